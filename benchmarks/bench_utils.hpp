@@ -0,0 +1,109 @@
+//
+// Shared helpers for the benchmarks
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+static const char *const kValidImages[] = {
+    "valid/avif/sample.avif",
+    "valid/avif/sample2.avif",
+    "valid/avif/sample3.avif",
+    "valid/bmp/sample.bmp",
+    "valid/bmp/sample2.bmp",
+    "valid/cur/sample.cur",
+    "valid/dds/sample.dds",
+    "valid/gif/animated.gif",
+    "valid/gif/sample.gif",
+    "valid/hdr/sample.hdr",
+    "valid/hdr/sample2.hdr",
+    "valid/heic/sample.heic",
+    "valid/heic/sample2.heic",
+    "valid/heic/sample3.heic",
+    "valid/heic/sample4.heic",
+    "valid/icns/sample.icns",
+    "valid/ico/multi-size-compressed.ico",
+    "valid/ico/multi-size.ico",
+    "valid/ico/sample-256-compressed.ico",
+    "valid/ico/sample-256.ico",
+    "valid/ico/sample-compressed.ico",
+    "valid/ico/sample.ico",
+    "valid/j2k/_00042.j2k",
+    "valid/j2k/balloon.j2k",
+    "valid/j2k/cthead1.j2k",
+    "valid/j2k/sample.j2k",
+    "valid/jp2/jpx_disguised_as_jp2.jp2",
+    "valid/jp2/sample.jp2",
+    "valid/jpg/1x2-flipped-big-endian.jpg",
+    "valid/jpg/1x2-flipped-little-endian.jpg",
+    "valid/jpg/large.jpg",
+    "valid/jpg/optimized.jpg",
+    "valid/jpg/progressive.jpg",
+    "valid/jpg/rotation-90.jpg",
+    "valid/jpg/sample.jpg",
+    "valid/jpg/sample2.jpg",
+    "valid/jpg/sampleExported.jpg",
+    "valid/jpg/very-large.jpg",
+    "valid/jph/byte.jph",
+    "valid/jpx/sample.jpx",
+    "valid/ktx/sample.ktx",
+    "valid/png/sample.png",
+    "valid/png/sample_apng.png",
+    "valid/png/sample_fried.png",
+    "valid/psd/sample.psd",
+    "valid/qoi/sample.qoi",
+    "valid/tga/sample.tga",
+    "valid/tiff/BigTIFF.tif",
+    "valid/tiff/BigTIFFLong.tif",
+    "valid/tiff/BigTIFFMotorola.tif",
+    "valid/tiff/big-endian.tiff",
+    "valid/tiff/jpeg.tiff",
+    "valid/tiff/little-endian.tiff",
+    "valid/tiff/pyramid.tif",
+    "valid/webp/animated.webp",
+    "valid/webp/extended.webp",
+    "valid/webp/lossless.webp",
+    "valid/webp/lossy.webp",
+};
+
+inline std::vector<std::string> valid_image_paths() {
+    std::vector<std::string> paths;
+    for (const char *image : kValidImages) {
+        paths.emplace_back(std::string(IMAGES_DIR) + image);
+    }
+    return paths;
+}
+
+inline bool load_file(const std::string &path, std::vector<uint8_t> &data) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data.resize(size > 0 ? (size_t)size : 0);
+    bool ok = fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    return ok;
+}
+
+class Timer {
+public:
+    Timer() : start_(std::chrono::steady_clock::now()) {}
+
+    inline double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace bench
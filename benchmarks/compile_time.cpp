@@ -0,0 +1,16 @@
+//
+// A typical user translation unit, compiled by compile_time.sh against the full and the lean header
+//
+
+#include <cstdio>
+
+#include "imageinfo.hpp"
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        auto info = imageinfo::parse<imageinfo::FilePathReader>(argv[i]);
+        printf("%s: %s %lldx%lld\n", argv[i], info.ext(), (long long)info.size().width,
+               (long long)info.size().height);
+    }
+    return 0;
+}
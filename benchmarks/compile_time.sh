@@ -0,0 +1,29 @@
+#!/bin/sh
+# Usage: compile_time.sh CXX SOURCE_DIR [RUNS]
+# Average time to compile benchmarks/compile_time.cpp header-only and against the lean header of imageinfo_static
+set -e
+
+CXX="$1"
+SOURCE_DIR="$2"
+RUNS="${3:-10}"
+OUT="${TMPDIR:-/tmp}/imageinfo_compile_time_$$.o"
+trap 'rm -f "$OUT"' EXIT
+
+now_ms() {
+    date +%s%N | cut -b1-13
+}
+
+measure() {
+    start=$(now_ms)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$CXX" -std=c++11 -O2 "$@" -I"$SOURCE_DIR/include" -c "$SOURCE_DIR/benchmarks/compile_time.cpp" -o "$OUT"
+        i=$((i + 1))
+    done
+    end=$(now_ms)
+    echo $(((end - start) / RUNS))
+}
+
+echo "$CXX, -O2, average of $RUNS runs"
+echo "header-only:       $(measure) ms"
+echo "IMAGEINFO_STATIC:  $(measure -DIMAGEINFO_STATIC) ms"
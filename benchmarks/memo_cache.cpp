@@ -0,0 +1,85 @@
+//
+// Throughput of MemoCache on a zipf-distributed replay of images/valid
+//
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bench_utils.hpp"
+#include "imageinfo.hpp"
+
+// Usage: imageinfo_bench_memo_cache [REQUESTS] [CAPACITY] [ZIPF_EXPONENT]
+int main(int argc, char **argv) {
+    size_t requests = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t capacity = argc > 2 ? strtoull(argv[2], nullptr, 10) : 4096;
+    double exponent = argc > 3 ? atof(argv[3]) : 1.1;
+    size_t threads = (std::max)(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::vector<uint8_t>> payloads;
+    for (const auto &path : bench::valid_image_paths()) {
+        std::vector<uint8_t> data;
+        if (!bench::load_file(path, data)) {
+            fprintf(stderr, "Failed to load %s\n", path.c_str());
+            return 1;
+        }
+        payloads.emplace_back(std::move(data));
+    }
+
+    // Rank i is requested with probability proportional to 1 / (i + 1)^s
+    std::vector<double> weights;
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        weights.push_back(1.0 / std::pow((double)(i + 1), exponent));
+    }
+    std::mt19937_64 rng(42);
+    std::discrete_distribution<size_t> zipf(weights.begin(), weights.end());
+    std::vector<size_t> replay(requests);
+    for (auto &index : replay) {
+        index = zipf(rng);
+    }
+
+    printf("payloads: %zu, requests: %zu, capacity: %zu, zipf s: %.2f, threads: %zu\n", payloads.size(), requests,
+           capacity, exponent, threads);
+
+    auto run = [&](size_t thread_count, imageinfo::MemoCache *cache) {
+        std::vector<std::thread> workers;
+        bench::Timer timer;
+        for (size_t t = 0; t < thread_count; ++t) {
+            workers.emplace_back([&, t]() {
+                for (size_t i = t; i < replay.size(); i += thread_count) {
+                    const auto &payload = payloads[replay[i]];
+                    imageinfo::RawData raw(payload.data(), payload.size());
+                    auto info = cache != nullptr ? imageinfo::parse_memo<imageinfo::RawDataReader>(*cache, raw)
+                                                 : imageinfo::parse<imageinfo::RawDataReader>(raw);
+                    if (!info) {
+                        abort();
+                    }
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        return (double)replay.size() / timer.seconds();
+    };
+
+    std::vector<size_t> thread_counts = {1};
+    if (threads > 1) {
+        thread_counts.push_back(threads);
+    }
+    for (size_t thread_count : thread_counts) {
+        double baseline = run(thread_count, nullptr);
+        imageinfo::MemoCache cache(capacity);
+        double memo = run(thread_count, &cache);
+        auto stats = cache.stats();
+        printf("threads: %2zu, parse: %12.0f/s, parse_memo: %12.0f/s, speedup: %5.2fx, hit rate: %5.1f%%, "
+               "evictions: %" PRIu64 "\n",
+               thread_count, baseline, memo, memo / baseline, 100.0 * stats.hits / (stats.hits + stats.misses),
+               stats.evictions);
+    }
+    return 0;
+}
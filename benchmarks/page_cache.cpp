@@ -0,0 +1,128 @@
+//
+// Page cache footprint of a bulk scan, with and without the ScanFileReader hints
+//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench_utils.hpp"
+#include "imageinfo.hpp"
+
+// Pages of `path` in the page cache, in bytes
+static size_t resident_bytes(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st {};
+    if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return 0;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (size_t)st.st_size;
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    std::vector<unsigned char> pages((size + page - 1) / page);
+    size_t resident = 0;
+    if (::mincore(map, size, (decltype(&pages[0]))pages.data()) == 0) {
+        for (unsigned char p : pages) {
+            resident += (p & 1) ? page : 0;
+        }
+    }
+    ::munmap(map, size);
+    return resident;
+}
+
+static void evict(const std::vector<std::string> &paths) {
+    for (const auto &path : paths) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            II_FADVISE(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+}
+
+// Usage: imageinfo_bench_page_cache [DIR] [COPIES]
+// DIR has to be on a disk backed file system, tmpfs pages cannot be dropped
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    size_t copies = argc > 2 ? strtoull(argv[2], nullptr, 10) : 8;
+
+    std::vector<std::string> paths;
+    size_t total = 0;
+    for (const auto &source : bench::valid_image_paths()) {
+        std::vector<uint8_t> data;
+        if (!bench::load_file(source, data)) {
+            fprintf(stderr, "Failed to load %s\n", source.c_str());
+            return 1;
+        }
+        for (size_t c = 0; c < copies; ++c) {
+            std::string path = dir + "/imageinfo_bench_" + std::to_string(paths.size()) +
+                               source.substr(source.find_last_of('.'));
+            FILE *file = fopen(path.c_str(), "wb");
+            if (file == nullptr || fwrite(data.data(), 1, data.size(), file) != data.size()) {
+                fprintf(stderr, "Failed to write %s\n", path.c_str());
+                return 1;
+            }
+            fclose(file);
+            paths.push_back(path);
+            total += data.size();
+        }
+    }
+    // Written pages are dirty until they reach the disk, and dirty pages cannot be dropped
+    sync();
+    printf("files: %zu, total: %.1f MiB\n", paths.size(), (double)total / (1 << 20));
+
+    auto run = [&](const char *name, size_t prefetch, unsigned hints, bool stdio) {
+        evict(paths);
+        size_t before = 0;
+        for (const auto &path : paths) {
+            before += resident_bytes(path);
+        }
+        bench::Timer timer;
+        if (stdio) {
+            for (const auto &path : paths) {
+                if (!imageinfo::parse<imageinfo::FilePathReader>(path)) {
+                    abort();
+                }
+            }
+        } else {
+            imageinfo::ScanQueue queue(paths, prefetch, hints);
+            imageinfo::ScanFile file;
+            while (queue.next(file)) {
+                if (!imageinfo::parse<imageinfo::ScanFileReader>(file)) {
+                    abort();
+                }
+            }
+        }
+        double seconds = timer.seconds();
+        size_t after = 0;
+        for (const auto &path : paths) {
+            after += resident_bytes(path);
+        }
+        printf("%-28s cached before: %8.1f KiB, after: %10.1f KiB, %8.0f files/s\n", name, (double)before / 1024,
+               (double)after / 1024, (double)paths.size() / seconds);
+    };
+
+    run("FilePathReader", 0, imageinfo::kPageCacheDefault, true);
+    run("ScanFileReader, no hints", 0, imageinfo::kPageCacheDefault, false);
+    run("no read-ahead", 0, imageinfo::kPageCacheNoReadAhead, false);
+    run("no read-ahead, drop", 0, imageinfo::kPageCacheScan, false);
+    run("no read-ahead, drop, K=8", 8, imageinfo::kPageCacheScan, false);
+
+    for (const auto &path : paths) {
+        ::unlink(path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace cli {
+
+int run_daemon(int argc, char **argv);
+
+int run_client(int argc, char **argv);
+
+int run_strip(int argc, char **argv);
+
+int run_index(int argc, char **argv);
+
+int run_watch(int argc, char **argv);
+
+int run_merge(int argc, char **argv);
+
+// Rows of several dimension indexes in one index at `output`, sorted by path, the last input holding a path wins
+int merge_indexes(const std::vector<std::string> &inputs, const char *output);
+
+}  // namespace cli
@@ -0,0 +1,390 @@
+//
+// Long-lived probe daemon over a Unix domain socket, and the matching client
+//
+// Protocol, one request per line:
+//   path<TAB>/absolute/path/to/file\n
+//   fd<TAB>label\n           (the descriptor is attached to the same message with SCM_RIGHTS)
+// Every request is answered with one NDJSON line, in request order.
+//
+
+#include "commands.hpp"
+#include "imageinfo.hpp"
+
+#ifdef II_POSIX
+
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "output.hpp"
+#include "thread_pool.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+#ifndef SOCK_CLOEXEC
+#define SOCK_CLOEXEC 0
+#endif
+
+namespace cli {
+
+namespace {
+
+const size_t kMaxFdsPerMessage = 64;
+
+struct Daemon {
+    explicit Daemon(size_t threads) : pool(threads) {}
+
+    ThreadPool pool;
+    imageinfo::MemoCache memo{65536};
+    imageinfo::ResultCache result_cache;
+    std::mutex result_cache_mutex;
+};
+
+struct Request {
+    bool is_fd = false;
+    std::string name;
+    int fd = -1;
+};
+
+bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Receive once, keeping any attached descriptors in arrival order
+bool receive(int conn, std::string &pending, std::deque<int> &fds) {
+    char data[65536];
+    char control[CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage)];
+    struct iovec iov = {data, sizeof(data)};
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+    }
+    pending.append(data, (size_t)n);
+    return true;
+}
+
+imageinfo::ImageInfo parse_fd(Daemon &daemon, int fd) {
+    return imageinfo::parse_memo<imageinfo::FileDescriptorReader>(daemon.memo, fd);
+}
+
+imageinfo::ImageInfo parse_path(Daemon &daemon, const std::string &path) {
+    imageinfo::ResultCacheKey key;
+    bool cacheable = daemon.result_cache.is_open() && imageinfo::make_result_cache_key(path, key);
+    imageinfo::ImageInfo info;
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(daemon.result_cache_mutex);
+        if (daemon.result_cache.lookup(key, info)) {
+            return info;
+        }
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return imageinfo::ImageInfo(imageinfo::kUnrecognizedFormat);
+    }
+    info = parse_fd(daemon, fd);
+    ::close(fd);
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(daemon.result_cache_mutex);
+        daemon.result_cache.store(key, info);
+    }
+    return info;
+}
+
+void serve(Daemon &daemon, int conn) {
+    std::string pending;
+    std::deque<int> fds;
+    while (receive(conn, pending, fds)) {
+        // Every complete line received so far forms one batch
+        std::vector<Request> batch;
+        size_t start = 0;
+        for (size_t end; (end = pending.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string line = pending.substr(start, end - start);
+            Request request;
+            if (line.compare(0, 3, "fd\t") == 0) {
+                request.is_fd = true;
+                request.name = line.substr(3);
+                if (!fds.empty()) {
+                    request.fd = fds.front();
+                    fds.pop_front();
+                }
+            } else if (line.compare(0, 5, "path\t") == 0) {
+                request.name = line.substr(5);
+            } else {
+                request.name = line;
+            }
+            batch.push_back(std::move(request));
+        }
+        pending.erase(0, start);
+        if (batch.empty()) {
+            continue;
+        }
+
+        std::vector<std::string> responses(batch.size());
+        daemon.pool.parallel_for(batch.size(), [&](size_t i) {
+            const auto &request = batch[i];
+            imageinfo::ImageInfo info(imageinfo::kUnrecognizedFormat);
+            if (request.is_fd) {
+                if (request.fd >= 0) {
+                    info = parse_fd(daemon, request.fd);
+                }
+            } else {
+                info = parse_path(daemon, request.name);
+            }
+            responses[i] = info_to_json(request.is_fd ? "fd" : "path", request.name, info) + "\n";
+        });
+        for (const auto &request : batch) {
+            if (request.fd >= 0) {
+                ::close(request.fd);
+            }
+        }
+
+        std::string out;
+        for (const auto &response : responses) {
+            out += response;
+        }
+        if (!write_all(conn, out.data(), out.size())) {
+            break;
+        }
+    }
+    for (int fd : fds) {
+        ::close(fd);
+    }
+    ::close(conn);
+}
+
+char g_socket_path[sizeof(sockaddr_un::sun_path)];
+
+void on_terminate(int) {
+    ::unlink(g_socket_path);
+    _exit(0);
+}
+
+bool make_address(const char *path, sockaddr_un &addr) {
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+}  // namespace
+
+int run_daemon(int argc, char **argv) {
+    size_t threads = 0;
+    const char *cache_path = nullptr;
+    const char *socket_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else {
+            socket_path = argv[i];
+        }
+    }
+    if (socket_path == nullptr) {
+        fprintf(stderr, "Usage: imageinfo daemon [--threads N] [--cache FILE] SOCKET\n");
+        return 1;
+    }
+
+    sockaddr_un addr{};
+    if (!make_address(socket_path, addr)) {
+        return 1;
+    }
+
+    Daemon daemon(threads);
+    if (cache_path != nullptr && !daemon.result_cache.open(cache_path)) {
+        fprintf(stderr, "Failed to open cache: %s\n", cache_path);
+        return 1;
+    }
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    ::unlink(socket_path);
+    if (::bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(listener, 128) != 0) {
+        perror("bind");
+        ::close(listener);
+        return 1;
+    }
+    strncpy(g_socket_path, socket_path, sizeof(g_socket_path) - 1);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_terminate);
+    signal(SIGTERM, on_terminate);
+
+    for (;;) {
+        int conn = ::accept(listener, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        std::thread([&daemon, conn]() { serve(daemon, conn); }).detach();
+    }
+    ::close(listener);
+    ::unlink(socket_path);
+    return 1;
+}
+
+int run_client(int argc, char **argv) {
+    bool pass_fd = false;
+    const char *socket_path = nullptr;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--fd") == 0) {
+            pass_fd = true;
+        } else if (socket_path == nullptr) {
+            socket_path = argv[i];
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (socket_path == nullptr || files.empty()) {
+        fprintf(stderr, "Usage: imageinfo client [--fd] SOCKET FILE...\n");
+        return 1;
+    }
+
+    sockaddr_un addr{};
+    if (!make_address(socket_path, addr)) {
+        return 1;
+    }
+    int conn = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || ::connect(conn, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Read answers concurrently so a large batch can not fill both socket buffers
+    std::thread reader([conn]() {
+        char buf[65536];
+        ssize_t n;
+        while ((n = ::recv(conn, buf, sizeof(buf), 0)) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) {
+                fwrite(buf, 1, (size_t)n, stdout);
+            }
+        }
+        fflush(stdout);
+    });
+
+    int status = 0;
+    for (const char *file : files) {
+        std::string line;
+        if (pass_fd) {
+            int fd = ::open(file, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                fprintf(stderr, "Failed to open %s\n", file);
+                status = 1;
+                continue;
+            }
+            line = std::string("fd\t") + file + "\n";
+            char control[CMSG_SPACE(sizeof(int))] = {};
+            struct iovec iov = {(void *)line.data(), line.size()};
+            struct msghdr msg {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+            ssize_t n = ::sendmsg(conn, &msg, MSG_NOSIGNAL);
+            ::close(fd);
+            // The descriptor travels with the first byte, the rest of the line may follow separately
+            if (n < 0 || !write_all(conn, line.data() + n, line.size() - (size_t)n)) {
+                status = 1;
+                break;
+            }
+        } else {
+            char resolved[PATH_MAX];
+            line = std::string("path\t") + (::realpath(file, resolved) != nullptr ? resolved : file) + "\n";
+            if (!write_all(conn, line.data(), line.size())) {
+                status = 1;
+                break;
+            }
+        }
+    }
+    ::shutdown(conn, SHUT_WR);
+    reader.join();
+    ::close(conn);
+    return status;
+}
+
+}  // namespace cli
+
+#else
+
+#include <cstdio>
+
+namespace cli {
+
+int run_daemon(int, char **) {
+    fprintf(stderr, "daemon is not supported on this platform\n");
+    return 1;
+}
+
+int run_client(int, char **) {
+    fprintf(stderr, "client is not supported on this platform\n");
+    return 1;
+}
+
+}  // namespace cli
+
+#endif
@@ -0,0 +1,667 @@
+//
+// Columnar dimension index of a directory tree, built once and queried without touching the images again
+//
+// Layout, version 1, every integer little-endian, every section aligned to 64 bytes:
+//   header     magic "IIDX", version(4), row count(8), then the offsets of the sections below(8 each)
+//   formats    dictionary: name count(1), then length(1) and name of each, code 0 is unrecognized
+//   format     uint8 code per row
+//   channels   uint8 per row, 0 when unknown
+//   width      uint32 per row, saturated
+//   height     uint32 per row, saturated
+//   entries    uint32 entry count per row, icons and cursors
+//   paths      uint64 offset per row plus one into the path blob, then the blob itself
+//
+// Usage:
+//   imageinfo index build [--threads N] [--prefetch K] [--shard i/N] -o INDEX DIR...
+//     files are read with the page cache hints of imageinfo::kPageCacheScan, K files ahead of each thread,
+//     with --shard only the files of shard i of N, see cli::Shard, and `imageinfo merge` joins the shards
+//   imageinfo index query [--count] INDEX TERM... [or TERM...]...
+//     TERM is FIELD OP VALUE with FIELD one of format, width, height, channels, entries and OP one of
+//     = != < <= > >=, terms are joined with and, groups with or
+//
+
+#include "commands.hpp"
+#include "imageinfo.hpp"
+
+#ifdef II_POSIX
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "shard.hpp"
+#include "thread_pool.hpp"
+
+namespace cli {
+
+namespace {
+
+const char kIndexMagic[4] = {'I', 'I', 'D', 'X'};
+const uint32_t kIndexVersion = 1;
+const size_t kIndexHeaderSize = 128;
+const size_t kIndexAlign = 64;
+// Rows filtered per pass, the masks of a block stay in L1
+const size_t kQueryBlock = 4096;
+
+enum IndexSection {
+    kSectionFormats = 0,
+    kSectionFormat,
+    kSectionChannels,
+    kSectionWidth,
+    kSectionHeight,
+    kSectionEntries,
+    kSectionPathOffsets,
+    kSectionPaths,
+    kSectionEnd,
+    SECTION_COUNT,
+};
+
+struct Row {
+    const char *format = nullptr;
+    uint8_t channels = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t entries = 0;
+};
+
+inline void put_le(uint8_t *p, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        p[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+inline uint64_t get_le(const uint8_t *p, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        value |= (uint64_t)p[i] << (i * 8);
+    }
+    return value;
+}
+
+inline uint32_t saturate_u32(int64_t value) {
+    return value <= 0 ? 0 : value >= (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+// Regular files under `path` in name order, symbolic links are not followed
+void walk(const std::string &path, std::vector<std::string> &files) {
+    DIR *dir = ::opendir(path.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    std::vector<std::string> names;
+    while (dirent *entry = ::readdir(dir)) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            names.emplace_back(entry->d_name);
+        }
+    }
+    ::closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const auto &name : names) {
+        std::string child = path.back() == '/' ? path + name : path + "/" + name;
+        struct stat st {};
+        if (::lstat(child.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            walk(child, files);
+        } else if (S_ISREG(st.st_mode)) {
+            files.push_back(child);
+        }
+    }
+}
+
+class SectionWriter {
+public:
+    explicit SectionWriter(FILE *file) : file_(file) {}
+
+    inline void write(const void *data, size_t size) {
+        ok_ = ok_ && (size == 0 || fwrite(data, 1, size, file_) == size);
+        offset_ += size;
+    }
+
+    // Pads to the next section, returns its offset
+    inline uint64_t align() {
+        static const uint8_t zeros[kIndexAlign] = {};
+        write(zeros, (kIndexAlign - offset_ % kIndexAlign) % kIndexAlign);
+        return offset_;
+    }
+
+    template <typename T>
+    inline void column(const std::vector<Row> &rows, size_t size, T field) {
+        uint8_t buf[4096];
+        size_t n = 0;
+        for (const auto &row : rows) {
+            put_le(buf + n, field(row), size);
+            n += size;
+            if (n + size > sizeof(buf)) {
+                write(buf, n);
+                n = 0;
+            }
+        }
+        write(buf, n);
+    }
+
+    inline bool ok() const { return ok_; }
+
+private:
+    FILE *file_;
+    uint64_t offset_ = 0;
+    bool ok_ = true;
+};
+
+// Writes the rows and paths as an index at `output`, rows[i].format is nullptr for unrecognized files
+bool write_index(const char *output, const std::vector<std::string> &files, const std::vector<Row> &rows,
+                 size_t &format_count) {
+    std::vector<std::string> format_names;
+    std::vector<uint8_t> codes(rows.size(), 0);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (rows[i].format == nullptr) {
+            continue;
+        }
+        auto it = std::find(format_names.begin(), format_names.end(), rows[i].format);
+        if (it == format_names.end()) {
+            it = format_names.insert(format_names.end(), rows[i].format);
+        }
+        codes[i] = (uint8_t)(it - format_names.begin() + 1);
+    }
+
+    // Written next to the index and renamed over it, a reader never maps a half-written file
+    std::string tmp_path = std::string(output) + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to create: %s\n", tmp_path.c_str());
+        return false;
+    }
+    SectionWriter writer(file);
+    uint64_t sections[SECTION_COUNT] = {};
+    uint8_t header[kIndexHeaderSize] = {};
+    writer.write(header, sizeof(header));
+
+    sections[kSectionFormats] = writer.align();
+    uint8_t name_count = (uint8_t)format_names.size();
+    writer.write(&name_count, 1);
+    for (const auto &name : format_names) {
+        uint8_t size = (uint8_t)name.size();
+        writer.write(&size, 1);
+        writer.write(name.data(), size);
+    }
+    sections[kSectionFormat] = writer.align();
+    writer.write(codes.data(), codes.size());
+    sections[kSectionChannels] = writer.align();
+    writer.column(rows, 1, [](const Row &row) { return row.channels; });
+    sections[kSectionWidth] = writer.align();
+    writer.column(rows, 4, [](const Row &row) { return row.width; });
+    sections[kSectionHeight] = writer.align();
+    writer.column(rows, 4, [](const Row &row) { return row.height; });
+    sections[kSectionEntries] = writer.align();
+    writer.column(rows, 4, [](const Row &row) { return row.entries; });
+    sections[kSectionPathOffsets] = writer.align();
+    uint64_t path_offset = 0;
+    uint8_t buf[8];
+    for (const auto &path : files) {
+        put_le(buf, path_offset, 8);
+        writer.write(buf, 8);
+        path_offset += path.size();
+    }
+    put_le(buf, path_offset, 8);
+    writer.write(buf, 8);
+    sections[kSectionPaths] = writer.align();
+    for (const auto &path : files) {
+        writer.write(path.data(), path.size());
+    }
+    sections[kSectionEnd] = writer.align();
+
+    memcpy(header, kIndexMagic, 4);
+    put_le(header + 4, kIndexVersion, 4);
+    put_le(header + 8, rows.size(), 8);
+    for (size_t i = 0; i < SECTION_COUNT; ++i) {
+        put_le(header + 16 + i * 8, sections[i], 8);
+    }
+    bool ok = writer.ok() && fseek(file, 0, SEEK_SET) == 0 && fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || ::rename(tmp_path.c_str(), output) != 0) {
+        fprintf(stderr, "Failed to write: %s\n", output);
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+    format_count = format_names.size();
+    return true;
+}
+
+int index_build(int argc, char **argv) {
+    size_t threads = 0;
+    size_t prefetch = 4;
+    const char *output = nullptr;
+    Shard shard;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (!shard.parse(argv[++i])) {
+                fprintf(stderr, "Invalid --shard, expected i/N with 0 <= i < N: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            prefetch = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            struct stat st {};
+            if (::stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+                walk(argv[i], files);
+            } else {
+                files.emplace_back(argv[i]);
+            }
+        }
+    }
+    if (output == nullptr || files.empty()) {
+        fprintf(stderr, "Usage: imageinfo index build [--threads N] [--prefetch K] [--shard i/N] -o INDEX DIR...\n");
+        return 1;
+    }
+    files.erase(std::remove_if(files.begin(), files.end(), [&](const std::string &file) { return !shard.owns(file); }),
+                files.end());
+
+    // Every row is written by exactly one task, blocks keep the task count low for large trees
+    std::vector<Row> rows(files.size());
+    {
+        ThreadPool pool(threads);
+        const size_t block = 256;
+        pool.parallel_for((files.size() + block - 1) / block, [&](size_t b) {
+            imageinfo::ScanQueue queue(files, b * block, (b + 1) * block, prefetch);
+            imageinfo::ScanFile file;
+            for (size_t i = b * block; queue.next(file); ++i) {
+                auto info = imageinfo::parse<imageinfo::ScanFileReader>(file);
+                if (!info) {
+                    continue;
+                }
+                rows[i].format = info.full_ext();
+                rows[i].channels = (uint8_t)(std::max)(0, info.channels());
+                rows[i].width = saturate_u32(info.size().width);
+                rows[i].height = saturate_u32(info.size().height);
+                rows[i].entries = (uint32_t)info.entry_sizes().size();
+            }
+        });
+    }
+
+    size_t format_count = 0;
+    if (!write_index(output, files, rows, format_count)) {
+        return 1;
+    }
+    fprintf(stderr, "Indexed %zu files, %zu formats\n", files.size(), format_count);
+    return 0;
+}
+
+enum QueryOp { kOpEq, kOpNe, kOpLt, kOpLe, kOpGt, kOpGe };
+
+struct QueryTerm {
+    IndexSection column;
+    QueryOp op;
+    uint32_t value;
+};
+
+// mask[i] &= column[i] OP value, without branches or aliasing. The body is a multiple of 16 rows, which
+// compilers vectorise even at -O2 where they would not add a scalar epilogue of their own
+template <typename T, typename Cmp>
+inline void filter(const T *__restrict column, size_t n, T value, uint8_t *__restrict mask, Cmp cmp) {
+    size_t body = n & ~(size_t)15;
+    for (size_t i = 0; i < body; ++i) {
+        mask[i] &= (uint8_t)cmp(column[i], value);
+    }
+    for (size_t i = body; i < n; ++i) {
+        mask[i] &= (uint8_t)cmp(column[i], value);
+    }
+}
+
+template <typename T>
+inline void filter(const T *column, size_t n, QueryOp op, T value, uint8_t *mask) {
+    switch (op) {
+        case kOpEq:
+            return filter(column, n, value, mask, [](T a, T b) { return a == b; });
+        case kOpNe:
+            return filter(column, n, value, mask, [](T a, T b) { return a != b; });
+        case kOpLt:
+            return filter(column, n, value, mask, [](T a, T b) { return a < b; });
+        case kOpLe:
+            return filter(column, n, value, mask, [](T a, T b) { return a <= b; });
+        case kOpGt:
+            return filter(column, n, value, mask, [](T a, T b) { return a > b; });
+        case kOpGe:
+            return filter(column, n, value, mask, [](T a, T b) { return a >= b; });
+    }
+}
+
+class MappedIndex {
+public:
+    ~MappedIndex() {
+        if (data_ != nullptr) {
+            ::munmap((void *)data_, size_);
+        }
+    }
+
+    inline bool open(const char *path) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) == 0 && (size_t)st.st_size >= kIndexHeaderSize) {
+            size_ = (size_t)st.st_size;
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            data_ = p == MAP_FAILED ? nullptr : (const uint8_t *)p;
+        }
+        ::close(fd);
+        if (data_ == nullptr || memcmp(data_, kIndexMagic, 4) != 0 || get_le(data_ + 4, 4) != kIndexVersion) {
+            return false;
+        }
+        count_ = get_le(data_ + 8, 8);
+        for (size_t i = 0; i < SECTION_COUNT; ++i) {
+            sections_[i] = get_le(data_ + 16 + i * 8, 8);
+            if (sections_[i] > size_ || (i > 0 && sections_[i] < sections_[i - 1])) {
+                return false;
+            }
+        }
+        const size_t widths[] = {0, 1, 1, 4, 4, 4, 8};
+        for (size_t i = kSectionFormat; i <= kSectionPathOffsets; ++i) {
+            if (count_ + (i == kSectionPathOffsets) > (sections_[i + 1] - sections_[i]) / widths[i]) {
+                return false;
+            }
+        }
+        const uint8_t *p = data_ + sections_[kSectionFormats];
+        const uint8_t *end = data_ + sections_[kSectionFormat];
+        size_t format_count = p < end ? *p++ : 0;
+        for (size_t i = 0; i < format_count && p < end && p + 1 + *p <= end; ++i) {
+            formats_.emplace_back((const char *)p + 1, *p);
+            p += 1 + *p;
+        }
+        return formats_.size() == format_count;
+    }
+
+    inline uint64_t count() const { return count_; }
+
+    // Code of no row for a format the index doesn't list, 0 is taken by unrecognized files
+    static constexpr uint8_t kNoFormatCode = 0xFF;
+
+    inline uint8_t format_code(const std::string &name) const {
+        for (size_t i = 0; i < formats_.size(); ++i) {
+            if (formats_[i] == name) {
+                return (uint8_t)(i + 1);
+            }
+        }
+        return kNoFormatCode;
+    }
+
+    // Rows [start, start + n) of a column, straight from the mapping on little-endian hosts
+    template <typename T>
+    inline const T *column(IndexSection section, uint64_t start, size_t n, std::vector<T> &scratch) const {
+        const uint8_t *p = data_ + sections_[section] + start * sizeof(T);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        (void)n;
+        (void)scratch;
+        return (const T *)p;
+#else
+        scratch.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            scratch[i] = (T)get_le(p + i * sizeof(T), sizeof(T));
+        }
+        return scratch.data();
+#endif
+    }
+
+    inline Row row(uint64_t i) const {
+        Row row;
+        uint8_t code = data_[sections_[kSectionFormat] + i];
+        row.format = code >= 1 && code <= formats_.size() ? formats_[code - 1].c_str() : nullptr;
+        row.channels = data_[sections_[kSectionChannels] + i];
+        row.width = (uint32_t)get_le(data_ + sections_[kSectionWidth] + i * 4, 4);
+        row.height = (uint32_t)get_le(data_ + sections_[kSectionHeight] + i * 4, 4);
+        row.entries = (uint32_t)get_le(data_ + sections_[kSectionEntries] + i * 4, 4);
+        return row;
+    }
+
+    inline std::string path(uint64_t row) const {
+        const uint8_t *offsets = data_ + sections_[kSectionPathOffsets];
+        uint64_t begin = get_le(offsets + row * 8, 8);
+        uint64_t end = get_le(offsets + row * 8 + 8, 8);
+        uint64_t blob_size = sections_[kSectionEnd] - sections_[kSectionPaths];
+        if (begin > end || end > blob_size) {
+            return std::string();
+        }
+        return std::string((const char *)data_ + sections_[kSectionPaths] + begin, (size_t)(end - begin));
+    }
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    uint64_t count_ = 0;
+    uint64_t sections_[SECTION_COUNT] = {};
+    std::vector<std::string> formats_;
+};
+
+bool parse_term(const MappedIndex &index, const char *text, QueryTerm &term) {
+    static const struct {
+        const char *name;
+        IndexSection column;
+    } fields[] = {
+        {"format", kSectionFormat},
+        {"channels", kSectionChannels},
+        {"width", kSectionWidth},
+        {"height", kSectionHeight},
+        {"entries", kSectionEntries},
+    };
+    // Two character operators first
+    static const struct {
+        const char *text;
+        QueryOp op;
+    } ops[] = {
+        {"!=", kOpNe}, {"<=", kOpLe}, {">=", kOpGe}, {"=", kOpEq}, {"<", kOpLt}, {">", kOpGt},
+    };
+    std::string str(text);
+    size_t pos = str.find_first_of("=!<>");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    std::string field = str.substr(0, pos);
+    std::string value;
+    bool found = false;
+    for (const auto &op : ops) {
+        if (str.compare(pos, strlen(op.text), op.text) == 0) {
+            term.op = op.op;
+            value = str.substr(pos + strlen(op.text));
+            found = true;
+            break;
+        }
+    }
+    if (!found || value.empty()) {
+        return false;
+    }
+    for (const auto &f : fields) {
+        if (field != f.name) {
+            continue;
+        }
+        term.column = f.column;
+        if (f.column == kSectionFormat) {
+            // Codes are only ordered by first appearance, formats compare for equality
+            term.value = index.format_code(value);
+            return term.op == kOpEq || term.op == kOpNe;
+        }
+        char *end = nullptr;
+        unsigned long long number = strtoull(value.c_str(), &end, 10);
+        term.value = (uint32_t)(std::min)(number, (unsigned long long)UINT32_MAX);
+        return *end == '\0' && (f.column != kSectionChannels || number <= 255);
+    }
+    return false;
+}
+
+int index_query(int argc, char **argv) {
+    bool count_only = false;
+    const char *path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--count") == 0) {
+            count_only = true;
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (path == nullptr) {
+        fprintf(stderr, "Usage: imageinfo index query [--count] INDEX TERM... [or TERM...]...\n");
+        return 1;
+    }
+    MappedIndex index;
+    if (!index.open(path)) {
+        fprintf(stderr, "Not an index of version %u: %s\n", kIndexVersion, path);
+        return 1;
+    }
+
+    // Disjunction of conjunctions, no terms matches every row
+    std::vector<std::vector<QueryTerm>> groups(1);
+    for (const char *arg : args) {
+        if (strcmp(arg, "or") == 0) {
+            groups.emplace_back();
+            continue;
+        }
+        if (strcmp(arg, "and") == 0) {
+            continue;
+        }
+        QueryTerm term{};
+        if (!parse_term(index, arg, term)) {
+            fprintf(stderr, "Invalid term: %s\n", arg);
+            return 1;
+        }
+        groups.back().push_back(term);
+    }
+
+    uint64_t matches = 0;
+    std::vector<uint8_t> mask(kQueryBlock);
+    std::vector<uint8_t> group_mask(kQueryBlock);
+    std::vector<uint8_t> u8_scratch;
+    std::vector<uint32_t> u32_scratch;
+    for (uint64_t start = 0; start < index.count(); start += kQueryBlock) {
+        size_t n = (size_t)(std::min)((uint64_t)kQueryBlock, index.count() - start);
+        std::fill(mask.begin(), mask.begin() + n, 0);
+        for (const auto &group : groups) {
+            std::fill(group_mask.begin(), group_mask.begin() + n, 1);
+            for (const auto &term : group) {
+                if (term.column == kSectionFormat || term.column == kSectionChannels) {
+                    filter(index.column<uint8_t>(term.column, start, n, u8_scratch), n, term.op,
+                           (uint8_t)term.value, group_mask.data());
+                } else {
+                    filter(index.column<uint32_t>(term.column, start, n, u32_scratch), n, term.op, term.value,
+                           group_mask.data());
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                mask[i] |= group_mask[i];
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (!mask[i]) {
+                continue;
+            }
+            ++matches;
+            if (!count_only) {
+                printf("%s\n", index.path(start + i).c_str());
+            }
+        }
+    }
+    if (count_only) {
+        printf("%" PRIu64 "\n", matches);
+    }
+    return 0;
+}
+
+}  // namespace
+
+int merge_indexes(const std::vector<std::string> &inputs, const char *output) {
+    std::vector<std::unique_ptr<MappedIndex>> indexes;
+    // Path, then input and row, sorted so the last input of a path comes last
+    std::vector<std::pair<std::string, std::pair<size_t, uint64_t>>> keys;
+    for (const auto &input : inputs) {
+        indexes.emplace_back(new MappedIndex());
+        if (!indexes.back()->open(input.c_str())) {
+            fprintf(stderr, "Failed to open index: %s\n", input.c_str());
+            return 1;
+        }
+        for (uint64_t i = 0; i < indexes.back()->count(); ++i) {
+            keys.emplace_back(indexes.back()->path(i), std::make_pair(indexes.size() - 1, i));
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<std::string> files;
+    std::vector<Row> rows;
+    size_t duplicates = 0;
+    size_t conflicts = 0;
+    for (size_t k = 0; k < keys.size(); ++k) {
+        const auto &key = keys[k];
+        Row row = indexes[key.second.first]->row(key.second.second);
+        if (!files.empty() && files.back() == key.first) {
+            const Row &last = rows.back();
+            bool same = (last.format == nullptr) == (row.format == nullptr) &&
+                        (row.format == nullptr || strcmp(last.format, row.format) == 0) &&
+                        last.channels == row.channels && last.width == row.width && last.height == row.height &&
+                        last.entries == row.entries;
+            ++duplicates;
+            conflicts += same ? 0 : 1;
+            rows.back() = row;
+            continue;
+        }
+        files.push_back(key.first);
+        rows.push_back(row);
+    }
+
+    size_t format_count = 0;
+    if (!write_index(output, files, rows, format_count)) {
+        return 1;
+    }
+    size_t unrecognized = 0;
+    for (const auto &row : rows) {
+        unrecognized += row.format == nullptr ? 1 : 0;
+    }
+    fprintf(stderr, "Merged %zu indexes: %zu files, %zu formats, %zu unrecognized, %zu duplicates, %zu conflicting\n",
+            inputs.size(), files.size(), format_count, unrecognized, duplicates, conflicts);
+    return 0;
+}
+
+int run_index(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "build") == 0) {
+        return index_build(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "query") == 0) {
+        return index_query(argc - 1, argv + 1);
+    }
+    fprintf(stderr, "Usage: imageinfo index build|query ...\n");
+    return 1;
+}
+
+}  // namespace cli
+
+#else
+
+#include <cstdio>
+
+namespace cli {
+
+int run_index(int, char **) {
+    fprintf(stderr, "index is not supported on this platform\n");
+    return 1;
+}
+
+int merge_indexes(const std::vector<std::string> &, const char *) {
+    fprintf(stderr, "index is not supported on this platform\n");
+    return 1;
+}
+
+}  // namespace cli
+
+#endif
@@ -1,34 +1,276 @@
-#include <cinttypes>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
 
+#include "commands.hpp"
 #include "imageinfo.hpp"
+#include "output.hpp"
+#include "shard.hpp"
+#include "stats.hpp"
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [OPTIONS] [FILE]...\n", program);
+    printf("\n");
+    printf("Options:\n");
+    printf("  --json         Print one NDJSON record per file\n");
+    printf("  --no-exif      Skip the JPEG EXIF orientation, sizes are reported as stored\n");
+    printf("  --tiff-levels  Walk TIFF IFDs and SubIFDs for reduced-resolution levels\n");
+    printf("  --thumbnails   Locate embedded EXIF, HEIF and PSD thumbnails\n");
+    printf("  --metadata     Locate EXIF, XMP and ICC profile blocks\n");
+    printf("  --verify       Check PNG IHDR CRCs, the WebP RIFF size, JPEG segment lengths and ISOBMFF boxes\n");
+    printf("  --verify=full  Read whole files: every PNG chunk CRC, every WebP chunk, JPEG markers up to EOI\n");
+    printf("  --truncation   Report files ending before their trailer or declared length as truncated\n");
+    printf("  --plan WxH     Print the cheapest decode reduction covering a WxH thumbnail\n");
+    printf("  --members      Treat FILEs as tar or zip archives and print every member as ARCHIVE:MEMBER\n");
+    printf("  --stats        Print throughput, latency percentiles per format, errors and slowest files to stderr\n");
+    printf("  --slowest N    Number of slowest files listed by --stats, 10 by default\n");
+    printf("  --shard i/N    Only FILEs of shard i of N, partitioned by the CRC-32 of their paths\n");
+    printf("  --frame-budget BYTES\n");
+    printf("                 Read up to BYTES past the header to count GIF, WebP and AVIF frames\n");
+#ifdef II_POSIX
+    printf("  --cache FILE   Persistent result cache, unchanged files are answered without being opened.\n");
+    printf("                 Holds results of the default options, not combined with them, --members or --scan\n");
+    printf("  --scan         Keep files out of the page cache: no read-ahead, pages dropped once parsed, no atime\n");
+    printf("  --prefetch K   With --scan, open the next K files ahead and request their headers\n");
+    printf("\n");
+    printf("Commands:\n");
+    printf("  daemon [--threads N] [--cache FILE] SOCKET   Serve requests on a Unix domain socket\n");
+    printf("  client [--fd] SOCKET FILE...                 Ask a running daemon, optionally passing descriptors\n");
+    printf("  strip INPUT OUTPUT                           Copy a JPEG, PNG or WebP without EXIF, XMP and text\n");
+    printf("  index build [--threads N] [--prefetch K] -o INDEX DIR...\n");
+    printf("                                               Write a columnar size index of every file under DIRs\n");
+    printf("  index query [--count] INDEX TERM...          Print the paths matching TERMs, e.g. width>4000 or\n");
+    printf("                                               format=jpeg channels=4\n");
+    printf("  watch [--threads N] [--debounce MS] DIR...   Scan DIRs, then print NDJSON updates as files change\n");
+    printf("  merge [-o OUTPUT] INPUT...                   Merge --json outputs or indexes of shards by path\n");
+#endif
+}
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: %s [FILE]...\n", argv[0]);
-        return 1;
+    if (argc >= 2 && strcmp(argv[1], "daemon") == 0) {
+        return cli::run_daemon(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "client") == 0) {
+        return cli::run_client(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "strip") == 0) {
+        return cli::run_strip(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "index") == 0) {
+        return cli::run_index(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "watch") == 0) {
+        return cli::run_watch(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "merge") == 0) {
+        return cli::run_merge(argc - 1, argv + 1);
     }
 
+    std::vector<const char *> files;
+    bool json = false;
+    bool members = false;
+    bool stats = false;
+    size_t slowest = 10;
+    cli::Shard shard;
+    imageinfo::ParseOptions options;
+    imageinfo::ImageSize plan_target;
+#ifdef II_POSIX
+    const char *cache_path = nullptr;
+    bool scan = false;
+    size_t prefetch = 0;
+#endif
     for (int i = 1; i < argc; ++i) {
-        const char *file = argv[i];
-        auto info = imageinfo::parse<imageinfo::FilePathReader>(file);
-        printf("File: %s\n", file);
-        if (!info) {
-            printf("  - Error    : %s\n", info.error_msg());
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-exif") == 0) {
+            options.read_exif = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--tiff-levels") == 0) {
+            options.read_tiff_levels = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--thumbnails") == 0) {
+            options.read_thumbnails = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--metadata") == 0) {
+            options.read_metadata = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--verify") == 0) {
+            options.verify = imageinfo::kVerifyHeader;
+            continue;
+        }
+        if (strcmp(argv[i], "--verify=full") == 0) {
+            options.verify = imageinfo::kVerifyFull;
+            continue;
+        }
+        if (strcmp(argv[i], "--truncation") == 0) {
+            options.check_truncation = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--members") == 0) {
+            members = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--slowest") == 0 && i + 1 < argc) {
+            slowest = strtoul(argv[++i], nullptr, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (!shard.parse(argv[++i])) {
+                fprintf(stderr, "Invalid --shard, expected i/N with 0 <= i < N: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--plan") == 0 && i + 1 < argc) {
+            long long width = 0;
+            long long height = 0;
+            if (sscanf(argv[++i], "%lldx%lld", &width, &height) != 2 || width <= 0 || height <= 0) {
+                fprintf(stderr, "Invalid --plan size: %s\n", argv[i]);
+                return 1;
+            }
+            plan_target = imageinfo::ImageSize(width, height);
+            continue;
+        }
+        if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            options.frame_scan_budget = strtoull(argv[++i], nullptr, 10);
+            continue;
+        }
+#ifdef II_POSIX
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--scan") == 0) {
+            scan = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            prefetch = strtoul(argv[++i], nullptr, 10);
+            continue;
+        }
+#endif
+        files.push_back(argv[i]);
+    }
+
+    if (files.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // A shard may well be empty, that is not a usage error
+    files.erase(std::remove_if(files.begin(), files.end(), [&](const char *file) { return !shard.owns(file); }),
+                files.end());
+
+#ifdef II_POSIX
+    // Rather than parse some files around the cache without a word
+    if (cache_path != nullptr &&
+        (members || scan || options.fingerprint() != imageinfo::ParseOptions().fingerprint())) {
+        fprintf(stderr, "--cache holds results of the default options, it is not combined with options changing "
+                        "results, --members or --scan\n");
+        return 1;
+    }
+    imageinfo::ResultCache cache;
+    if (cache_path != nullptr && !cache.open(cache_path)) {
+        fprintf(stderr, "Failed to open cache: %s\n", cache_path);
+        return 1;
+    }
+#endif
+
+    auto report = [&](const std::string &name, const imageinfo::ImageInfo &info) {
+        bool plan = plan_target.width > 0 && info.ok();
+        if (json) {
+            auto record = cli::info_to_json("path", name, info);
+            if (plan) {
+                record.insert(record.size() - 1, "," + cli::plan_to_json(imageinfo::plan_decode(info, plan_target)));
+            }
+            printf("%s\n", record.c_str());
         } else {
-            printf("  - Format   : %d\n", info.format());
-            printf("  - Ext      : %s\n", info.ext());
-            printf("  - Full Ext : %s\n", info.full_ext());
-            printf("  - Size     : {width: %" PRId64 ", height: %" PRId64 "}\n", info.size().width, info.size().height);
-            printf("  - Mimetype : %s\n", info.mimetype());
-            if (!info.entry_sizes().empty()) {
-                printf("  - Entries  :\n");
-                for (const auto &size : info.entry_sizes()) {
-                    printf("    - {width: %" PRId64 ", height: %" PRId64 "}\n", size.width, size.height);
-                }
+            cli::print_info(name.c_str(), info);
+            if (plan) {
+                cli::print_plan(imageinfo::plan_decode(info, plan_target));
+            }
+        }
+    };
+
+    using Clock = std::chrono::steady_clock;
+    auto elapsed_ns = [](Clock::time_point start) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    };
+    cli::RunStats run_stats(slowest);
+    auto run_start = Clock::now();
+    auto print_stats = [&]() {
+        if (stats) {
+            run_stats.print(stderr, (double)elapsed_ns(run_start) / 1e9);
+        }
+    };
+
+    int status = 0;
+#ifdef II_POSIX
+    // Archives are read the usual way
+    if (scan && !members) {
+        std::vector<std::string> paths(files.begin(), files.end());
+        imageinfo::ScanQueue queue(paths, prefetch);
+        imageinfo::ScanFile file;
+        while (queue.next(file)) {
+            uint64_t bytes = 0;
+            auto start = Clock::now();
+            auto info = cli::parse_counted<imageinfo::ScanFileReader>(file, options, bytes);
+            run_stats.record(file.path, info, elapsed_ns(start), bytes);
+            report(file.path, info);
+        }
+        print_stats();
+        return status;
+    }
+#endif
+    for (const char *file : files) {
+        if (members) {
+            // Members are read in place through the archive's reader, nothing is extracted
+            imageinfo::FilePathReader file_reader(file);
+            uint64_t bytes = 0;
+            cli::CountingReader<imageinfo::FilePathReader> reader(file_reader, bytes);
+            imageinfo::ArchiveMembers archive_members;
+            if (imageinfo::list_archive_members(reader, archive_members) == imageinfo::kArchiveUnknown) {
+                fprintf(stderr, "Not a tar or zip archive: %s\n", file);
+                status = 1;
+                continue;
+            }
+            for (const auto &member : archive_members) {
+                // The bytes read since the last record, the directory listing counts with the first member
+                auto name = std::string(file) + ":" + member.name;
+                auto start = Clock::now();
+                auto info = imageinfo::parse_member(reader, member, options);
+                run_stats.record(name, info, elapsed_ns(start), bytes);
+                bytes = 0;
+                report(name, info);
             }
+            continue;
         }
+        uint64_t bytes = 0;
+        auto start = Clock::now();
+#ifdef II_POSIX
+        auto info = cache.is_open() ? imageinfo::parse_cached(cache, file)
+                                    : cli::parse_counted<imageinfo::FilePathReader>(file, options, bytes);
+#else
+        auto info = cli::parse_counted<imageinfo::FilePathReader>(file, options, bytes);
+#endif
+        run_stats.record(file, info, elapsed_ns(start), bytes);
+        report(file, info);
     }
 
-    return 0;
+    print_stats();
+    return status;
 }
@@ -0,0 +1,168 @@
+//
+// Merge of the outputs of sharded runs, see --shard
+//
+// Usage:
+//   imageinfo merge [-o OUTPUT] INPUT...
+//     INPUTs are all NDJSON of --json, merged to OUTPUT or stdout, or all indexes of index build, merged to the
+//     index OUTPUT. Records are sorted by path, a path found in several inputs keeps the record of the last one.
+//     A summary of the merged records goes to stderr.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "commands.hpp"
+
+namespace cli {
+
+namespace {
+
+struct Record {
+    // The JSON string of "path", still escaped, sorts the same way on every node
+    std::string path;
+    std::string line;
+};
+
+bool read_line(FILE *file, std::string &line) {
+    line.clear();
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), file) != nullptr) {
+        line += buf;
+        if (line.back() == '\n') {
+            line.pop_back();
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+// Value of a string member, still escaped, false if the record has none
+bool json_string_member(const std::string &line, const char *name, std::string &value) {
+    std::string key = std::string("\"") + name + "\":\"";
+    size_t start = line.find(key);
+    if (start == std::string::npos) {
+        return false;
+    }
+    start += key.size();
+    for (size_t i = start; i < line.size(); ++i) {
+        if (line[i] == '\\') {
+            ++i;
+        } else if (line[i] == '"') {
+            value = line.substr(start, i - start);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_index(const char *path) {
+    FILE *file = fopen(path, "rb");
+    char magic[4] = {};
+    bool index = file != nullptr && fread(magic, 1, 4, file) == 4 && memcmp(magic, "IIDX", 4) == 0;
+    if (file != nullptr) {
+        fclose(file);
+    }
+    return index;
+}
+
+int merge_ndjson(const std::vector<std::string> &inputs, const char *output) {
+    std::vector<Record> records;
+    size_t skipped = 0;
+    for (const auto &input : inputs) {
+        FILE *file = fopen(input.c_str(), "rb");
+        if (file == nullptr) {
+            fprintf(stderr, "Failed to open: %s\n", input.c_str());
+            return 1;
+        }
+        Record record;
+        while (read_line(file, record.line)) {
+            if (json_string_member(record.line, "path", record.path)) {
+                records.push_back(record);
+            } else if (!record.line.empty()) {
+                ++skipped;
+            }
+        }
+        fclose(file);
+    }
+    // Stable, so records of a path stay in input order and the last one wins
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record &a, const Record &b) { return a.path < b.path; });
+
+    FILE *out = output != nullptr ? fopen(output, "wb") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "Failed to create: %s\n", output);
+        return 1;
+    }
+    size_t files = 0;
+    size_t duplicates = 0;
+    size_t conflicts = 0;
+    std::map<std::string, size_t> formats;
+    std::map<std::string, size_t> errors;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (i + 1 < records.size() && records[i + 1].path == records[i].path) {
+            ++duplicates;
+            conflicts += records[i + 1].line != records[i].line ? 1 : 0;
+            continue;
+        }
+        ++files;
+        std::string value;
+        if (json_string_member(records[i].line, "format", value)) {
+            ++formats[value];
+        } else if (json_string_member(records[i].line, "error", value)) {
+            ++errors[value];
+        }
+        fprintf(out, "%s\n", records[i].line.c_str());
+    }
+    bool ok = !ferror(out);
+    ok = (output != nullptr ? fclose(out) : fflush(out)) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Failed to write: %s\n", output != nullptr ? output : "stdout");
+        return 1;
+    }
+
+    fprintf(stderr, "Merged %zu inputs: %zu files, %zu duplicates, %zu conflicting, %zu lines without a path\n",
+            inputs.size(), files, duplicates, conflicts, skipped);
+    for (const auto &format : formats) {
+        fprintf(stderr, "  %-24s %8zu\n", format.first.c_str(), format.second);
+    }
+    for (const auto &error : errors) {
+        fprintf(stderr, "  %-24s %8zu\n", error.first.c_str(), error.second);
+    }
+    return 0;
+}
+
+}  // namespace
+
+int run_merge(int argc, char **argv) {
+    const char *output = nullptr;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            inputs.emplace_back(argv[i]);
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "Usage: imageinfo merge [-o OUTPUT] INPUT...\n");
+        return 1;
+    }
+    size_t indexes = 0;
+    for (const auto &input : inputs) {
+        indexes += is_index(input.c_str()) ? 1 : 0;
+    }
+    if (indexes == 0) {
+        return merge_ndjson(inputs, output);
+    }
+    if (indexes != inputs.size() || output == nullptr) {
+        fprintf(stderr, "Indexes are merged with other indexes only, into the index given with -o\n");
+        return 1;
+    }
+    return merge_indexes(inputs, output);
+}
+
+}  // namespace cli
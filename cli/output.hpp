@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+#include "imageinfo.hpp"
+
+namespace cli {
+
+inline std::string json_escape(const std::string &str) {
+    std::string out;
+    out.reserve(str.size() + 2);
+    for (unsigned char c : str) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += (char)c;
+                }
+                break;
+        }
+    }
+    return out;
+}
+
+// Formats an embedded thumbnail can have
+inline const char *thumbnail_format_name(imageinfo::Format format) {
+    switch (format) {
+        case imageinfo::kFormatJpeg:
+            return "jpeg";
+        case imageinfo::kFormatHeic:
+            return "heic";
+        case imageinfo::kFormatAvif:
+            return "avif";
+        default:
+            return "unknown";
+    }
+}
+
+inline const char *metadata_kind_name(imageinfo::MetadataKind kind) {
+    switch (kind) {
+        case imageinfo::kMetadataExif:
+            return "exif";
+        case imageinfo::kMetadataXmp:
+            return "xmp";
+        case imageinfo::kMetadataIcc:
+            return "icc";
+        default:
+            return "unknown";
+    }
+}
+
+// One NDJSON record without the trailing newline, `key` names the request field ("path", "fd", ...)
+inline std::string info_to_json(const char *key, const std::string &name, const imageinfo::ImageInfo &info) {
+    std::string json = "{\"";
+    json += key;
+    json += "\":\"" + json_escape(name) + "\"";
+    if (!info) {
+        json += ",\"error\":\"";
+        json += info.error_msg();
+        json += "\"}";
+        return json;
+    }
+    char buf[128];
+    snprintf(buf, sizeof(buf), ",\"format\":\"%s\",\"ext\":\"%s\",\"mimetype\":\"%s\"", info.full_ext(), info.ext(),
+             info.mimetype());
+    json += buf;
+    snprintf(buf, sizeof(buf), ",\"width\":%" PRId64 ",\"height\":%" PRId64, info.size().width, info.size().height);
+    json += buf;
+    if (info.channels() > 0) {
+        snprintf(buf, sizeof(buf), ",\"bit_depth\":%d,\"channels\":%d,\"alpha\":%s", info.bit_depth(),
+                 info.channels(), info.has_alpha() ? "true" : "false");
+        json += buf;
+    }
+    if (info.orientation() != 1) {
+        snprintf(buf, sizeof(buf), ",\"orientation\":%d", info.orientation());
+        json += buf;
+    }
+    if (info.is_animated()) {
+        snprintf(buf, sizeof(buf), ",\"frames\":%" PRId64, info.frame_count());
+        json += buf;
+    }
+    snprintf(buf, sizeof(buf), ",\"decoded_bytes\":%" PRId64, info.decoded_bytes_estimate());
+    json += buf;
+    if (!info.entry_sizes().empty()) {
+        json += ",\"entries\":[";
+        bool first = true;
+        for (const auto &size : info.entry_sizes()) {
+            snprintf(buf, sizeof(buf), "%s[%" PRId64 ",%" PRId64 "]", first ? "" : ",", size.width, size.height);
+            json += buf;
+            first = false;
+        }
+        json += "]";
+    }
+    if (!info.levels().empty()) {
+        json += ",\"levels\":[";
+        bool first = true;
+        for (const auto &level : info.levels()) {
+            snprintf(buf, sizeof(buf), "%s[%" PRId64 ",%" PRId64 "]", first ? "" : ",", level.size.width,
+                     level.size.height);
+            json += buf;
+            first = false;
+        }
+        json += "]";
+        if (info.levels()[0].layers > 1) {
+            snprintf(buf, sizeof(buf), ",\"layers\":%u", info.levels()[0].layers);
+            json += buf;
+        }
+    }
+    if (!info.thumbnails().empty()) {
+        json += ",\"thumbnails\":[";
+        bool first = true;
+        for (const auto &thumbnail : info.thumbnails()) {
+            snprintf(buf, sizeof(buf),
+                     "%s{\"offset\":%" PRId64 ",\"length\":%" PRIu64 ",\"format\":\"%s\",\"width\":%" PRId64
+                     ",\"height\":%" PRId64 "}",
+                     first ? "" : ",", (int64_t)thumbnail.offset, (uint64_t)thumbnail.length,
+                     thumbnail_format_name(thumbnail.format), thumbnail.size.width, thumbnail.size.height);
+            json += buf;
+            first = false;
+        }
+        json += "]";
+    }
+    if (!info.metadata().empty()) {
+        json += ",\"metadata\":[";
+        bool first = true;
+        for (const auto &block : info.metadata()) {
+            snprintf(buf, sizeof(buf),
+                     "%s{\"kind\":\"%s\",\"offset\":%" PRId64 ",\"length\":%" PRIu64 ",\"compressed\":%s}",
+                     first ? "" : ",", metadata_kind_name(block.kind), (int64_t)block.offset, (uint64_t)block.length,
+                     block.compressed ? "true" : "false");
+            json += buf;
+            first = false;
+        }
+        json += "]";
+    }
+    json += "}";
+    return json;
+}
+
+inline const char *reduction_name(imageinfo::DecodeReduction reduction) {
+    switch (reduction) {
+        case imageinfo::kReductionJpegScale:
+            return "jpeg_scale";
+        case imageinfo::kReductionLevel:
+            return "level";
+        default:
+            return "none";
+    }
+}
+
+// "plan" member to append to a record of info_to_json
+inline std::string plan_to_json(const imageinfo::DecodePlan &plan) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "\"plan\":{\"reduction\":\"%s\",\"scale_denom\":%d,\"level\":%d,\"width\":%" PRId64
+             ",\"height\":%" PRId64 ",\"decoder_bytes\":%" PRId64 "}",
+             reduction_name(plan.reduction), plan.scale_denom, plan.level, plan.decoded_size.width,
+             plan.decoded_size.height, plan.decoder_bytes);
+    return buf;
+}
+
+inline void print_plan(const imageinfo::DecodePlan &plan) {
+    printf("  - Plan     : %s, 1/%d, level %d, {width: %" PRId64 ", height: %" PRId64 "}, %" PRId64 " bytes\n",
+           reduction_name(plan.reduction), plan.scale_denom, plan.level, plan.decoded_size.width,
+           plan.decoded_size.height, plan.decoder_bytes);
+}
+
+inline void print_info(const char *file, const imageinfo::ImageInfo &info) {
+    printf("File: %s\n", file);
+    if (!info) {
+        printf("  - Error    : %s\n", info.error_msg());
+    } else {
+        printf("  - Format   : %d\n", info.format());
+        printf("  - Ext      : %s\n", info.ext());
+        printf("  - Full Ext : %s\n", info.full_ext());
+        printf("  - Size     : {width: %" PRId64 ", height: %" PRId64 "}\n", info.size().width, info.size().height);
+        printf("  - Mimetype : %s\n", info.mimetype());
+        if (info.channels() > 0) {
+            printf("  - Pixel    : {bit_depth: %d, channels: %d, alpha: %s}\n", info.bit_depth(), info.channels(),
+                   info.has_alpha() ? "true" : "false");
+        }
+        if (info.orientation() != 1) {
+            printf("  - Orient   : %d (stored %" PRId64 "x%" PRId64 ")\n", info.orientation(), info.stored_size().width,
+                   info.stored_size().height);
+        }
+        if (info.is_animated()) {
+            printf("  - Frames   : %" PRId64 "\n", info.frame_count());
+        }
+        printf("  - Decoded  : %" PRId64 " bytes\n", info.decoded_bytes_estimate());
+        if (!info.entry_sizes().empty()) {
+            printf("  - Entries  :\n");
+            for (const auto &size : info.entry_sizes()) {
+                printf("    - {width: %" PRId64 ", height: %" PRId64 "}\n", size.width, size.height);
+            }
+        }
+        if (!info.levels().empty()) {
+            printf("  - Levels   :\n");
+            for (const auto &level : info.levels()) {
+                printf("    - {width: %" PRId64 ", height: %" PRId64 ", layers: %u}\n", level.size.width,
+                       level.size.height, level.layers);
+            }
+        }
+        if (!info.thumbnails().empty()) {
+            printf("  - Thumbs   :\n");
+            for (const auto &thumbnail : info.thumbnails()) {
+                printf("    - {offset: %" PRId64 ", length: %" PRIu64 ", format: %s, width: %" PRId64
+                       ", height: %" PRId64 "}\n",
+                       (int64_t)thumbnail.offset, (uint64_t)thumbnail.length, thumbnail_format_name(thumbnail.format),
+                       thumbnail.size.width, thumbnail.size.height);
+            }
+        }
+        if (!info.metadata().empty()) {
+            printf("  - Metadata :\n");
+            for (const auto &block : info.metadata()) {
+                printf("    - {kind: %s, offset: %" PRId64 ", length: %" PRIu64 ", compressed: %s}\n",
+                       metadata_kind_name(block.kind), (int64_t)block.offset, (uint64_t)block.length,
+                       block.compressed ? "true" : "false");
+            }
+        }
+    }
+}
+
+}  // namespace cli
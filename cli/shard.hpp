@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "imageinfo.hpp"
+
+namespace cli {
+
+// Shard i of N of a path list. A path belongs to shard crc32(path) % N, the zlib CRC-32 of its bytes, so every node
+// picks the same partition from the same paths without coordination, whatever its byte order or build
+struct Shard {
+    uint32_t index = 0;
+    uint32_t count = 1;
+
+    // "i/N" with 0 <= i < N
+    inline bool parse(const char *text) {
+        unsigned long i = 0;
+        unsigned long n = 0;
+        char tail = 0;
+        if (sscanf(text, "%lu/%lu%c", &i, &n, &tail) != 2 || n == 0 || i >= n || n > UINT32_MAX) {
+            return false;
+        }
+        index = (uint32_t)i;
+        count = (uint32_t)n;
+        return true;
+    }
+
+    inline bool owns(const std::string &path) const {
+        return count == 1 || imageinfo::crc32(path.data(), path.size()) % count == index;
+    }
+};
+
+}  // namespace cli
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "imageinfo.hpp"
+
+namespace cli {
+
+// Log-linear latency histogram in the spirit of HdrHistogram: values below 128 get a bucket each, every power of two
+// above is split into 64 buckets, so a recorded value is off by at most 1/64 (~1.6%) whatever its magnitude
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 6;
+    static constexpr uint64_t kSubBuckets = 1ull << kSubBucketBits;
+    static constexpr size_t kBucketCount = 2 * kSubBuckets + (64 - kSubBucketBits - 1) * kSubBuckets;
+
+    void record(uint64_t value) {
+        if (counts_.empty()) {
+            counts_.resize(kBucketCount);
+        }
+        ++counts_[index_of(value)];
+        ++count_;
+        max_ = (std::max)(max_, value);
+    }
+
+    uint64_t count() const { return count_; }
+
+    uint64_t max() const { return max_; }
+
+    // Highest value equivalent to the bucket holding the `percentile` (0..100) sample, capped at the max
+    uint64_t percentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        auto target = (uint64_t)((double)count_ * percentile / 100.0 + 0.5);
+        target = (std::max)(target, (uint64_t)1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return (std::min)(highest_of(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static size_t index_of(uint64_t value) {
+        if (value < 2 * kSubBuckets) {
+            return (size_t)value;
+        }
+        int msb = 63;
+        while ((value >> msb) == 0) {
+            --msb;
+        }
+        int shift = msb - kSubBucketBits;
+        return (size_t)(2 * kSubBuckets + (uint64_t)(msb - kSubBucketBits - 1) * kSubBuckets +
+                        ((value >> shift) - kSubBuckets));
+    }
+
+    static uint64_t highest_of(size_t index) {
+        if (index < 2 * kSubBuckets) {
+            return index;
+        }
+        uint64_t k = index - 2 * kSubBuckets;
+        int shift = (int)(k / kSubBuckets) + 1;
+        uint64_t low = ((k % kSubBuckets) + kSubBuckets) << shift;
+        return low + ((1ull << shift) - 1);
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
+
+inline std::string format_duration(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) {
+        snprintf(buf, sizeof(buf), "%" PRIu64 "ns", ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, sizeof(buf), "%.1fus", (double)ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, sizeof(buf), "%.2fms", (double)ns / 1e6);
+    } else {
+        snprintf(buf, sizeof(buf), "%.2fs", (double)ns / 1e9);
+    }
+    return buf;
+}
+
+// Collects the --stats report: latency per format, bytes read, errors and the slowest files
+class RunStats {
+public:
+    explicit RunStats(size_t slowest = 10) : slowest_limit_(slowest) {}
+
+    void record(const std::string &path, const imageinfo::ImageInfo &info, uint64_t ns, uint64_t bytes) {
+        ++files_;
+        bytes_ += bytes;
+        all_.record(ns);
+        if (info) {
+            formats_[info.full_ext()].record(ns);
+        } else {
+            ++errors_[info.error_msg()];
+        }
+        if (slowest_limit_ == 0) {
+            return;
+        }
+        // Min-heap on the latency, the root is the fastest of the slowest
+        auto faster = [](const Sample &a, const Sample &b) { return a.first > b.first; };
+        if (slowest_.size() < slowest_limit_) {
+            slowest_.emplace_back(ns, path);
+            std::push_heap(slowest_.begin(), slowest_.end(), faster);
+        } else if (ns > slowest_.front().first) {
+            std::pop_heap(slowest_.begin(), slowest_.end(), faster);
+            slowest_.back() = Sample(ns, path);
+            std::push_heap(slowest_.begin(), slowest_.end(), faster);
+        }
+    }
+
+    void print(FILE *out, double seconds) const {
+        seconds = (std::max)(seconds, 1e-9);
+        double mb = (double)bytes_ / 1e6;
+        fprintf(out, "Stats: %" PRIu64 " files in %.3f s, %.0f parses/s, %.3f MB read, %.2f MB/s\n", files_, seconds,
+                (double)files_ / seconds, mb, mb / seconds);
+        fprintf(out, "  %-10s %8s %10s %10s %10s %10s\n", "format", "files", "p50", "p90", "p99", "max");
+        auto row = [out](const char *name, const LatencyHistogram &histogram) {
+            fprintf(out, "  %-10s %8" PRIu64 " %10s %10s %10s %10s\n", name, histogram.count(),
+                    format_duration(histogram.percentile(50)).c_str(),
+                    format_duration(histogram.percentile(90)).c_str(),
+                    format_duration(histogram.percentile(99)).c_str(), format_duration(histogram.max()).c_str());
+        };
+        for (const auto &entry : formats_) {
+            row(entry.first.c_str(), entry.second);
+        }
+        row("all", all_);
+        if (!errors_.empty()) {
+            fprintf(out, "Errors:\n");
+            for (const auto &entry : errors_) {
+                fprintf(out, "  %-24s %8" PRIu64 "\n", entry.first.c_str(), entry.second);
+            }
+        }
+        if (!slowest_.empty()) {
+            auto sorted = slowest_;
+            std::sort(sorted.begin(), sorted.end(), [](const Sample &a, const Sample &b) { return a.first > b.first; });
+            fprintf(out, "Slowest:\n");
+            for (const auto &sample : sorted) {
+                fprintf(out, "  %10s  %s\n", format_duration(sample.first).c_str(), sample.second.c_str());
+            }
+        }
+    }
+
+private:
+    using Sample = std::pair<uint64_t, std::string>;
+
+    size_t slowest_limit_;
+    uint64_t files_ = 0;
+    uint64_t bytes_ = 0;
+    LatencyHistogram all_;
+    std::map<std::string, LatencyHistogram> formats_;
+    std::map<std::string, uint64_t> errors_;
+    std::vector<Sample> slowest_;
+};
+
+// Forwards to `reader` and adds up the bytes asked for, for archives read through imageinfo::parse_member()
+template <typename ReaderType>
+class CountingReader {
+public:
+    CountingReader(ReaderType &reader, uint64_t &bytes) : reader_(reader), bytes_(bytes) {}
+
+    inline size_t size() { return reader_.size(); }
+
+    inline void read(void *buf, off_t offset, size_t size) {
+        reader_.read(buf, offset, size);
+        bytes_ += size;
+    }
+
+private:
+    ReaderType &reader_;
+    uint64_t &bytes_;
+};
+
+// imageinfo::parse<ReaderType> that also adds up the bytes the detectors asked for
+template <typename ReaderType, typename InputType>
+inline imageinfo::ImageInfo parse_counted(const InputType &input, const imageinfo::ParseOptions &options,
+                                          uint64_t &bytes) {
+    ReaderType reader(input);
+    imageinfo::ReadFunc read_func = [&reader, &bytes](void *buf, off_t offset, size_t size) {
+        reader.read(buf, offset, size);
+        bytes += size;
+    };
+    imageinfo::ReadInterface ri(read_func, reader.size(), options);
+    return imageinfo::parse(ri);
+}
+
+}  // namespace cli
@@ -0,0 +1,66 @@
+//
+// Metadata stripping, the output is the input with its EXIF, XMP and text segments and chunks left out
+//
+// Usage: imageinfo strip INPUT OUTPUT, OUTPUT may be - for stdout
+//
+
+#include "commands.hpp"
+#include "imageinfo.hpp"
+
+#ifdef II_POSIX
+
+#include <cstdio>
+#include <cstring>
+
+namespace cli {
+
+int run_strip(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: imageinfo strip INPUT OUTPUT\n");
+        return 1;
+    }
+    const char *input = argv[1];
+    const char *output = argv[2];
+    int in_fd = ::open(input, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        fprintf(stderr, "Failed to open: %s\n", input);
+        return 1;
+    }
+    bool to_stdout = strcmp(output, "-") == 0;
+    int out_fd = to_stdout ? STDOUT_FILENO : ::open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        fprintf(stderr, "Failed to create: %s\n", output);
+        ::close(in_fd);
+        return 1;
+    }
+    bool ok = imageinfo::strip_metadata(in_fd, out_fd);
+    ::close(in_fd);
+    if (!to_stdout) {
+        ok = ::close(out_fd) == 0 && ok;
+        if (!ok) {
+            ::unlink(output);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to strip, not a JPEG, PNG or WebP, or an I/O error: %s\n", input);
+        return 1;
+    }
+    return 0;
+}
+
+}  // namespace cli
+
+#else
+
+#include <cstdio>
+
+namespace cli {
+
+int run_strip(int, char **) {
+    fprintf(stderr, "strip is not supported on this platform\n");
+    return 1;
+}
+
+}  // namespace cli
+
+#endif
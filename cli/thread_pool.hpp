@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cli {
+
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 0) {
+        if (threads == 0) {
+            threads = (std::max)(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    inline size_t size() const { return workers_.size(); }
+
+    inline void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+    // Run fn(0) ... fn(count - 1) on the pool and wait for all of them, never call it from a pool thread
+    inline void parallel_for(size_t count, const std::function<void(size_t)> &fn) {
+        std::mutex done_mutex;
+        std::condition_variable done_cv;
+        size_t remaining = count;
+        for (size_t i = 0; i < count; ++i) {
+            submit([&, i]() {
+                fn(i);
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (--remaining == 0) {
+                    done_cv.notify_all();
+                }
+            });
+        }
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&]() { return remaining == 0; });
+    }
+
+private:
+    inline void work() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
+
+}  // namespace cli
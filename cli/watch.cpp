@@ -0,0 +1,341 @@
+//
+// Watch mode: one parallel scan of a directory tree, then incremental updates from inotify
+//
+// Usage:
+//   imageinfo watch [--threads N] [--debounce MS] DIR...
+//
+// Every line on stdout is one NDJSON record:
+//   {"event":"scan","path":...}     a file of the initial scan, with the members of the one-shot --json output
+//   {"event":"ready","files":N}     the initial scan is complete
+//   {"event":"update","path":...}   a file was created, rewritten or moved in, parsed again
+//   {"event":"remove","path":...}   a file was deleted or moved out
+// Files being written are parsed once they are closed, or once they have been quiet for the debounce interval.
+// Only changed files are parsed again, an event queue overflow rescans the trees.
+//
+
+#include "commands.hpp"
+#include "imageinfo.hpp"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "output.hpp"
+#include "thread_pool.hpp"
+
+namespace cli {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const uint32_t kWatchMask =
+    IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR;
+// Files parsed per pass of the pool, records are printed in between
+const size_t kScanChunk = 4096;
+
+std::string join(const std::string &dir, const char *name) {
+    return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+class Watcher {
+public:
+    Watcher(size_t threads, Clock::duration debounce) : pool_(threads), debounce_(debounce) {}
+
+    ~Watcher() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool open() {
+        fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        return fd_ >= 0;
+    }
+
+    // Watches every directory under `root` and prints a record of every file in it
+    void scan(const std::string &root, const char *event) {
+        std::vector<std::string> files;
+        add_tree(root, files);
+        parse_and_print(files, event);
+    }
+
+    void ready() {
+        printf("{\"event\":\"ready\",\"files\":%zu}\n", known_.size());
+        fflush(stdout);
+    }
+
+    int run(const std::vector<std::string> &roots) {
+        std::vector<char> events(64 * 1024);
+        for (;;) {
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            if (::poll(&pfd, 1, poll_timeout()) < 0 && errno != EINTR) {
+                perror("poll");
+                return 1;
+            }
+            for (;;) {
+                ssize_t n = ::read(fd_, events.data(), events.size());
+                if (n <= 0) {
+                    break;
+                }
+                for (ssize_t offset = 0; offset < n;) {
+                    auto *event = (const struct inotify_event *)(events.data() + offset);
+                    offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        rescan(roots);
+                        continue;
+                    }
+                    handle(*event);
+                }
+            }
+            flush_due();
+        }
+    }
+
+private:
+    void add_tree(const std::string &dir, std::vector<std::string> &files) {
+        int wd = ::inotify_add_watch(fd_, dir.c_str(), kWatchMask);
+        if (wd < 0) {
+            fprintf(stderr, "Failed to watch %s: %s\n", dir.c_str(), strerror(errno));
+            return;
+        }
+        dirs_[wd] = dir;
+        DIR *handle = ::opendir(dir.c_str());
+        if (handle == nullptr) {
+            return;
+        }
+        std::vector<std::string> names;
+        while (dirent *entry = ::readdir(handle)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                names.emplace_back(entry->d_name);
+            }
+        }
+        ::closedir(handle);
+        std::sort(names.begin(), names.end());
+        for (const auto &name : names) {
+            std::string child = join(dir, name.c_str());
+            struct stat st {};
+            if (::lstat(child.c_str(), &st) != 0) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                add_tree(child, files);
+            } else if (S_ISREG(st.st_mode)) {
+                files.push_back(child);
+            }
+        }
+    }
+
+    // Watches of `dir` and every directory below it are dropped, and its files reported as removed
+    void remove_tree(const std::string &dir) {
+        std::string prefix = dir + "/";
+        for (auto it = dirs_.begin(); it != dirs_.end();) {
+            if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0) {
+                ::inotify_rm_watch(fd_, it->first);
+                it = dirs_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        auto first = known_.lower_bound(prefix);
+        auto last = first;
+        while (last != known_.end() && last->compare(0, prefix.size(), prefix) == 0) {
+            pending_.erase(*last);
+            print_remove(*last);
+            ++last;
+        }
+        known_.erase(first, last);
+        fflush(stdout);
+    }
+
+    void rescan(const std::vector<std::string> &roots) {
+        fprintf(stderr, "inotify queue overflow, rescanning\n");
+        for (const auto &dir : dirs_) {
+            ::inotify_rm_watch(fd_, dir.first);
+        }
+        dirs_.clear();
+        pending_.clear();
+        std::vector<std::string> files;
+        for (const auto &root : roots) {
+            add_tree(root, files);
+        }
+        std::set<std::string> present(files.begin(), files.end());
+        for (const auto &path : known_) {
+            if (present.find(path) == present.end()) {
+                print_remove(path);
+            }
+        }
+        known_.clear();
+        parse_and_print(files, "update");
+    }
+
+    void handle(const struct inotify_event &event) {
+        if (event.mask & IN_IGNORED) {
+            dirs_.erase(event.wd);
+            return;
+        }
+        auto dir_it = dirs_.find(event.wd);
+        if (dir_it == dirs_.end() || event.len == 0) {
+            return;
+        }
+        std::string path = join(dir_it->second, event.name);
+        if (event.mask & IN_ISDIR) {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                // Files created before the watch was in place are only found by the scan
+                scan(path, "update");
+            } else if (event.mask & (IN_MOVED_FROM | IN_DELETE)) {
+                remove_tree(path);
+            }
+            return;
+        }
+        if (event.mask & (IN_MOVED_FROM | IN_DELETE)) {
+            pending_.erase(path);
+            if (known_.erase(path) != 0) {
+                print_remove(path);
+                fflush(stdout);
+            }
+        } else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            // The writer is done, or the file was renamed into place whole
+            pending_[path] = Clock::now();
+        } else if (event.mask & (IN_CREATE | IN_MODIFY)) {
+            // Still being written, every write pushes the parse back
+            pending_[path] = Clock::now() + debounce_;
+        }
+    }
+
+    int poll_timeout() const {
+        if (pending_.empty()) {
+            return -1;
+        }
+        auto next = Clock::time_point::max();
+        for (const auto &p : pending_) {
+            next = (std::min)(next, p.second);
+        }
+        auto now = Clock::now();
+        if (next <= now) {
+            return 0;
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+        return (int)(std::min)(ms + 1, (decltype(ms))60000);
+    }
+
+    void flush_due() {
+        auto now = Clock::now();
+        std::vector<std::string> due;
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (it->second <= now) {
+                due.push_back(it->first);
+                it = pending_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        std::sort(due.begin(), due.end());
+        std::vector<std::string> files;
+        for (const auto &path : due) {
+            struct stat st {};
+            if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                files.push_back(path);
+            } else if (known_.erase(path) != 0) {
+                // Gone again before it settled
+                print_remove(path);
+            }
+        }
+        parse_and_print(files, "update");
+    }
+
+    void parse_and_print(const std::vector<std::string> &files, const char *event) {
+        std::string prefix = std::string("{\"event\":\"") + event + "\",";
+        for (size_t start = 0; start < files.size(); start += kScanChunk) {
+            size_t count = (std::min)(kScanChunk, files.size() - start);
+            std::vector<std::string> records(count);
+            pool_.parallel_for(count, [&](size_t i) {
+                const auto &path = files[start + i];
+                auto info = imageinfo::parse<imageinfo::FilePathReader>(path);
+                records[i] = prefix + info_to_json("path", path, info).substr(1);
+            });
+            for (size_t i = 0; i < count; ++i) {
+                known_.insert(files[start + i]);
+                printf("%s\n", records[i].c_str());
+            }
+        }
+        fflush(stdout);
+    }
+
+    static void print_remove(const std::string &path) {
+        printf("{\"event\":\"remove\",\"path\":\"%s\"}\n", json_escape(path).c_str());
+    }
+
+    ThreadPool pool_;
+    Clock::duration debounce_;
+    int fd_ = -1;
+    std::unordered_map<int, std::string> dirs_;
+    // Files reported and not removed since, ordered so a directory is one range
+    std::set<std::string> known_;
+    // Changed files and when to parse them
+    std::unordered_map<std::string, Clock::time_point> pending_;
+};
+
+}  // namespace
+
+int run_watch(int argc, char **argv) {
+    size_t threads = 0;
+    long debounce_ms = 200;
+    std::vector<std::string> roots;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc) {
+            debounce_ms = strtol(argv[++i], nullptr, 10);
+        } else {
+            roots.emplace_back(argv[i]);
+        }
+    }
+    if (roots.empty() || debounce_ms < 0) {
+        fprintf(stderr, "Usage: imageinfo watch [--threads N] [--debounce MS] DIR...\n");
+        return 1;
+    }
+
+    Watcher watcher(threads, std::chrono::milliseconds(debounce_ms));
+    if (!watcher.open()) {
+        perror("inotify_init1");
+        return 1;
+    }
+    for (const auto &root : roots) {
+        watcher.scan(root, "scan");
+    }
+    watcher.ready();
+    return watcher.run(roots);
+}
+
+}  // namespace cli
+
+#else
+
+#include <cstdio>
+
+namespace cli {
+
+int run_watch(int, char **) {
+    fprintf(stderr, "watch is not supported on this platform\n");
+    return 1;
+}
+
+}  // namespace cli
+
+#endif
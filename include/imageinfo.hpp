@@ -30,28 +30,96 @@
 #ifndef IMAGEINFO_IMAGEINFO_H
 #define IMAGEINFO_IMAGEINFO_H
 
+/**
+ * Header-only by default. Define IMAGEINFO_STATIC (the imageinfo_static CMake target does it for its users)
+ * to keep only declarations of the detectors and the parse core here, and define IMAGEINFO_IMPLEMENTATION
+ * as well in the one translation unit that compiles them, see src/imageinfo.cpp.
+ * All translation units of a program have to agree on IMAGEINFO_STATIC.
+ */
+#if defined(IMAGEINFO_STATIC) && !defined(IMAGEINFO_IMPLEMENTATION)
+#define II_LEAN_HEADER
+#endif
+
+// Library version, persisted results of another version are not trusted
+#define IMAGEINFO_VERSION_MAJOR 2
+#define IMAGEINFO_VERSION_MINOR 1
+#define IMAGEINFO_VERSION_PATCH 0
+#define IMAGEINFO_VERSION (IMAGEINFO_VERSION_MAJOR * 10000 + IMAGEINFO_VERSION_MINOR * 100 + IMAGEINFO_VERSION_PATCH)
+
+#ifdef IMAGEINFO_STATIC
+#define II_IMPL
+#else
+#define II_IMPL inline
+#endif
+
 #include <algorithm>
-#include <array>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
-#include <fstream>
 #include <functional>
+#include <initializer_list>
+#include <iosfwd>
 #include <limits>
+#include <list>
 #include <memory>
-#include <set>
+#include <mutex>
 #include <string>
-#include <tuple>
+#include <type_traits>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#ifndef II_LEAN_HEADER
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <tuple>
+#include <unordered_set>
+
+// Hardware CRC-32 kernels, see crc32(). Only the PCLMULQDQ and SSE4.1 headers, immintrin.h is a large include
+#if !defined(II_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define II_CRC32_PCLMUL
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#elif !defined(II_DISABLE_SIMD) && defined(__ARM_FEATURE_CRC32)
+#define II_CRC32_ARM
+#include <arm_acle.h>
+#endif
+#endif
+
 #ifdef ANDROID
 #include <android/asset_manager.h>
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+#define II_POSIX
+#endif
+
+// C++20 coroutines, see parse_async()
+#if !defined(II_DISABLE_COROUTINES) && defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define II_COROUTINES
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <map>
+#endif
+
+#ifdef II_POSIX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
 #ifndef II_HEADER_CACHE_SIZE
 #define II_HEADER_CACHE_SIZE (1024)
 #endif
@@ -103,9 +171,75 @@ enum Format {
     FORMAT_COUNT = FORMAT_END - 1,
 };
 
+struct FormatDescriptor {
+    Format format;
+    const char *ext;
+    const char *full_ext;
+    const char *mimetype;
+};
+
+// Indexed by Format, the only place the names of a format are spelled out
+constexpr FormatDescriptor kFormatDescriptors[FORMAT_END] = {
+    {kFormatUnknown,     "",     "",                   ""},
+    {   kFormatAvif, "avif", "avif",         "image/avif"},
+    {    kFormatBmp,  "bmp",  "bmp",          "image/bmp"},
+    {    kFormatCur,  "cur",  "cur",          "image/cur"},
+    {    kFormatDds,  "dds",  "dds",          "image/dds"},
+    {    kFormatGif,  "gif",  "gif",          "image/gif"},
+    {    kFormatHdr,  "hdr",  "hdr", "image/vnd.radiance"},
+    {   kFormatHeic, "heic", "heic",         "image/heic"},
+    {   kFormatIcns, "icns", "icns",         "image/icns"},
+    {    kFormatIco,  "ico",  "ico",          "image/ico"},
+    {    kFormatJ2k,  "j2k",  "j2k",          "image/j2k"},
+    {    kFormatJp2,  "jp2",  "jp2",          "image/jp2"},
+    {    kFormatJph,  "jph",  "jph",          "image/jph"},
+    {    kFormatJpx,  "jpx",  "jpx",          "image/jpx"},
+    {   kFormatJpeg,  "jpg", "jpeg",         "image/jpeg"},
+    {    kFormatKtx,  "ktx",  "ktx",          "image/ktx"},
+    {    kFormatPng,  "png",  "png",          "image/png"},
+    {    kFormatPsd,  "psd",  "psd",          "image/psd"},
+    {    kFormatQoi,  "qoi",  "qoi",          "image/qoi"},
+    {   kFormatTiff, "tiff", "tiff",         "image/tiff"},
+    {   kFormatWebp, "webp", "webp",         "image/webp"},
+    {    kFormatTga,  "tga",  "tga",          "image/tga"},
+};
+
+// Out of range values get the descriptor of kFormatUnknown
+constexpr const FormatDescriptor &format_descriptor(Format format) {
+    return kFormatDescriptors[(size_t)format < (size_t)FORMAT_END ? (size_t)format : 0];
+}
+
+constexpr bool format_descriptors_ordered(size_t i = 0) {
+    return i == FORMAT_END || (kFormatDescriptors[i].format == (Format)i && format_descriptors_ordered(i + 1));
+}
+
+static_assert(format_descriptors_ordered(), "kFormatDescriptors is not indexed by Format");
+
+constexpr bool format_str_equal(const char *a, const char *b) {
+    return *a == *b && (*a == '\0' || format_str_equal(a + 1, b + 1));
+}
+
+// kFormatUnknown when no format has this MIME type
+constexpr Format format_from_mimetype(const char *mimetype, size_t i = 1) {
+    return i == FORMAT_END                                                ? kFormatUnknown
+           : format_str_equal(kFormatDescriptors[i].mimetype, mimetype) ? (Format)i
+                                                                          : format_from_mimetype(mimetype, i + 1);
+}
+
+// Matches ext or full_ext, "jpg" and "jpeg" are both kFormatJpeg
+constexpr Format format_from_ext(const char *ext, size_t i = 1) {
+    return i == FORMAT_END ? kFormatUnknown
+           : format_str_equal(kFormatDescriptors[i].ext, ext) || format_str_equal(kFormatDescriptors[i].full_ext, ext)
+               ? (Format)i
+               : format_from_ext(ext, i + 1);
+}
+
 enum Error {
     kNoError = 0,
     kUnrecognizedFormat,
+    kUnsupportedMember,
+    kIntegrityCheckFailed,
+    kTruncatedFile,
 };
 
 class FileReader {
@@ -130,56 +264,253 @@ private:
     FILE *file_ = nullptr;
 };
 
+// 64-bit offsets for files over 2GB
+#ifdef _WIN32
+#define II_FSEEK _fseeki64
+#define II_FTELL _ftelli64
+#else
+#define II_FSEEK fseeko
+#define II_FTELL ftello
+#endif
+
+// stdio rather than std::ifstream, so that the lean header does not need <fstream>
 class FilePathReader {
 public:
-    explicit FilePathReader(const std::string &path) : file_(path, std::ios::in | std::ios::binary) {}
+    explicit FilePathReader(const std::string &path) : file_(fopen(path.c_str(), "rb")) {}
+
+    FilePathReader(const FilePathReader &) = delete;
+    FilePathReader &operator=(const FilePathReader &) = delete;
 
     ~FilePathReader() {
-        if (file_.is_open()) {
-            file_.close();
+        if (file_ != nullptr) {
+            fclose(file_);
         }
     }
 
     inline size_t size() {
-        if (file_.is_open()) {
-            file_.seekg(0, std::ios::end);
-            return (size_t)file_.tellg();
+        if (file_ != nullptr && II_FSEEK(file_, 0, SEEK_END) == 0) {
+            auto size = II_FTELL(file_);
+            return size > 0 ? (size_t)size : 0;
         } else {
             return 0;
         }
     }
 
     inline void read(void *buf, off_t offset, size_t size) {
-        file_.seekg(offset, std::ios::beg);
-        file_.read((char *)buf, (std::streamsize)size);
+        II_FSEEK(file_, offset, SEEK_SET);
+        fread(buf, 1, size, file_);
     }
 
 private:
-    std::ifstream file_;
+    FILE *file_ = nullptr;
 };
 
 class FileStreamReader {
 public:
     explicit FileStreamReader(std::ifstream &file) : file_(file) {}
 
-    inline size_t size() {
-        if (file_.is_open()) {
-            file_.seekg(0, std::ios::end);
-            return (size_t)file_.tellg();
+    size_t size();
+
+    void read(void *buf, off_t offset, size_t size);
+
+private:
+    std::ifstream &file_;
+};
+
+#ifndef II_LEAN_HEADER
+II_IMPL size_t FileStreamReader::size() {
+    if (file_.is_open()) {
+        file_.seekg(0, std::ios::end);
+        return (size_t)file_.tellg();
+    } else {
+        return 0;
+    }
+}
+
+II_IMPL void FileStreamReader::read(void *buf, off_t offset, size_t size) {
+    file_.seekg(offset, std::ios::beg);
+    file_.read((char *)buf, (std::streamsize)size);
+}
+#endif
+
+#ifdef II_POSIX
+
+class FileDescriptorReader {
+public:
+    explicit FileDescriptorReader(int fd) : fd_(fd) {}
+
+    inline size_t size() const {
+        struct stat st {};
+        if (fd_ >= 0 && ::fstat(fd_, &st) == 0) {
+            return (size_t)st.st_size;
         } else {
             return 0;
         }
     }
 
-    inline void read(void *buf, off_t offset, size_t size) {
-        file_.seekg(offset, std::ios::beg);
-        file_.read((char *)buf, (std::streamsize)size);
+    // pread keeps the file offset untouched, so a descriptor can be shared between threads
+    inline void read(void *buf, off_t offset, size_t size) const {
+        auto *p = (uint8_t *)buf;
+        while (size > 0) {
+            ssize_t n = ::pread(fd_, p, size, offset);
+            if (n <= 0) {
+                memset(p, 0, size);
+                break;
+            }
+            p += n;
+            size -= (size_t)n;
+            offset += (off_t)n;
+        }
     }
 
 private:
-    std::ifstream &file_;
+    int fd_ = -1;
+};
+
+// Page cache behaviour of ScanFileReader, bulk scans should not push the working set of the host out of memory
+enum PageCacheHint {
+    kPageCacheDefault = 0,
+    // POSIX_FADV_RANDOM, the kernel reads the pages the detectors ask for and no read-ahead beyond them
+    kPageCacheNoReadAhead = 1,
+    // POSIX_FADV_DONTNEED once parsed, this drops pages that were cached before the scan as well
+    kPageCacheDrop = 2,
+    // O_NOATIME, needs ownership of the file or CAP_FOWNER, skipped when refused
+    kPageCacheNoAtime = 4,
+    kPageCacheScan = kPageCacheNoReadAhead | kPageCacheDrop | kPageCacheNoAtime,
+};
+
+// posix_fadvise() where the platform has it, a no-op elsewhere (macOS)
+#ifdef POSIX_FADV_RANDOM
+#define II_FADVISE(fd, offset, length, advice) ((void)::posix_fadvise((fd), (offset), (length), (advice)))
+#else
+#define II_FADVISE(fd, offset, length, advice) ((void)0)
+#endif
+
+inline int open_for_scan(const char *path, unsigned hints) {
+    int fd = -1;
+#ifdef O_NOATIME
+    if (hints & kPageCacheNoAtime) {
+        fd = ::open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+    }
+#endif
+    if (fd < 0) {
+        fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd >= 0 && (hints & kPageCacheNoReadAhead)) {
+        II_FADVISE(fd, 0, 0, POSIX_FADV_RANDOM);
+    }
+    return fd;
+}
+
+// Starts reading [offset, offset + size) into the page cache without waiting for it
+inline void prefetch_pages(int fd, off_t offset, size_t size) {
+#if defined(POSIX_FADV_WILLNEED)
+    II_FADVISE(fd, offset, (off_t)size, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct radvisory advisory {};
+    advisory.ra_offset = offset;
+    advisory.ra_count = (int)size;
+    ::fcntl(fd, F_RDADVISE, &advisory);
+#else
+    (void)fd;
+    (void)offset;
+    (void)size;
+#endif
+}
+
+struct ScanFile {
+    ScanFile() = default;
+
+    explicit ScanFile(std::string path, unsigned hints = kPageCacheScan, int fd = -1)
+        : path(std::move(path)), hints(hints), fd(fd) {}
+
+    std::string path;
+    unsigned hints = kPageCacheScan;
+    // Opened ahead by ScanQueue, the reader takes it over, -1 to open `path`
+    int fd = -1;
+};
+
+// Reads a file with the page cache hints of a ScanFile, parse<ScanFileReader>(ScanFile(path))
+class ScanFileReader {
+public:
+    explicit ScanFileReader(const ScanFile &file)
+        : fd_(file.fd >= 0 ? file.fd : open_for_scan(file.path.c_str(), file.hints)), hints_(file.hints) {}
+
+    ScanFileReader(const ScanFileReader &) = delete;
+    ScanFileReader &operator=(const ScanFileReader &) = delete;
+
+    ~ScanFileReader() {
+        if (fd_ >= 0) {
+            if (hints_ & kPageCacheDrop) {
+                II_FADVISE(fd_, 0, 0, POSIX_FADV_DONTNEED);
+            }
+            ::close(fd_);
+        }
+    }
+
+    inline size_t size() const { return FileDescriptorReader(fd_).size(); }
+
+    inline void read(void *buf, off_t offset, size_t size) const { FileDescriptorReader(fd_).read(buf, offset, size); }
+
+private:
+    int fd_ = -1;
+    unsigned hints_ = kPageCacheDefault;
+};
+
+/**
+ * Hands out the files of a list in order, with the next `depth` files already open and their headers requested
+ * from the kernel, so the disk works on them while the current file is parsed
+ */
+class ScanQueue {
+public:
+    ScanQueue(const std::vector<std::string> &paths, size_t first, size_t last, size_t depth,
+              unsigned hints = kPageCacheScan)
+        : paths_(paths), cursor_(first), ahead_(first), last_((std::min)(last, paths.size())), depth_(depth),
+          hints_(hints) {}
+
+    ScanQueue(const std::vector<std::string> &paths, size_t depth, unsigned hints = kPageCacheScan)
+        : ScanQueue(paths, 0, paths.size(), depth, hints) {}
+
+    ScanQueue(const ScanQueue &) = delete;
+    ScanQueue &operator=(const ScanQueue &) = delete;
+
+    ~ScanQueue() {
+        for (int fd : opened_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    // False past the end, `file` is meant for parse<ScanFileReader>(), which closes its descriptor
+    inline bool next(ScanFile &file) {
+        if (cursor_ >= last_) {
+            return false;
+        }
+        for (; ahead_ < last_ && ahead_ <= cursor_ + depth_; ++ahead_) {
+            int fd = open_for_scan(paths_[ahead_].c_str(), hints_);
+            if (fd >= 0 && ahead_ > cursor_) {
+                prefetch_pages(fd, 0, II_HEADER_CACHE_SIZE);
+            }
+            opened_.push_back(fd);
+        }
+        file = ScanFile(paths_[cursor_++], hints_, opened_.front());
+        opened_.erase(opened_.begin());
+        return true;
+    }
+
+private:
+    const std::vector<std::string> &paths_;
+    size_t cursor_;
+    size_t ahead_;
+    size_t last_;
+    size_t depth_;
+    unsigned hints_;
+    std::vector<int> opened_;
 };
 
+#endif
+
 #ifdef ANDROID
 
 class AndroidAssetFileReader {
@@ -227,6 +558,297 @@ private:
     RawData data_;
 };
 
+// Product of non-negative factors, saturated at INT64_MAX, for byte counts of declared sizes
+inline int64_t saturating_product(std::initializer_list<int64_t> factors) {
+    const uint64_t limit = (uint64_t)std::numeric_limits<int64_t>::max();
+    uint64_t product = 1;
+    for (int64_t factor : factors) {
+        if (factor <= 0) {
+            return 0;
+        }
+        if (product > limit / (uint64_t)factor) {
+            return std::numeric_limits<int64_t>::max();
+        }
+        product *= (uint64_t)factor;
+    }
+    return (int64_t)product;
+}
+
+inline uint64_t hash_mix(uint64_t h) {
+    // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+// Non-cryptographic 64-bit hash, 8 bytes per step, good enough to fingerprint headers
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t h = hash_mix(seed ^ ((uint64_t)size * 0x9E3779B97F4A7C15ull));
+    while (size >= 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        h = (h ^ hash_mix(k)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+        p += 8;
+        size -= 8;
+    }
+    uint64_t tail = 0;
+    for (size_t i = 0; i < size; ++i) {
+        tail |= (uint64_t)p[i] << (i * 8);
+    }
+    return hash_mix(h ^ tail);
+}
+
+#ifndef II_LEAN_HEADER
+
+// CRC-32 of PNG, gzip and zlib (reflected polynomial 0xEDB88320), slice-by-8 tables
+struct Crc32Tables {
+    uint32_t table[8][256];
+
+    Crc32Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1)));
+            }
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+inline const Crc32Tables &crc32_tables() {
+    static const Crc32Tables tables;
+    return tables;
+}
+
+// Portable kernel, `crc` is the register without the pre and post inversion
+inline uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t size) {
+    const auto &t = crc32_tables().table;
+    while (size >= 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^  //
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef II_CRC32_PCLMUL
+
+inline bool crc32_has_pclmul() {
+    static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    return supported;
+}
+
+/**
+ * Carry-less multiplication folding of Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ",
+ * four 128-bit lanes at a time, then a Barrett reduction. `size` is at least 64 and a multiple of 16.
+ * The crc32 instruction of SSE4.2 computes CRC-32C, a different polynomial, and is of no use for PNG.
+ */
+__attribute__((target("pclmul,sse4.1"))) inline uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size) {
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    p += 64;
+    size -= 64;
+
+    __m128i k = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    while (size >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), x5);
+        x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k, 0x11), x6);
+        x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k, 0x11), x7);
+        x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k, 0x11), x8);
+        x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)(p + 0x00)));
+        x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i *)(p + 0x10)));
+        x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i *)(p + 0x20)));
+        x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i *)(p + 0x30)));
+        p += 64;
+        size -= 64;
+    }
+
+    // Fold the four lanes into one, then the remaining 16-byte blocks
+    k = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    __m128i lanes[3] = {x2, x3, x4};
+    for (auto &lane : lanes) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), lane), x5);
+    }
+    while (size >= 16) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), x5);
+        x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)p));
+        p += 16;
+        size -= 16;
+    }
+
+    // 128 to 64 bits
+    __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    k = _mm_set_epi64x(0, 0x0163cd6124);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    k = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+    return (uint32_t)_mm_extract_epi32(_mm_xor_si128(x1, x2), 1);
+}
+
+#endif
+
+#ifdef II_CRC32_ARM
+
+inline uint32_t crc32_arm(uint32_t crc, const uint8_t *p, size_t size) {
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32d(crc, v);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = __crc32b(crc, *p++);
+    }
+    return crc;
+}
+
+#endif
+
+// Compatible with zlib's crc32(), pass the previous result as `crc` to continue a running checksum
+II_IMPL uint32_t crc32(const void *data, size_t size, uint32_t crc = 0) {
+    const auto *p = (const uint8_t *)data;
+    crc = ~crc;
+#if defined(II_CRC32_PCLMUL)
+    if (size >= 64 && crc32_has_pclmul()) {
+        size_t n = size & ~(size_t)15;
+        crc = crc32_pclmul(crc, p, n);
+        p += n;
+        size -= n;
+    }
+#elif defined(II_CRC32_ARM)
+    crc = crc32_arm(crc, p, size);
+    size = 0;
+#endif
+    return ~crc32_slice8(crc, p, size);
+}
+
+#else  // II_LEAN_HEADER
+
+uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+#endif  // II_LEAN_HEADER
+
+enum ByteOrder {
+    kLittleEndian,
+    kBigEndian,
+};
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr ByteOrder kHostByteOrder = kBigEndian;
+#else
+constexpr ByteOrder kHostByteOrder = kLittleEndian;
+#endif
+
+inline uint8_t byte_swap(uint8_t v) {
+    return v;
+}
+
+// Compilers without the builtins recognize the shift patterns as well
+inline uint16_t byte_swap(uint16_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap16(v);
+#else
+    return (uint16_t)((v >> 8) | (v << 8));
+#endif
+}
+
+inline uint32_t byte_swap(uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(v);
+#else
+    return (v >> 24) | ((v >> 8) & 0xFF00u) | ((v << 8) & 0xFF0000u) | (v << 24);
+#endif
+}
+
+inline uint64_t byte_swap(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(v);
+#else
+    return ((uint64_t)byte_swap((uint32_t)v) << 32) | byte_swap((uint32_t)(v >> 32));
+#endif
+}
+
+template <size_t N>
+struct UintOfSize;
+
+template <>
+struct UintOfSize<1> {
+    using Type = uint8_t;
+};
+
+template <>
+struct UintOfSize<2> {
+    using Type = uint16_t;
+};
+
+template <>
+struct UintOfSize<4> {
+    using Type = uint32_t;
+};
+
+template <>
+struct UintOfSize<8> {
+    using Type = uint64_t;
+};
+
+// An integer stored in `order` at any alignment, one load and at most one byte swap
+template <typename T>
+inline T load_int(const uint8_t *p, ByteOrder order) {
+    static_assert(std::is_integral<T>::value, "T is not an integer");
+    using U = typename UintOfSize<sizeof(T)>::Type;
+    U u;
+    memcpy(&u, p, sizeof(U));
+    return (T)(order == kHostByteOrder ? u : byte_swap(u));
+}
+
+/**
+ * A header field at a fixed offset, layouts of fixed headers are structs of these, e.g.
+ * struct QoiHeader { using Width = BeField<uint32_t, 4>; }; and buffer.read<QoiHeader::Width>()
+ */
+template <typename T, size_t Offset, ByteOrder Order>
+struct Field {
+    using Type = T;
+    static constexpr size_t kOffset = Offset;
+    static constexpr size_t kEnd = Offset + sizeof(T);
+
+    static inline T load(const uint8_t *p) { return load_int<T>(p + Offset, Order); }
+};
+
+template <typename T, size_t Offset>
+using LeField = Field<T, Offset, kLittleEndian>;
+
+template <typename T, size_t Offset>
+using BeField = Field<T, Offset, kBigEndian>;
+
 class Buffer {
 public:
     Buffer() = default;
@@ -278,9 +900,16 @@ public:
     inline int64_t read_s64_be(off_t offset) { return read_int<int64_t>(offset, true); }
 
     template <typename T>
-    inline T read_int(off_t offset, bool swap_endian = false) {
-        T val = *((T *)(data() + offset));
-        return swap_endian ? swap_e<T>(val) : val;
+    inline T read_int(off_t offset, bool big_endian = false) {
+        assert(offset >= 0 && (size_t)offset + sizeof(T) <= size_);
+        return load_int<T>(data() + offset, big_endian ? kBigEndian : kLittleEndian);
+    }
+
+    // A field of a header layout, the buffer has to cover it
+    template <typename F>
+    inline typename F::Type read() const {
+        assert(F::kEnd <= size_);
+        return F::load(data());
     }
 
     inline std::string read_string(off_t offset, size_t size) { return std::string((char *)data() + offset, size); }
@@ -297,20 +926,6 @@ public:
                            [this, offset, size](const void *buf) { return memcmp(data() + offset, buf, size) == 0; });
     }
 
-private:
-    template <typename T>
-    static inline T swap_e(T u) {
-        union {
-            T u;
-            uint8_t u8[sizeof(T)];
-        } src{}, dst{};
-        src.u = u;
-        for (size_t k = 0; k < sizeof(T); k++) {
-            dst.u8[k] = src.u8[sizeof(T) - k - 1];
-        }
-        return dst.u;
-    }
-
 private:
     std::shared_ptr<uint8_t> data_ = nullptr;
     size_t size_ = 0;
@@ -318,11 +933,66 @@ private:
 
 using ReadFunc = std::function<void(void *buf, off_t offset, size_t size)>;
 
+struct ReadRecord {
+    off_t offset;
+    size_t size;
+    uint64_t hash;
+};
+
+using ReadLog = std::vector<ReadRecord>;
+
+// Structural checks of a detected file, a failure is reported as kIntegrityCheckFailed
+enum VerifyLevel {
+    kVerifyNone = 0,
+    // The structure the size comes from: the PNG IHDR CRC, the WebP RIFF size, the ISOBMFF top-level box chain
+    // and the JPEG segment chain up to the first SOS, mostly within the header cache
+    kVerifyHeader,
+    // Reads the whole file: every PNG chunk CRC up to IEND, every WebP chunk, the ISOBMFF boxes inside meta,
+    // iprp and moov, the JPEG markers up to EOI
+    kVerifyFull,
+};
+
+struct ParseOptions {
+    // Read the EXIF orientation of JPEG files, turn it off for the fastest size probe,
+    // size() is then the stored size
+    bool read_exif = true;
+
+    // Walk the IFD chain and SubIFDs of TIFF files for reduced-resolution levels, a few reads per IFD
+    bool read_tiff_levels = false;
+
+    // Locate embedded thumbnails: the JPEG of EXIF IFD1, HEIF thmb items and the PSD thumbnail resource,
+    // one to three extra reads for JPEG and one per image resource for PSD
+    bool read_thumbnails = false;
+
+    // Locate EXIF, XMP and ICC blocks, in the chunk and segment walks of the size detection, plus a few reads
+    // for PNG, WebP and TIFF chunks and entries past the ones needed for the size
+    bool read_metadata = false;
+
+    // Bytes that may be read beyond the header cache to count GIF, WebP and AVIF frames,
+    // 0 only counts what the header cache holds, animated files are then reported with frame_count() -1
+    uint64_t frame_scan_budget = 0;
+
+    // PNG, WebP, JPEG and ISOBMFF (AVIF, HEIC, JPEG 2000) files only, other formats always pass
+    VerifyLevel verify = kVerifyNone;
+
+    // Report files that end before their trailer or declared length as kTruncatedFile, one read of the tail at most,
+    // see is_truncated(). ICO, CUR and ICNS files too short for their directory are then detected instead of rejected
+    bool check_truncation = false;
+
+    // Everything that may change a result, used as part of cache keys
+    inline uint64_t fingerprint() const {
+        return hash_mix(frame_scan_budget) ^ (read_exif ? 1 : 0) ^ (read_tiff_levels ? 2 : 0) ^
+               (read_thumbnails ? 4 : 0) ^ (read_metadata ? 8 : 0) ^ ((uint64_t)verify << 4) ^
+               (check_truncation ? 64 : 0);
+    }
+};
+
 class ReadInterface {
 public:
     ReadInterface() = delete;
 
-    ReadInterface(ReadFunc &read_func, size_t length) : read_func_(read_func), length_(length) {
+    ReadInterface(ReadFunc &read_func, size_t length, const ParseOptions &options = ParseOptions())
+        : read_func_(read_func), length_(length), options_(options) {
 #ifndef II_DISABLE_HEADER_CACHE
         header_cache_.alloc((std::min)((size_t)II_HEADER_CACHE_SIZE, length));
         read(header_cache_.data(), 0, header_cache_.size());
@@ -346,17 +1016,36 @@ public:
 #else
         read(buffer.data(), offset, size);
 #endif
+        if (read_log_ != nullptr) {
+            read_log_->push_back({offset, size, hash_bytes(buffer.data(), size)});
+        }
         return buffer;
     }
 
     inline size_t length() const { return length_; }
 
+    // Reads below this offset are served from memory
+    inline size_t header_cache_size() const {
+#ifndef II_DISABLE_HEADER_CACHE
+        return header_cache_.size();
+#else
+        return 0;
+#endif
+    }
+
+    inline const ParseOptions &options() const { return options_; }
+
+    // Record every buffer handed to detectors, used to fingerprint the bytes a result depends on
+    inline void set_read_log(ReadLog *read_log) { read_log_ = read_log; }
+
 private:
     inline void read(void *buf, off_t offset, size_t size) { read_func_(buf, offset, size); }
 
 private:
     ReadFunc &read_func_;
     size_t length_ = 0;
+    ParseOptions options_;
+    ReadLog *read_log_ = nullptr;
 #ifndef II_DISABLE_HEADER_CACHE
     Buffer header_cache_;
 #endif
@@ -381,26 +1070,116 @@ public:
 
 using EntrySizes = std::vector<ImageSize>;
 
-class ImageInfo {
-public:
-    ImageInfo() = default;
-    explicit ImageInfo(Error error) : error_(error) {}
-    ImageInfo(Format format, const char *ext, const char *full_ext, const char *mimetype)
-        : format_(format), ext_(ext), full_ext_(full_ext), mimetype_(mimetype) {}
-
+// One resolution level of a mipmapped or pyramidal image
+class ImageLevel {
 public:
-    inline void set_size(const ImageSize &size) { size_ = size; }
+    ImageLevel() = default;
 
-    inline void set_size(int64_t width, int64_t height) { size_ = ImageSize(width, height); }
+    ImageLevel(int64_t width, int64_t height, uint32_t layers = 1) : size(width, height), layers(layers) {}
 
-    inline void set_entry_sizes(const EntrySizes &entry_sizes) { entry_sizes_ = entry_sizes; }
+    inline bool operator==(const ImageLevel &rhs) const { return size == rhs.size && layers == rhs.layers; }
 
-    inline void add_entry_size(const ImageSize &size) { entry_sizes_.emplace_back(size); }
+    ImageSize size;
+    // Array elements times cube faces stored at this level
+    uint32_t layers = 1;
+};
 
-    inline void add_entry_size(int64_t width, int64_t height) { entry_sizes_.emplace_back(width, height); }
+// Level 0 is the full size, each following level is smaller
+using ImageLevels = std::vector<ImageLevel>;
 
+// An embedded preview stored as one contiguous range of the file
+class Thumbnail {
 public:
-    inline explicit operator bool() const { return error_ == kNoError; }
+    Thumbnail() = default;
+
+    Thumbnail(off_t offset, size_t length, Format format, const ImageSize &size)
+        : offset(offset), length(length), format(format), size(size) {}
+
+    inline bool operator==(const Thumbnail &rhs) const {
+        return offset == rhs.offset && length == rhs.length && format == rhs.format && size == rhs.size;
+    }
+
+    off_t offset = 0;
+    size_t length = 0;
+    // A JPEG file, or for HEIF thumbnail items kFormatHeic or kFormatAvif: bare HEVC or AV1 coded data
+    Format format = kFormatUnknown;
+    ImageSize size;
+};
+
+using Thumbnails = std::vector<Thumbnail>;
+
+enum MetadataKind {
+    kMetadataExif = 0,
+    kMetadataXmp,
+    kMetadataIcc,
+};
+
+/**
+ * Payload of an EXIF, XMP or ICC block. EXIF starts at its TIFF header, or is the Exif IFD of a TIFF file,
+ * XMP is the XML packet. A JPEG ICC profile may span several APP2 blocks, concatenate them in order.
+ */
+class MetadataBlock {
+public:
+    MetadataBlock() = default;
+
+    MetadataBlock(MetadataKind kind, off_t offset, size_t length, bool compressed = false)
+        : kind(kind), offset(offset), length(length), compressed(compressed) {}
+
+    inline bool operator==(const MetadataBlock &rhs) const {
+        return kind == rhs.kind && offset == rhs.offset && length == rhs.length && compressed == rhs.compressed;
+    }
+
+    MetadataKind kind = kMetadataExif;
+    off_t offset = 0;
+    size_t length = 0;
+    // zlib stream, PNG iCCP and compressed iTXt
+    bool compressed = false;
+};
+
+using MetadataBlocks = std::vector<MetadataBlock>;
+
+class ImageInfo {
+public:
+    ImageInfo() = default;
+    explicit ImageInfo(Error error) : error_(error) {}
+    // ext(), full_ext() and mimetype() come from kFormatDescriptors
+    explicit ImageInfo(Format format) : format_(format) {}
+
+public:
+    inline void set_size(const ImageSize &size) { size_ = size; }
+
+    inline void set_size(int64_t width, int64_t height) { size_ = ImageSize(width, height); }
+
+    inline void set_entry_sizes(const EntrySizes &entry_sizes) { entry_sizes_ = entry_sizes; }
+
+    inline void add_entry_size(const ImageSize &size) { entry_sizes_.emplace_back(size); }
+
+    inline void add_entry_size(int64_t width, int64_t height) { entry_sizes_.emplace_back(width, height); }
+
+    inline void set_levels(const ImageLevels &levels) { levels_ = levels; }
+
+    inline void add_level(const ImageLevel &level) { levels_.emplace_back(level); }
+
+    inline void add_thumbnail(const Thumbnail &thumbnail) { thumbnails_.emplace_back(thumbnail); }
+
+    inline void add_metadata(const MetadataBlock &block) { metadata_.emplace_back(block); }
+
+    inline void set_orientation(int orientation) { orientation_ = orientation; }
+
+    inline void set_progressive(bool progressive) { progressive_ = progressive; }
+
+    inline void set_chroma_subsampling(int x, int y) { chroma_subsampling_ = ImageSize(x, y); }
+
+    inline void set_frame_count(int64_t frame_count) { frame_count_ = frame_count; }
+
+    inline void set_pixel_format(int bit_depth, int channels, bool has_alpha) {
+        bit_depth_ = bit_depth;
+        channels_ = channels;
+        has_alpha_ = has_alpha;
+    }
+
+public:
+    inline explicit operator bool() const { return error_ == kNoError; }
 
     inline bool ok() const { return error_ == kNoError; }
 
@@ -412,6 +1191,12 @@ public:
                 return "No error";
             case kUnrecognizedFormat:
                 return "Unrecognized format";
+            case kUnsupportedMember:
+                return "Compressed or encrypted archive member";
+            case kIntegrityCheckFailed:
+                return "Integrity check failed";
+            case kTruncatedFile:
+                return "Truncated file";
             default:
                 return "Unknown error";
         }
@@ -419,30 +1204,369 @@ public:
 
     inline Format format() const { return format_; }
 
-    inline const char *ext() const { return ext_; }
+    inline const char *ext() const { return format_descriptor(format_).ext; }
 
-    inline const char *full_ext() const { return full_ext_; }
+    inline const char *full_ext() const { return format_descriptor(format_).full_ext; }
 
-    inline const char *mimetype() const { return mimetype_; }
+    inline const char *mimetype() const { return format_descriptor(format_).mimetype; }
 
     inline const ImageSize &size() const { return size_; }
 
     inline const EntrySizes &entry_sizes() const { return entry_sizes_; }
 
+    // Empty unless the file stores more than one resolution level or layer
+    inline const ImageLevels &levels() const { return levels_; }
+
+    // Embedded previews, only looked for with ParseOptions::read_thumbnails
+    inline const Thumbnails &thumbnails() const { return thumbnails_; }
+
+    // EXIF, XMP and ICC blocks in file order, only looked for with ParseOptions::read_metadata
+    inline const MetadataBlocks &metadata() const { return metadata_; }
+
+    // EXIF orientation, 1 to 8, HEIF irot and imir are mapped to the same values
+    inline int orientation() const { return orientation_; }
+
+    // Size of the stored pixels, size() is the display size with orientation applied
+    inline ImageSize stored_size() const {
+        if (orientation_ >= 5 && orientation_ <= 8) {
+            return ImageSize(size_.height, size_.width);
+        }
+        return size_;
+    }
+
+    // Progressive JPEG or interlaced PNG, decoders keep the whole image in flight
+    inline bool progressive() const { return progressive_; }
+
+    // Horizontal and vertical luma samples per chroma sample of JPEG files, {2, 2} is 4:2:0
+    inline const ImageSize &chroma_subsampling() const { return chroma_subsampling_; }
+
+    // 1 for still images, -1 if the image is animated but its frames were not counted
+    inline int64_t frame_count() const { return frame_count_; }
+
+    // More than one frame
+    inline bool is_animated() const { return frame_count_ != 1; }
+
+    // Bits per decoded channel sample, -1 if the header does not tell
+    inline int bit_depth() const { return bit_depth_; }
+
+    // Number of decoded channels including alpha, -1 if the header does not tell
+    inline int channels() const { return channels_; }
+
+    inline bool has_alpha() const { return has_alpha_; }
+
+    /**
+     * Memory needed to hold the decoded main image, width * height * channels * bytes per sample.
+     * Unknown channels and bit depth are taken as RGBA8, the result saturates at INT64_MAX.
+     */
+    inline int64_t decoded_bytes_estimate() const {
+        if (size_.width <= 0 || size_.height <= 0) {
+            return 0;
+        }
+        int64_t channels = channels_ > 0 ? channels_ : 4;
+        int64_t sample_bytes = bit_depth_ > 0 ? ((int64_t)bit_depth_ + 7) / 8 : 1;
+        return saturating_product({size_.width, size_.height, channels, sample_bytes});
+    }
+
 private:
     Format format_ = kFormatUnknown;
-    const char *ext_ = "";
-    const char *full_ext_ = "";
-    const char *mimetype_ = "";
     ImageSize size_;
     EntrySizes entry_sizes_;
+    ImageLevels levels_;
+    Thumbnails thumbnails_;
+    MetadataBlocks metadata_;
+    int orientation_ = 1;
+    bool progressive_ = false;
+    ImageSize chroma_subsampling_ = ImageSize(1, 1);
+    int64_t frame_count_ = 1;
+    int bit_depth_ = -1;
+    int channels_ = -1;
+    bool has_alpha_ = false;
     Error error_ = kNoError;
 };
 
+/**
+ * Trivially copyable 24 bytes summary of an ImageInfo, for flat arrays, shared memory and passing between threads
+ * by value. Keeps the size, format, error, pixel format, orientation and flags, entry sizes are only counted.
+ */
+struct CompactImageInfo {
+    enum Flags : uint8_t {
+        kFlagAlpha = 0x01,
+        kFlagProgressive = 0x02,
+        kFlagAnimated = 0x04,
+    };
+
+    int64_t width;
+    int64_t height;
+    uint8_t format;
+    uint8_t error;
+    uint8_t orientation;
+    // 0 when the header does not tell
+    uint8_t bit_depth;
+    uint8_t channels;
+    uint8_t flags;
+    // Saturated at 65535
+    uint16_t entry_count;
+
+    static inline CompactImageInfo from(const ImageInfo &info) {
+        CompactImageInfo compact{};
+        compact.width = info.size().width;
+        compact.height = info.size().height;
+        compact.format = (uint8_t)info.format();
+        compact.error = (uint8_t)info.error();
+        compact.orientation = (uint8_t)info.orientation();
+        compact.bit_depth = (uint8_t)(info.bit_depth() > 0 ? info.bit_depth() : 0);
+        compact.channels = (uint8_t)(info.channels() > 0 ? info.channels() : 0);
+        compact.flags = (uint8_t)((info.has_alpha() ? kFlagAlpha : 0) | (info.progressive() ? kFlagProgressive : 0) |
+                                  (info.is_animated() ? kFlagAnimated : 0));
+        compact.entry_count = (uint16_t)(std::min)(info.entry_sizes().size(), (size_t)65535);
+        return compact;
+    }
+
+    inline bool ok() const { return error == kNoError; }
+
+    inline const FormatDescriptor &descriptor() const { return format_descriptor((Format)format); }
+
+    inline ImageSize size() const { return ImageSize(width, height); }
+
+    // Without entry sizes, levels, thumbnails, metadata, chroma subsampling and the frame count
+    inline ImageInfo to_image_info() const {
+        if (error != kNoError) {
+            return ImageInfo((Error)error);
+        }
+        ImageInfo info((Format)format);
+        info.set_size(width, height);
+        info.set_orientation(orientation);
+        info.set_progressive((flags & kFlagProgressive) != 0);
+        info.set_pixel_format(bit_depth != 0 ? bit_depth : -1, channels != 0 ? channels : -1,
+                              (flags & kFlagAlpha) != 0);
+        if (flags & kFlagAnimated) {
+            info.set_frame_count(-1);
+        }
+        return info;
+    }
+};
+
+static_assert(sizeof(CompactImageInfo) == 24, "sizeof(CompactImageInfo) != 24");
+static_assert(std::is_trivially_copyable<CompactImageInfo>::value, "CompactImageInfo is not trivially copyable");
+
+template <typename T, size_t N>
+inline constexpr size_t countof(T (&)[N]) noexcept {
+    return N;
+}
+
+#ifndef II_LEAN_HEADER
+
 inline bool is_numeric(const std::string &str) {
     return !str.empty() && std::all_of(str.begin(), str.end(), ::isdigit);
 }
 
+// A mip chain halving down to 1x1 or `count` levels, listed only if there is more than one level or layer
+inline void set_mip_levels(ImageInfo &info, uint32_t count, uint32_t layers) {
+    ImageSize size = info.size();
+    if (size.width <= 0 || size.height <= 0 || (count <= 1 && layers <= 1)) {
+        return;
+    }
+    ImageLevels levels;
+    for (uint32_t i = 0; i < (std::max)(count, 1u) && i < 64; ++i) {
+        levels.emplace_back((std::max)(size.width >> i, (int64_t)1), (std::max)(size.height >> i, (int64_t)1), layers);
+        if ((size.width >> i) <= 1 && (size.height >> i) <= 1) {
+            break;
+        }
+    }
+    info.set_levels(levels);
+}
+
+// Window size of block-skipping scans
+#ifndef II_SCAN_WINDOW_SIZE
+#define II_SCAN_WINDOW_SIZE (4096)
+#endif
+
+// Accounts reads of frame scans against ParseOptions::frame_scan_budget, the header cache is free
+class ScanBudget {
+public:
+    explicit ScanBudget(ReadInterface &ri) : ri_(ri), left_(ri.options().frame_scan_budget) {}
+
+    // Whether `size` bytes at `offset` may be read
+    inline bool take(uint64_t offset, size_t size) {
+        if (offset + size <= ri_.header_cache_size()) {
+            return true;
+        }
+        if (left_ < size) {
+            return false;
+        }
+        left_ -= size;
+        return true;
+    }
+
+    // Largest read of at most `size` bytes at `offset` that stays in the header cache or the budget
+    inline size_t take_up_to(uint64_t offset, size_t size) {
+        size_t cached = ri_.header_cache_size();
+        if (offset < cached) {
+            return (std::min)(size, (size_t)(cached - offset));
+        }
+        size = (size_t)(std::min)((uint64_t)size, left_);
+        left_ -= size;
+        return size;
+    }
+
+private:
+    ReadInterface &ri_;
+    uint64_t left_;
+};
+
+// Find a child box in [start, end) reading only box headers, box_start is past the header
+inline bool iso_find_box(ReadInterface &ri, ScanBudget &budget, uint64_t start, uint64_t end, const char *type,
+                         uint64_t &box_start, uint64_t &box_end) {
+    uint64_t offset = start;
+    while (offset + 8 <= end) {
+        if (!budget.take(offset, 8)) {
+            return false;
+        }
+        auto header = ri.read_buffer((off_t)offset, 8);
+        uint64_t size = header.read_u32_be(0);
+        uint64_t header_size = 8;
+        if (size == 1) {
+            if (offset + 16 > end || !budget.take(offset + 8, 8)) {
+                return false;
+            }
+            size = ri.read_buffer((off_t)offset + 8, 8).read_u64_be(0);
+            header_size = 16;
+        } else if (size == 0) {
+            size = end - offset;
+        }
+        if (size < header_size || size > end - offset) {
+            return false;
+        }
+        if (header.cmp(4, 4, type)) {
+            box_start = offset + header_size;
+            box_end = offset + size;
+            return true;
+        }
+        offset += size;
+    }
+    return false;
+}
+
+// Sample count of the first track of an image sequence, -1 if it can not be reached within the budget
+inline int64_t iso_sequence_frame_count(ReadInterface &ri, size_t length) {
+    ScanBudget budget(ri);
+    uint64_t start = 0;
+    uint64_t end = length;
+    for (const char *type : {"moov", "trak", "mdia", "minf", "stbl", "stsz"}) {
+        if (!iso_find_box(ri, budget, start, end, type, start, end)) {
+            return -1;
+        }
+    }
+    // version and flags(4), sample_size(4), sample_count(4)
+    if (end - start < 12 || !budget.take(start + 8, 4)) {
+        return -1;
+    }
+    uint32_t sample_count = ri.read_buffer((off_t)start + 8, 4).read_u32_be(0);
+    return sample_count >= 1 ? sample_count : -1;
+}
+
+// Item locations of an iloc box in [offset, end) of buffer, only items stored as one extent in the file itself.
+// `data_end`, if given, is raised to the end of every extent in the file, whatever the number of extents
+inline void heif_item_locations(Buffer &buffer, off_t offset, off_t end,
+                                std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> &locations,
+                                uint64_t *data_end = nullptr) {
+    auto read_uint = [&buffer](off_t at, uint8_t size, uint64_t &value) {
+        switch (size) {
+            case 0:
+                value = 0;
+                return true;
+            case 4:
+                value = buffer.read_u32_be(at);
+                return true;
+            case 8:
+                value = buffer.read_u64_be(at);
+                return true;
+            default:
+                return false;
+        }
+    };
+    // FullBox, offset_size(4 bits), length_size(4), base_offset_size(4), index_size(4) or reserved, item_count
+    if (offset + 16 > end) {
+        return;
+    }
+    uint8_t version = buffer.read_u8(offset + 8);
+    uint8_t offset_size = buffer.read_u8(offset + 12) >> 4;
+    uint8_t length_size = buffer.read_u8(offset + 12) & 0x0F;
+    uint8_t base_offset_size = buffer.read_u8(offset + 13) >> 4;
+    uint8_t index_size = version >= 1 ? buffer.read_u8(offset + 13) & 0x0F : 0;
+    uint32_t item_count = version < 2 ? buffer.read_u16_be(offset + 14) : buffer.read_u32_be(offset + 14);
+    off_t t = offset + (version < 2 ? 16 : 18);
+    off_t id_size = version < 2 ? 2 : 4;
+    for (uint32_t i = 0; i < item_count; ++i) {
+        // item_ID, construction_method(2) for version 1 and 2, data_reference_index(2), base_offset, extent_count(2)
+        off_t method_size = version >= 1 ? 2 : 0;
+        if (t + id_size + method_size + 2 + base_offset_size + 2 > end) {
+            return;
+        }
+        uint32_t item_id = id_size == 2 ? buffer.read_u16_be(t) : buffer.read_u32_be(t);
+        t += id_size;
+        uint16_t construction_method = version >= 1 ? buffer.read_u16_be(t) & 0x0F : 0;
+        t += method_size;
+        uint16_t data_reference_index = buffer.read_u16_be(t);
+        t += 2;
+        uint64_t base_offset = 0;
+        if (!read_uint(t, base_offset_size, base_offset)) {
+            return;
+        }
+        t += base_offset_size;
+        uint16_t extent_count = buffer.read_u16_be(t);
+        t += 2;
+        uint64_t extent_offset = 0;
+        uint64_t extent_length = 0;
+        for (uint16_t j = 0; j < extent_count; ++j) {
+            if (t + index_size + offset_size + length_size > end) {
+                return;
+            }
+            t += index_size;
+            if (!read_uint(t, offset_size, extent_offset) || !read_uint(t + offset_size, length_size, extent_length)) {
+                return;
+            }
+            t += offset_size + length_size;
+            if (data_end != nullptr && construction_method == 0 && data_reference_index == 0) {
+                *data_end = (std::max)(*data_end, base_offset + extent_offset + extent_length);
+            }
+        }
+        if (extent_count == 1 && construction_method == 0 && data_reference_index == 0) {
+            locations[item_id] = std::make_pair(base_offset + extent_offset, extent_length);
+        }
+    }
+}
+
+// Exif and XMP items, an Exif item starts with the offset of its TIFF header
+inline void heif_metadata(ReadInterface &ri, size_t length, const std::unordered_map<uint32_t, std::string> &item_types,
+                          const std::unordered_set<uint32_t> &xmp_items,
+                          const std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> &item_locations,
+                          ImageInfo &info) {
+    // In item_ID order, the maps are unordered
+    std::vector<std::pair<uint32_t, std::string>> items(item_types.begin(), item_types.end());
+    std::sort(items.begin(), items.end());
+    for (const auto &p : items) {
+        auto location_it = item_locations.find(p.first);
+        if (location_it == item_locations.end()) {
+            continue;
+        }
+        uint64_t item_offset = location_it->second.first;
+        uint64_t item_length = location_it->second.second;
+        if (item_offset > length || item_length > length - item_offset) {
+            continue;
+        }
+        if (p.second == "Exif" && item_length >= 4) {
+            uint32_t tiff_header = ri.read_buffer((off_t)item_offset, 4).read_u32_be(0);
+            if (tiff_header <= item_length - 4) {
+                info.add_metadata(MetadataBlock(kMetadataExif, (off_t)(item_offset + 4 + tiff_header),
+                                                (size_t)(item_length - 4 - tiff_header)));
+            }
+        } else if (xmp_items.find(p.first) != xmp_items.end()) {
+            info.add_metadata(MetadataBlock(kMetadataXmp, (off_t)item_offset, (size_t)item_length));
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // https://nokiatech.github.io/heif/technical.html
@@ -483,20 +1607,17 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
         compatible_brands.insert(buffer.read_string(16 + i * 4, 4));
     }
 
+    // Image sequences keep their frames in a moov track next to the meta of the primary image
+    bool is_sequence = buffer.cmp_any_of(8, 4, {"avis", "msf1", "hevc", "hevx"});
+    for (const char *brand : {"avis", "msf1"}) {
+        is_sequence = is_sequence || compatible_brands.find(brand) != compatible_brands.end();
+    }
+
     Format format;
-    const char *ext;
-    const char *full_ext;
-    const char *mimetype;
     if (compatible_brands.find("avif") != compatible_brands.end() || buffer.cmp(8, 4, "avif")) {
         format = kFormatAvif;
-        ext = "avif";
-        full_ext = "avif";
-        mimetype = "image/avif";
     } else if (compatible_brands.find("heic") != compatible_brands.end() || buffer.cmp(8, 4, "heic")) {
         format = kFormatHeic;
-        ext = "heic";
-        full_ext = "heic";
-        mimetype = "image/heic";
     } else {
         return false;
     }
@@ -528,12 +1649,29 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
      *           - ispe
      */
     uint16_t pitm_id = 0;
-    std::unordered_map<uint16_t, std::unordered_set<uint8_t>> ipma_map;
+    // item_ID -> property indices as a bit mask, indices are 4 bits
+    std::unordered_map<uint16_t, uint16_t> ipma_map;
+    auto associated = [](uint16_t mask, uint8_t index) { return index < 16 && ((mask >> index) & 1) != 0; };
     off_t ipco_start = 0;
     off_t ipco_end = 0;
     uint8_t ipco_child_index = 1;
     std::unordered_map<uint8_t, ImageSize> ispe_map;
     std::unordered_map<uint8_t, uint8_t> irot_map;
+    std::unordered_map<uint8_t, uint8_t> imir_map;
+    // ipco child index -> (bit depth, channels), from pixi and from the codec configuration
+    std::unordered_map<uint8_t, std::pair<int, int>> pixi_map;
+    std::unordered_map<uint8_t, std::pair<int, int>> codec_map;
+    bool has_alpha = false;
+    // Thumbnails: item types from infe, thmb references (from, to) from iref, and item locations from iloc
+    bool read_thumbnails = ri.options().read_thumbnails;
+    // Metadata: Exif items, mime items holding XMP, and ICC profiles of colr properties by ipco child index
+    bool read_metadata = ri.options().read_metadata;
+    bool read_items = read_thumbnails || read_metadata;
+    std::unordered_set<uint32_t> xmp_items;
+    std::unordered_map<uint8_t, std::pair<uint64_t, uint64_t>> icc_map;
+    std::unordered_map<uint32_t, std::string> item_types;
+    std::vector<std::pair<uint32_t, uint32_t>> thmb_refs;
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> item_locations;
     while (offset < end) {
         if (offset + 8 > end) {
             break;
@@ -553,6 +1691,7 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
                 return false;
             }
             uint16_t entry_count = buffer.read_u16_be(offset + 14);
+            ipma_map.reserve(ipma_map.size() + entry_count);
             off_t t = offset + 16;
             for (uint16_t i = 0; i < entry_count; ++i) {
                 if (t + 2 > offset + box_size) {
@@ -568,16 +1707,68 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
                 if (t + index_count > offset + box_size) {
                     return false;
                 }
-                std::unordered_set<uint8_t> indices;
+                uint16_t indices = 0;
                 for (uint8_t j = 0; j < index_count; ++j, ++t) {
-                    auto index = buffer.read_u8(t) & 0x0F;
-                    indices.insert(index);
+                    indices |= (uint16_t)(1u << (buffer.read_u8(t) & 0x0F));
                 }
                 ipma_map[item_id] = indices;
             }
             offset += box_size;
         } else if (buffer.cmp(offset + 4, 4, "iprp")) {
             offset += 8;
+        } else if (read_items && buffer.cmp(offset + 4, 4, "iinf") && box_size >= 14) {
+            // FullBox, entry_count(2 or 4), then the infe children
+            offset += buffer.read_u8(offset + 8) == 0 ? 14 : 16;
+        } else if (read_items && buffer.cmp(offset + 4, 4, "infe")) {
+            // FullBox version 2 or 3, item_ID(2 or 4), item_protection_index(2), item_type(4),
+            // then item_name and, for mime items, content_type as null terminated strings
+            uint8_t version = buffer.read_u8(offset + 8);
+            uint32_t item_id = 0;
+            off_t type_pos = 0;
+            if (version == 2 && box_size >= 20) {
+                item_id = buffer.read_u16_be(offset + 12);
+                type_pos = offset + 16;
+            } else if (version == 3 && box_size >= 22) {
+                item_id = buffer.read_u32_be(offset + 12);
+                type_pos = offset + 18;
+            }
+            if (type_pos != 0) {
+                item_types[item_id] = buffer.read_string(type_pos, 4);
+                if (read_metadata && buffer.cmp(type_pos, 4, "mime")) {
+                    const char *names = (const char *)buffer.data() + type_pos + 4;
+                    size_t names_size = offset + box_size - type_pos - 4;
+                    size_t name_end = strnlen(names, names_size);
+                    static const char xmp_type[] = "application/rdf+xml";
+                    if (name_end + sizeof(xmp_type) <= names_size &&
+                        memcmp(names + name_end + 1, xmp_type, sizeof(xmp_type)) == 0) {
+                        xmp_items.insert(item_id);
+                    }
+                }
+            }
+            offset += box_size;
+        } else if (read_thumbnails && buffer.cmp(offset + 4, 4, "iref")) {
+            // FullBox, then references: size(4), type(4), from_item_ID, reference_count(2), to_item_ID...
+            off_t id_size = buffer.read_u8(offset + 8) == 0 ? 2 : 4;
+            auto read_id = [&](off_t at) { return id_size == 2 ? buffer.read_u16_be(at) : buffer.read_u32_be(at); };
+            off_t t = offset + 12;
+            while (t + 8 <= offset + box_size) {
+                uint32_t reference_size = buffer.read_u32_be(t);
+                if (reference_size < 10 + id_size || t + reference_size > offset + box_size) {
+                    break;
+                }
+                if (buffer.cmp(t + 4, 4, "thmb")) {
+                    uint32_t from = read_id(t + 8);
+                    uint16_t count = buffer.read_u16_be(t + 8 + id_size);
+                    for (uint16_t i = 0; i < count && t + 10 + (i + 1) * id_size <= t + reference_size; ++i) {
+                        thmb_refs.emplace_back(from, read_id(t + 10 + id_size + i * id_size));
+                    }
+                }
+                t += reference_size;
+            }
+            offset += box_size;
+        } else if (read_items && buffer.cmp(offset + 4, 4, "iloc")) {
+            heif_item_locations(buffer, offset, offset + box_size, item_locations);
+            offset += box_size;
         } else if (buffer.cmp(offset + 4, 4, "ipco")) {
             ipco_start = offset;
             ipco_end = offset + box_size;
@@ -599,6 +1790,57 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
             irot_map[ipco_child_index] = irot;
             ipco_child_index++;
             offset += box_size;
+        } else if (buffer.cmp(offset + 4, 4, "imir")) {
+            if (box_size < 9) {
+                return false;
+            }
+            imir_map[ipco_child_index] = buffer.read_u8(offset + 8) & 0x01;
+            ipco_child_index++;
+            offset += box_size;
+        } else if (buffer.cmp(offset + 4, 4, "pixi")) {
+            // FullBox, num_channels, bits_per_channel[num_channels]
+            if (box_size >= 14) {
+                uint8_t num_channels = buffer.read_u8(offset + 12);
+                if (num_channels > 0 && 13 + (uint32_t)num_channels <= box_size) {
+                    pixi_map[ipco_child_index] = std::make_pair((int)buffer.read_u8(offset + 13), (int)num_channels);
+                }
+            }
+            ipco_child_index++;
+            offset += box_size;
+        } else if (buffer.cmp(offset + 4, 4, "av1C")) {
+            // seq_tier_0, high_bitdepth, twelve_bit, monochrome, ...
+            if (box_size >= 11) {
+                uint8_t flags = buffer.read_u8(offset + 10);
+                int bit_depth = (flags & 0x40) ? ((flags & 0x20) ? 12 : 10) : 8;
+                codec_map[ipco_child_index] = std::make_pair(bit_depth, (flags & 0x10) ? 1 : 3);
+            }
+            ipco_child_index++;
+            offset += box_size;
+        } else if (buffer.cmp(offset + 4, 4, "hvcC")) {
+            // chroma_format_idc and bit_depth_luma_minus8 follow the 16 bytes of profile and level
+            if (box_size >= 26) {
+                int chroma_format = buffer.read_u8(offset + 24) & 0x03;
+                int bit_depth = (buffer.read_u8(offset + 25) & 0x07) + 8;
+                codec_map[ipco_child_index] = std::make_pair(bit_depth, chroma_format == 0 ? 1 : 3);
+            }
+            ipco_child_index++;
+            offset += box_size;
+        } else if (buffer.cmp(offset + 4, 4, "auxC")) {
+            // The alpha plane is an auxiliary image, its auxC names the alpha urn
+            auto aux_type = buffer.read_string(offset + 12, box_size > 12 ? box_size - 12 : 0);
+            if (aux_type.compare(0, 43, "urn:mpeg:mpegB:cicp:systems:auxiliary:alpha") == 0 ||
+                aux_type.compare(0, 26, "urn:mpeg:hevc:2015:auxid:1") == 0) {
+                has_alpha = true;
+            }
+            ipco_child_index++;
+            offset += box_size;
+        } else if (read_metadata && buffer.cmp(offset + 4, 4, "colr") && offset > ipco_start && offset < ipco_end) {
+            // colour_type(4), restricted or unrestricted ICC profiles follow
+            if (box_size > 12 && buffer.cmp_any_of(offset + 8, 4, {"prof", "rICC"})) {
+                icc_map[ipco_child_index] = std::make_pair(ftyp_box_length + 12 + offset + 12, box_size - 12);
+            }
+            ipco_child_index++;
+            offset += box_size;
         } else {
             if (offset > ipco_start && offset < ipco_end) {
                 ipco_child_index++;
@@ -611,24 +1853,90 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (ipma_it == ipma_map.end()) {
         return false;
     }
-    auto &indices = ipma_it->second;
+    uint16_t indices = ipma_it->second;
     uint8_t irot = 0;
     for (const auto &pair : irot_map) {
         auto index = pair.first;
-        if (indices.find(index) != indices.end()) {
+        if (associated(indices, index)) {
             irot = pair.second;
             break;
         }
     }
+    int imir = -1;
+    for (const auto &pair : imir_map) {
+        if (associated(indices, pair.first)) {
+            imir = pair.second;
+            break;
+        }
+    }
     for (const auto &pair : ispe_map) {
         auto index = pair.first;
-        if (indices.find(index) != indices.end()) {
+        if (associated(indices, index)) {
             auto size = pair.second;
-            if (irot == 1 || irot == 3 || irot == 6 || irot == 7) {
+            // irot rotates anti-clockwise by angle * 90, then imir mirrors about the vertical (0)
+            // or horizontal (1) axis
+            static const int irot_imir_to_orientation[3][4] = {
+                {1, 8, 3, 6},
+                {2, 7, 4, 5},
+                {4, 5, 2, 7},
+            };
+            int orientation = irot_imir_to_orientation[imir + 1][irot & 0x03];
+            if (orientation >= 5) {
                 std::swap(size.width, size.height);
             }
-            info = ImageInfo(format, ext, full_ext, mimetype);
+            info = ImageInfo(format);
             info.set_size(size);
+            info.set_orientation(orientation);
+            std::pair<int, int> pixel(-1, -1);
+            for (const auto *map : {&codec_map, &pixi_map}) {
+                for (const auto &p : *map) {
+                    if (associated(indices, p.first)) {
+                        pixel = p.second;
+                    }
+                }
+            }
+            if (pixel.second > 0) {
+                info.set_pixel_format(pixel.first, pixel.second + (has_alpha ? 1 : 0), has_alpha);
+            }
+            if (is_sequence) {
+                info.set_frame_count(iso_sequence_frame_count(ri, length));
+            }
+            for (const auto &ref : thmb_refs) {
+                auto type_it = item_types.find(ref.first);
+                auto location_it = item_locations.find(ref.first);
+                if (ref.second != pitm_id || type_it == item_types.end() || location_it == item_locations.end()) {
+                    continue;
+                }
+                Format thumbnail_format = type_it->second == "hvc1"   ? kFormatHeic
+                                          : type_it->second == "av01" ? kFormatAvif
+                                          : type_it->second == "jpeg" ? kFormatJpeg
+                                                                      : kFormatUnknown;
+                uint64_t thumbnail_offset = location_it->second.first;
+                uint64_t thumbnail_length = location_it->second.second;
+                if (thumbnail_format == kFormatUnknown || thumbnail_offset > length ||
+                    thumbnail_length > length - thumbnail_offset) {
+                    continue;
+                }
+                ImageSize thumbnail_size;
+                auto thumbnail_ipma_it = ipma_map.find((uint16_t)ref.first);
+                if (thumbnail_ipma_it != ipma_map.end()) {
+                    for (const auto &p : ispe_map) {
+                        if (associated(thumbnail_ipma_it->second, p.first)) {
+                            thumbnail_size = p.second;
+                        }
+                    }
+                }
+                info.add_thumbnail(
+                    Thumbnail((off_t)thumbnail_offset, (size_t)thumbnail_length, thumbnail_format, thumbnail_size));
+            }
+            if (read_metadata) {
+                heif_metadata(ri, length, item_types, xmp_items, item_locations, info);
+                for (const auto &p : icc_map) {
+                    if (associated(indices, p.first)) {
+                        info.add_metadata(MetadataBlock(kMetadataIcc, (off_t)p.second.first, p.second.second));
+                    }
+                }
+            }
             return true;
         }
     }
@@ -639,6 +1947,14 @@ inline bool try_avif_heic(ReadInterface &ri, size_t length, ImageInfo &info) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // https://www.fileformat.info/format/bmp/corion.htm
+// BITMAPFILEHEADER(14), then BITMAPINFOHEADER
+struct BmpHeader {
+    // Negative heights are top-down
+    using Width = LeField<int32_t, 18>;
+    using Height = LeField<int32_t, 22>;
+    using BitCount = LeField<uint16_t, 28>;
+};
+
 inline bool try_bmp(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 26) {
         return false;
@@ -648,12 +1964,23 @@ inline bool try_bmp(ReadInterface &ri, size_t length, ImageInfo &info) {
         return false;
     }
 
-    info = ImageInfo(kFormatBmp, "bmp", "bmp", "image/bmp");
+    info = ImageInfo(kFormatBmp);
     // bmp height can be negative, it means flip Y
-    info.set_size(                        //
-        buffer.read_s32_le(18),           //
-        std::abs(buffer.read_s32_le(22))  //
+    info.set_size(                                  //
+        buffer.read<BmpHeader::Width>(),            //
+        std::abs(buffer.read<BmpHeader::Height>())  //
     );
+    if (length >= 30) {
+        // Palette and 16 bits images decode to RGB8
+        buffer = ri.read_buffer(0, 30);
+        uint16_t bit_count = buffer.read<BmpHeader::BitCount>();
+        if (bit_count == 32) {
+            info.set_pixel_format(8, 4, true);
+        } else if (bit_count == 1 || bit_count == 2 || bit_count == 4 || bit_count == 8 || bit_count == 16 ||
+                   bit_count == 24) {
+            info.set_pixel_format(8, 3, false);
+        }
+    }
     return true;
 }
 
@@ -666,19 +1993,10 @@ inline bool try_cur_ico(ReadInterface &ri, size_t length, ImageInfo &info) {
     auto buffer = ri.read_buffer(0, 6);
 
     Format format;
-    const char *ext;
-    const char *full_ext;
-    const char *mimetype;
     if (buffer.cmp(0, 4, "\x00\x00\x01\x00")) {
         format = kFormatIco;
-        ext = "ico";
-        full_ext = "ico";
-        mimetype = "image/ico";
     } else if (buffer.cmp(0, 4, "\x00\x00\x02\x00")) {
         format = kFormatCur;
-        ext = "cur";
-        full_ext = "cur";
-        mimetype = "image/cur";
     } else {
         return false;
     }
@@ -710,18 +2028,119 @@ inline bool try_cur_ico(ReadInterface &ri, size_t length, ImageInfo &info) {
         offset += bytes;
     }
 
-    if (length < (size_t)offset) {
+    if (length < (size_t)offset && !ri.options().check_truncation) {
         return false;
     }
 
-    info = ImageInfo(format, ext, full_ext, mimetype);
+    info = ImageInfo(format);
     info.set_entry_sizes(sizes);
     info.set_size(sizes.front());
+    // Every entry either has an alpha channel or an AND mask
+    info.set_pixel_format(8, 4, true);
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+inline int popcount32(uint32_t v) {
+    int n = 0;
+    for (; v != 0; v &= v - 1) {
+        n++;
+    }
+    return n;
+}
+
+// DDS_HEADER after the magic, DDS_PIXELFORMAT at 76 and the optional DDS_HEADER_DXT10 at 128
+struct DdsHeader {
+    using Flags = LeField<uint32_t, 8>;
+    using Height = LeField<uint32_t, 12>;
+    using Width = LeField<uint32_t, 16>;
+    using MipMapCount = LeField<uint32_t, 28>;
+    using PixelFormatFlags = LeField<uint32_t, 80>;
+    using RgbBitCount = LeField<uint32_t, 88>;
+    using RBitMask = LeField<uint32_t, 92>;
+    using ABitMask = LeField<uint32_t, 104>;
+    using Caps2 = LeField<uint32_t, 112>;
+    using DxgiFormat = LeField<uint32_t, 128>;
+    using MiscFlag = LeField<uint32_t, 136>;
+    using ArraySize = LeField<uint32_t, 140>;
+};
+
+inline void dds_pixel_format(Buffer &buffer, ImageInfo &info) {
+    const uint32_t DDPF_ALPHAPIXELS = 0x1;
+    const uint32_t DDPF_ALPHA = 0x2;
+    const uint32_t DDPF_FOURCC = 0x4;
+    const uint32_t DDPF_RGB = 0x40;
+    const uint32_t DDPF_LUMINANCE = 0x20000;
+
+    uint32_t flags = buffer.read<DdsHeader::PixelFormatFlags>();
+    if (flags & DDPF_FOURCC) {
+        if (buffer.cmp_any_of(84, 4, {"DXT1", "DXT2", "DXT3", "DXT4", "DXT5"})) {
+            info.set_pixel_format(8, 4, true);
+        } else if (buffer.cmp_any_of(84, 4, {"ATI1", "BC4U", "BC4S"})) {
+            info.set_pixel_format(8, 1, false);
+        } else if (buffer.cmp_any_of(84, 4, {"ATI2", "BC5U", "BC5S"})) {
+            info.set_pixel_format(8, 2, false);
+        } else if (buffer.cmp(84, 4, "DX10") && buffer.size() >= 148) {
+            uint32_t dxgi_format = buffer.read<DdsHeader::DxgiFormat>();
+            if (dxgi_format >= 1 && dxgi_format <= 4) {  // R32G32B32A32
+                info.set_pixel_format(32, 4, true);
+            } else if (dxgi_format >= 5 && dxgi_format <= 8) {  // R32G32B32
+                info.set_pixel_format(32, 3, false);
+            } else if (dxgi_format >= 9 && dxgi_format <= 14) {  // R16G16B16A16
+                info.set_pixel_format(16, 4, true);
+            } else if ((dxgi_format >= 27 && dxgi_format <= 32) || (dxgi_format >= 87 && dxgi_format <= 93)) {
+                info.set_pixel_format(8, 4, true);  // R8G8B8A8, B8G8R8A8
+            } else if (dxgi_format >= 70 && dxgi_format <= 78) {  // BC1 - BC3
+                info.set_pixel_format(8, 4, true);
+            } else if (dxgi_format >= 79 && dxgi_format <= 81) {  // BC4
+                info.set_pixel_format(8, 1, false);
+            } else if (dxgi_format >= 82 && dxgi_format <= 84) {  // BC5
+                info.set_pixel_format(8, 2, false);
+            } else if (dxgi_format >= 94 && dxgi_format <= 96) {  // BC6H
+                info.set_pixel_format(16, 3, false);
+            } else if (dxgi_format >= 97 && dxgi_format <= 99) {  // BC7
+                info.set_pixel_format(8, 4, true);
+            }
+        }
+        return;
+    }
+
+    uint32_t bit_count = buffer.read<DdsHeader::RgbBitCount>();
+    uint32_t r_mask = buffer.read<DdsHeader::RBitMask>();
+    uint32_t a_mask = buffer.read<DdsHeader::ABitMask>();
+    bool has_alpha = (flags & (DDPF_ALPHAPIXELS | DDPF_ALPHA)) != 0 && a_mask != 0;
+    int bit_depth = r_mask != 0 ? popcount32(r_mask) : popcount32(a_mask);
+    if (bit_depth <= 0 || bit_count == 0) {
+        return;
+    }
+    if (flags & DDPF_RGB) {
+        info.set_pixel_format(bit_depth, has_alpha ? 4 : 3, has_alpha);
+    } else if (flags & DDPF_LUMINANCE) {
+        info.set_pixel_format(bit_depth, has_alpha ? 2 : 1, has_alpha);
+    } else if (flags & DDPF_ALPHA) {
+        info.set_pixel_format(bit_depth, 1, true);
+    }
+}
+
+// dwMipMapCount is valid with DDSD_MIPMAPCOUNT, the DX10 arraySize and cube maps multiply layers by 6
+inline void dds_levels(Buffer &buffer, ImageInfo &info) {
+    const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+    const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+    const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+    uint32_t mip_count = 1;
+    if (buffer.read<DdsHeader::Flags>() & DDSD_MIPMAPCOUNT) {
+        mip_count = buffer.read<DdsHeader::MipMapCount>();
+    }
+    uint32_t layers = (buffer.read<DdsHeader::Caps2>() & DDSCAPS2_CUBEMAP) ? 6 : 1;
+    if (buffer.cmp(84, 4, "DX10") && buffer.size() >= 148) {
+        uint32_t array_size = (std::max)(buffer.read<DdsHeader::ArraySize>(), 1u);
+        layers = array_size * ((buffer.read<DdsHeader::MiscFlag>() & DDS_RESOURCE_MISC_TEXTURECUBE) ? 6 : 1);
+    }
+    set_mip_levels(info, mip_count, layers);
+}
+
 inline bool try_dds(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 20) {
         return false;
@@ -731,37 +2150,146 @@ inline bool try_dds(ReadInterface &ri, size_t length, ImageInfo &info) {
         return false;
     }
 
-    info = ImageInfo(kFormatDds, "dds", "dds", "image/dds");
-    info.set_size(               //
-        buffer.read_u32_le(16),  //
-        buffer.read_u32_le(12)   //
+    info = ImageInfo(kFormatDds);
+    info.set_size(                        //
+        buffer.read<DdsHeader::Width>(),  //
+        buffer.read<DdsHeader::Height>()  //
     );
+    if (length >= 128) {
+        buffer = ri.read_buffer(0, length >= 148 ? 148 : 128);
+        dds_pixel_format(buffer, info);
+        dds_levels(buffer, info);
+    }
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // https://www.fileformat.info/format/gif/corion.htm
-inline bool try_gif(ReadInterface &ri, size_t length, ImageInfo &info) {
-    if (length < 10) {
-        return false;
-    }
-    auto buffer = ri.read_buffer(0, 10);
-    if (!buffer.cmp_any_of(0, 6, {"GIF87a", "GIF89a"})) {
+/**
+ * Count image descriptors from the first block after the global color table to the trailer, skipping
+ * data sub-blocks. If the scan stops early (budget spent, broken file) the file is still reported as
+ * animated (-1) when a looping application extension or a second frame was seen, and as still (1) otherwise,
+ * so a file without a looping extension needs the budget to reach its second frame.
+ */
+inline int64_t gif_frame_count(ReadInterface &ri, size_t length, size_t offset) {
+    ScanBudget budget(ri);
+    Buffer window;
+    size_t window_start = 0;
+    auto byte_at = [&](size_t pos, uint8_t &value) {
+        if (pos < window_start || pos >= window_start + window.size()) {
+            if (pos >= length) {
+                return false;
+            }
+            size_t size = budget.take_up_to(pos, (std::min)((size_t)II_SCAN_WINDOW_SIZE, length - pos));
+            if (size == 0) {
+                return false;
+            }
+            window = ri.read_buffer((off_t)pos, size);
+            window_start = pos;
+        }
+        value = window.read_u8((off_t)(pos - window_start));
+        return true;
+    };
+    auto skip_sub_blocks = [&](size_t &pos) {
+        uint8_t size;
+        while (byte_at(pos, size)) {
+            pos += 1 + (size_t)size;
+            if (size == 0) {
+                return true;
+            }
+        }
         return false;
-    }
+    };
 
-    info = ImageInfo(kFormatGif, "gif", "gif", "image/gif");
-    info.set_size(              //
-        buffer.read_u16_le(6),  //
-        buffer.read_u16_le(8)   //
-    );
-    return true;
+    int64_t frames = 0;
+    bool looping = false;
+    uint8_t introducer;
+    while (byte_at(offset, introducer)) {
+        if (introducer == 0x3B) {  // Trailer
+            return frames > 1 ? frames : 1;
+        } else if (introducer == 0x21) {  // Extension
+            uint8_t label;
+            uint8_t block_size;
+            if (!byte_at(offset + 1, label)) {
+                break;
+            }
+            offset += 2;
+            if (label == 0xFF && byte_at(offset, block_size) && block_size == 11) {
+                // Application identifier, "NETSCAPE2.0" or "ANIMEXTS1.0" carry the loop count
+                uint8_t id[8];
+                bool ok = true;
+                for (size_t i = 0; i < sizeof(id) && ok; ++i) {
+                    ok = byte_at(offset + 1 + i, id[i]);
+                }
+                looping = looping || (ok && (memcmp(id, "NETSCAPE", 8) == 0 || memcmp(id, "ANIMEXTS", 8) == 0));
+            }
+            if (!skip_sub_blocks(offset)) {
+                break;
+            }
+        } else if (introducer == 0x2C) {  // Image descriptor
+            ++frames;
+            uint8_t packed;
+            if (!byte_at(offset + 9, packed)) {
+                break;
+            }
+            // descriptor(10), local color table, LZW minimum code size(1)
+            offset += 10 + ((packed & 0x80) ? 3 * ((size_t)1 << ((packed & 0x07) + 1)) : 0) + 1;
+            if (!skip_sub_blocks(offset)) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+    return (looping || frames > 1) ? -1 : 1;
+}
+
+// Header(6) and logical screen descriptor
+struct GifHeader {
+    using Width = LeField<uint16_t, 6>;
+    using Height = LeField<uint16_t, 8>;
+    // Global color table flag 0x80 and its size in the low 3 bits
+    using Packed = LeField<uint8_t, 10>;
+};
+
+inline bool try_gif(ReadInterface &ri, size_t length, ImageInfo &info) {
+    if (length < 10) {
+        return false;
+    }
+    auto buffer = ri.read_buffer(0, length >= 13 ? 13 : 10);
+    if (!buffer.cmp_any_of(0, 6, {"GIF87a", "GIF89a"})) {
+        return false;
+    }
+
+    info = ImageInfo(kFormatGif);
+    info.set_size(                        //
+        buffer.read<GifHeader::Width>(),  //
+        buffer.read<GifHeader::Height>()  //
+    );
+
+    // Transparency lives in a graphic control extension, usually right after the global color table
+    bool has_alpha = false;
+    if (buffer.size() >= 13) {
+        uint8_t packed = buffer.read<GifHeader::Packed>();
+        size_t gce_offset = 13 + ((packed & 0x80) ? 3 * ((size_t)1 << ((packed & 0x07) + 1)) : 0);
+        if (gce_offset + 4 <= length) {
+            auto gce = ri.read_buffer((off_t)gce_offset, 4);
+            has_alpha = gce.cmp(0, 2, "\x21\xF9") && (gce.read_u8(3) & 0x01);
+        }
+        info.set_frame_count(gif_frame_count(ri, length, gce_offset));
+    }
+    info.set_pixel_format(8, has_alpha ? 4 : 3, has_alpha);
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // http://paulbourke.net/dataformats/pic/
+#ifndef II_HDR_MAX_PIECE
+#define II_HDR_MAX_PIECE (65536)
+#endif
+
 inline bool try_hdr(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 6) {
         return false;
@@ -777,14 +2305,16 @@ inline bool try_hdr(ReadInterface &ri, size_t length, ImageInfo &info) {
         }
     }
 
-    const size_t piece = 64;
+    // Pieces double up to II_HDR_MAX_PIECE, long comment blocks cost a few reads and are searched once
+    size_t piece = 64;
     std::string header;
     size_t resolution_start = 0;
     std::string resolution;
     off_t offset = 0;
     while (offset < length) {
         buffer = ri.read_buffer(offset, std::min<size_t>(length - offset, piece));
-        size_t start_pos = buffer.size() - 1;
+        piece = (std::min)(piece * 2, (size_t)II_HDR_MAX_PIECE);
+        size_t start_pos = header.empty() ? 0 : header.size() - 1;
         offset += (off_t)buffer.size();
         header += buffer.to_string();
         if (resolution_start == 0) {
@@ -846,8 +2376,9 @@ inline bool try_hdr(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (x == 0 || y == 0) {
         return false;
     }
-    info = ImageInfo(kFormatHdr, "hdr", "hdr", "image/vnd.radiance");
+    info = ImageInfo(kFormatHdr);
     info.set_size(x, y);
+    info.set_pixel_format(32, 3, false);
     return true;
 }
 
@@ -859,7 +2390,8 @@ inline bool try_icns(ReadInterface &ri, size_t length, ImageInfo &info) {
     }
     auto buffer = ri.read_buffer(0, 8);
     uint32_t file_length = buffer.read_u32_be(4);
-    if (!buffer.cmp(0, 4, "icns") || file_length != length) {
+    bool truncated = ri.options().check_truncation && file_length > length;
+    if (!buffer.cmp(0, 4, "icns") || (file_length != length && !truncated)) {
         return false;
     }
 
@@ -910,6 +2442,10 @@ inline bool try_icns(ReadInterface &ri, size_t length, ImageInfo &info) {
         buffer = ri.read_buffer(offset, 8);
         auto type = buffer.read_string(0, 4);
         uint32_t entry_size = buffer.read_u32_be(4);
+        // A chunk covers at least its own header, a smaller size would never move on
+        if (entry_size < 8) {
+            return false;
+        }
         auto it = size_map.find(type);
         if (it != size_map.end()) {
             int64_t s = it->second;
@@ -921,14 +2457,60 @@ inline bool try_icns(ReadInterface &ri, size_t length, ImageInfo &info) {
         offset += entry_size;
     }
 
-    info = ImageInfo(kFormatIcns, "icns", "icns", "image/icns");
+    info = ImageInfo(kFormatIcns);
     info.set_size(max_size, max_size);
     info.set_entry_sizes(entry_sizes);
+    info.set_pixel_format(8, 4, true);
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Main header markers searched for COD before giving up
+#ifndef II_J2K_MAX_MAIN_HEADER_MARKERS
+#define II_J2K_MAX_MAIN_HEADER_MARKERS (8)
+#endif
+
+/**
+ * Resolution levels of a code stream starting at `start`, N decomposition levels from COD give N + 1 levels.
+ * Level r covers ceil(Xsiz / 2^r) - ceil(XOsiz / 2^r) columns of the reference grid, likewise for rows.
+ */
+inline void j2k_levels(ReadInterface &ri, size_t length, uint64_t start, ImageInfo &info) {
+    if (start + 24 > length) {
+        return;
+    }
+    // SOC(2), SIZ(2), Lsiz(2), Rsiz(2), Xsiz(4), Ysiz(4), XOsiz(4), YOsiz(4)
+    auto siz = ri.read_buffer((off_t)start, 24);
+    if (!siz.cmp(0, 4, "\xFF\x4F\xFF\x51")) {
+        return;
+    }
+    uint64_t x = siz.read_u32_be(8), y = siz.read_u32_be(12);
+    uint64_t x0 = siz.read_u32_be(16), y0 = siz.read_u32_be(20);
+    uint64_t offset = start + 4 + siz.read_u16_be(4);
+    for (int i = 0; i < II_J2K_MAX_MAIN_HEADER_MARKERS && offset + 10 <= length; ++i) {
+        // COD: marker(2), Lcod(2), Scod(1), progression(1), layers(2), MCT(1), decomposition levels(1)
+        auto marker = ri.read_buffer((off_t)offset, 10);
+        if (marker.read_u8(0) != 0xFF || marker.cmp(0, 2, "\xFF\x90")) {  // SOT ends the main header
+            return;
+        }
+        if (marker.cmp(0, 2, "\xFF\x52")) {
+            uint32_t decomposition_levels = marker.read_u8(9);
+            if (decomposition_levels == 0 || decomposition_levels > 32) {
+                return;
+            }
+            ImageLevels levels;
+            for (uint32_t r = 0; r <= decomposition_levels; ++r) {
+                uint64_t d = (uint64_t)1 << r;
+                levels.emplace_back((int64_t)((x + d - 1) / d - (x0 + d - 1) / d),
+                                    (int64_t)((y + d - 1) / d - (y0 + d - 1) / d));
+            }
+            info.set_levels(levels);
+            return;
+        }
+        offset += 2 + marker.read_u16_be(2);
+    }
+}
+
 // https://docs.fileformat.com/image/jp2/
 // https://docs.fileformat.com/image/jpx/
 inline bool try_jpeg2000_code_stream(ReadInterface &ri, size_t length, ImageInfo &info) {
@@ -943,11 +2525,18 @@ inline bool try_jpeg2000_code_stream(ReadInterface &ri, size_t length, ImageInfo
         if (length < siz_length + 4) {
             return false;
         }
-        info = ImageInfo(kFormatJ2k, "j2k", "j2k", "image/j2k");
+        info = ImageInfo(kFormatJ2k);
         info.set_size(              //
             buffer.read_u32_be(8),  //
             buffer.read_u32_be(12)  //
         );
+        // Csiz, then Ssiz of the first component, bit 7 is the sign
+        if (siz_length >= 41 && length >= 45) {
+            buffer = ri.read_buffer(0, 45);
+            int channels = buffer.read_u16_be(40);
+            info.set_pixel_format((buffer.read_u8(42) & 0x7F) + 1, channels, channels == 2 || channels == 4);
+        }
+        j2k_levels(ri, length, 0, info);
         return true;
     }
 
@@ -981,24 +2570,12 @@ inline bool try_jpeg2000(ReadInterface &ri, size_t length, ImageInfo &info) {
     }
 
     Format format;
-    const char *ext;
-    const char *full_ext;
-    const char *mimetype;
     if (buffer.cmp(8, 4, "jp2 ")) {
         format = kFormatJp2;
-        ext = "jp2";
-        full_ext = "jp2";
-        mimetype = "image/jp2";
     } else if (buffer.cmp(8, 4, "jph ")) {
         format = kFormatJph;
-        ext = "jph";
-        full_ext = "jph";
-        mimetype = "image/jph";
     } else if (buffer.cmp(8, 4, "jpx ")) {
         format = kFormatJpx;
-        ext = "jpx";
-        full_ext = "jpx";
-        mimetype = "image/jpx";
     } else {
         return false;
     }
@@ -1007,14 +2584,32 @@ inline bool try_jpeg2000(ReadInterface &ri, size_t length, ImageInfo &info) {
     offset += ftyp_length;
 
     while (offset + 24 <= length) {
-        buffer = ri.read_buffer(offset, 24);
+        buffer = ri.read_buffer(offset, (uint64_t)offset + 27 <= length ? 27 : 24);
         if (buffer.cmp(4, 4, "jp2h")) {
             if (buffer.cmp(12, 4, "ihdr")) {
-                info = ImageInfo(format, ext, full_ext, mimetype);
+                info = ImageInfo(format);
                 info.set_size(               //
                     buffer.read_u32_be(20),  //
                     buffer.read_u32_be(16)   //
                 );
+                // BPC 255 means components differ, see the bpcc box
+                if (buffer.size() >= 27 && buffer.read_u8(26) != 0xFF) {
+                    int channels = buffer.read_u16_be(24);
+                    info.set_pixel_format((buffer.read_u8(26) & 0x7F) + 1, channels, channels == 2 || channels == 4);
+                }
+                // The code stream box usually follows the header box
+                uint64_t box_offset = (uint64_t)offset + buffer.read_u32_be(0);
+                for (int i = 0; i < II_J2K_MAX_MAIN_HEADER_MARKERS && box_offset + 8 <= length; ++i) {
+                    auto box = ri.read_buffer((off_t)box_offset, 8);
+                    if (box.cmp(4, 4, "jp2c")) {
+                        j2k_levels(ri, length, box_offset + 8, info);
+                        break;
+                    }
+                    if (box.read_u32_be(0) < 8) {
+                        break;
+                    }
+                    box_offset += box.read_u32_be(0);
+                }
                 return true;
             } else {
                 return false;
@@ -1028,6 +2623,142 @@ inline bool try_jpeg2000(ReadInterface &ri, size_t length, ImageInfo &info) {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Entries of the EXIF IFD0 are fetched this many at a time
+#ifndef II_EXIF_ENTRY_BATCH
+#define II_EXIF_ENTRY_BATCH (16)
+#endif
+
+/**
+ * Find the Orientation tag in IFD0 of an APP1 segment without reading the whole segment,
+ * which is mostly thumbnail and maker notes. Returns false if the EXIF structure is broken.
+ *
+ * APP1 layout: FFE1, length(2), "Exif\0\0", then a TIFF header whose offsets are relative to itself
+ */
+inline bool read_exif_orientation(ReadInterface &ri, off_t segment_offset, uint16_t section_size,
+                                  uint16_t &orientation) {
+    auto buffer = ri.read_buffer(segment_offset, 18);
+    if (!buffer.cmp(4, 5, "Exif\0")) {
+        return true;
+    }
+    const off_t tiff_start = segment_offset + 10;
+    const uint64_t segment_end = uint64_t(segment_offset) + section_size + 2;
+    bool big_endian = !buffer.cmp(10, 1, "I");
+    auto first_ifd_offset = buffer.read_int<uint32_t>(14, big_endian);
+    if (first_ifd_offset < 8 || uint64_t(tiff_start) + first_ifd_offset + 2 > segment_end) {
+        return false;
+    }
+    off_t ifd_offset = tiff_start + (off_t)first_ifd_offset;
+    auto entry_count = ri.read_buffer(ifd_offset, 2).read_int<uint16_t>(0, big_endian);
+    Buffer entries;
+    for (uint16_t i = 0; i < entry_count; ++i) {
+        off_t entry_offset = ifd_offset + 2 + (off_t)i * 12;
+        if (uint64_t(entry_offset) + 12 > segment_end) {
+            return false;
+        }
+        uint16_t k = i % II_EXIF_ENTRY_BATCH;
+        if (k == 0) {
+            uint64_t count = (std::min)((uint64_t)(entry_count - i), (uint64_t)II_EXIF_ENTRY_BATCH);
+            count = (std::min)(count, (segment_end - uint64_t(entry_offset)) / 12);
+            entries = ri.read_buffer(entry_offset, (size_t)count * 12);
+        }
+        auto tag = entries.read_int<uint16_t>(k * 12, big_endian);
+        if (tag == 274) {  // Orientation Tag
+            orientation = entries.read_int<uint16_t>(k * 12 + 8, big_endian);
+            return true;
+        }
+        if (tag > 274) {  // Tags are sorted
+            return true;
+        }
+    }
+    return true;
+}
+
+inline bool try_jpg(ReadInterface &ri, size_t length, ImageInfo &info);
+
+// The JPEG thumbnail of EXIF IFD1, sized by running try_jpg over its range. Returns false if the APP1 is not EXIF.
+inline bool read_exif_thumbnail(ReadInterface &ri, off_t segment_offset, uint16_t section_size,
+                                Thumbnails &thumbnails) {
+    auto buffer = ri.read_buffer(segment_offset, 18);
+    if (!buffer.cmp(4, 5, "Exif\0")) {
+        return false;
+    }
+    const uint64_t tiff_start = uint64_t(segment_offset) + 10;
+    const uint64_t segment_end = uint64_t(segment_offset) + section_size + 2;
+    bool big_endian = !buffer.cmp(10, 1, "I");
+    // IFD1 is linked from the end of IFD0, which is entry_count(2) and 12 bytes per entry
+    uint64_t ifd0_offset = tiff_start + buffer.read_int<uint32_t>(14, big_endian);
+    if (ifd0_offset + 2 > segment_end) {
+        return true;
+    }
+    uint64_t ifd0_entry_count = ri.read_buffer((off_t)ifd0_offset, 2).read_int<uint16_t>(0, big_endian);
+    uint64_t next_ifd_at = ifd0_offset + 2 + ifd0_entry_count * 12;
+    if (next_ifd_at + 4 > segment_end) {
+        return true;
+    }
+    uint64_t ifd1_offset = tiff_start + ri.read_buffer((off_t)next_ifd_at, 4).read_int<uint32_t>(0, big_endian);
+    if (ifd1_offset == tiff_start || ifd1_offset + 2 > segment_end) {
+        return true;
+    }
+    uint64_t entry_count = ri.read_buffer((off_t)ifd1_offset, 2).read_int<uint16_t>(0, big_endian);
+    entry_count = (std::min)(entry_count, (segment_end - ifd1_offset - 2) / 12);
+    if (entry_count == 0) {
+        return true;
+    }
+    auto entries = ri.read_buffer((off_t)ifd1_offset + 2, (size_t)entry_count * 12);
+    uint64_t compression = 6;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    for (uint64_t i = 0; i < entry_count; ++i) {
+        off_t e = (off_t)i * 12;
+        auto tag = entries.read_int<uint16_t>(e, big_endian);
+        // SHORT or LONG
+        uint64_t value = entries.read_int<uint16_t>(e + 2, big_endian) == 3
+                             ? entries.read_int<uint16_t>(e + 8, big_endian)
+                             : entries.read_int<uint32_t>(e + 8, big_endian);
+        if (tag == 0x0103) {  // Compression
+            compression = value;
+        } else if (tag == 0x0201) {  // JPEGInterchangeFormat
+            offset = tiff_start + value;
+        } else if (tag == 0x0202) {  // JPEGInterchangeFormatLength
+            size = value;
+        }
+    }
+    if ((compression != 6 && compression != 7) || offset <= tiff_start || size == 0 || offset > segment_end ||
+        size > segment_end - offset) {
+        return true;
+    }
+    ReadFunc read_func = [&ri, offset](void *buf, off_t o, size_t n) {
+        memcpy(buf, ri.read_buffer((off_t)offset + o, n).data(), n);
+    };
+    ParseOptions options;
+    options.read_exif = false;
+    ReadInterface thumbnail_ri(read_func, (size_t)size, options);
+    ImageInfo thumbnail_info;
+    if (try_jpg(thumbnail_ri, (size_t)size, thumbnail_info)) {
+        thumbnails.emplace_back((off_t)offset, (size_t)size, kFormatJpeg, thumbnail_info.size());
+    }
+    return true;
+}
+
+// EXIF or XMP payload of an APP1 segment, after "Exif\0\0" or the XMP namespace
+inline void jpeg_app1_metadata(ReadInterface &ri, off_t segment_offset, uint16_t section_size,
+                               MetadataBlocks &metadata) {
+    static const char xmp_namespace[] = "http://ns.adobe.com/xap/1.0/";
+    const size_t xmp_header_size = 4 + sizeof(xmp_namespace);
+    auto buffer = ri.read_buffer(segment_offset, (std::min)((size_t)section_size + 2, xmp_header_size));
+    if (buffer.size() >= 10 && buffer.cmp(4, 6, "Exif\0\0")) {
+        metadata.emplace_back(kMetadataExif, segment_offset + 10, (size_t)section_size + 2 - 10);
+    } else if (buffer.size() == xmp_header_size && buffer.cmp(4, sizeof(xmp_namespace), xmp_namespace)) {
+        metadata.emplace_back(kMetadataXmp, segment_offset + (off_t)xmp_header_size,
+                              (size_t)section_size + 2 - xmp_header_size);
+    }
+}
+
+// Bytes searched per read for the next marker when garbage follows a segment
+#ifndef II_JPEG_GARBAGE_WINDOW
+#define II_JPEG_GARBAGE_WINDOW (4096)
+#endif
+
 // https://www.fileformat.info/format/jpeg/corion.htm
 inline bool try_jpg(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 2) {
@@ -1039,13 +2770,23 @@ inline bool try_jpg(ReadInterface &ri, size_t length, ImageInfo &info) {
     }
 
     uint16_t orientation = 1;
+    bool exif_seen = false;
+    Thumbnails thumbnails;
+    MetadataBlocks metadata;
     off_t offset = 2;
     while (offset + 9 <= length) {
-        buffer = ri.read_buffer(offset, 9);
+        // 22 bytes reach the component count and up to 4 component sampling factors of SOF segments
+        buffer = ri.read_buffer(offset, std::min<size_t>(length - offset, 22));
         uint16_t section_size = buffer.read_u16_be(2);
         if (!buffer.cmp(0, 1, "\xFF")) {
-            // skip garbage bytes
-            offset += 1;
+            // skip garbage bytes up to the next 0xFF, a window at a time once the buffer has none
+            auto *ff = (const uint8_t *)memchr(buffer.data(), 0xFF, buffer.size());
+            if (ff == nullptr && offset + buffer.size() + 9 <= length) {
+                offset += (off_t)buffer.size();
+                buffer = ri.read_buffer(offset, std::min<size_t>(length - offset, II_JPEG_GARBAGE_WINDOW));
+                ff = (const uint8_t *)memchr(buffer.data(), 0xFF, buffer.size());
+            }
+            offset += ff != nullptr ? (off_t)(ff - buffer.data()) : (off_t)buffer.size();
             continue;
         }
 
@@ -1054,39 +2795,62 @@ inline bool try_jpg(ReadInterface &ri, size_t length, ImageInfo &info) {
             if (offset + section_size + 2 > length) {
                 return false;
             }
-            buffer = ri.read_buffer(offset, section_size + 2);
-            if (buffer.cmp(4, 5, "Exif\0")) {
-                bool big_endian = !buffer.cmp(10, 1, "I");
-                auto first_ifd_offset = buffer.read_int<uint32_t>(14, big_endian);
-                if (first_ifd_offset < 8 || uint64_t(first_ifd_offset) + 12 > uint64_t(section_size + 2)) {
-                    return false;
-                }
-                auto ifd_main_entries_count = buffer.read_int<uint16_t>(first_ifd_offset + 10, big_endian);
-                for (uint16_t i = 0; i < ifd_main_entries_count; ++i) {
-                    off_t entry_offset = first_ifd_offset + 12 + (off_t)i * 12;
-                    if (entry_offset + 12 > section_size + 2) {
-                        return false;
-                    }
-                    auto tag = buffer.read_int<uint16_t>(entry_offset, big_endian);
-                    if (tag == 274) {  // Orientation Tag
-                        orientation = buffer.read_int<uint16_t>(entry_offset + 8, big_endian);
-                    }
-                }
+            if (ri.options().read_exif && orientation == 1 && section_size >= 16 &&
+                !read_exif_orientation(ri, offset, section_size, orientation)) {
+                return false;
+            }
+            if (ri.options().read_thumbnails && !exif_seen && section_size >= 16) {
+                exif_seen = read_exif_thumbnail(ri, offset, section_size, thumbnails);
+            }
+            if (ri.options().read_metadata) {
+                jpeg_app1_metadata(ri, offset, section_size, metadata);
             }
             offset += section_size + 2;
             continue;
         }
 
+        // APP2 "ICC_PROFILE\0", sequence number(1), count(1), then a part of the profile
+        if (ri.options().read_metadata && buffer.cmp(0, 2, "\xFF\xE2") && section_size > 16 && buffer.size() >= 18 &&
+            buffer.cmp(4, 12, "ICC_PROFILE\0") && (uint64_t)offset + section_size + 2 <= length) {
+            metadata.emplace_back(kMetadataIcc, offset + 18, (size_t)section_size - 16);
+        }
+
         // 0xFFC0 is baseline standard (SOF0)
         // 0xFFC1 is baseline optimized (SOF1)
         // 0xFFC2 is progressive (SOF2)
         if (buffer.cmp_any_of(0, 2, {"\xFF\xC0", "\xFF\xC1", "\xFF\xC2"})) {
-            info = ImageInfo(kFormatJpeg, "jpg", "jpeg", "image/jpeg");
+            info = ImageInfo(kFormatJpeg);
             ImageSize size(buffer.read_u16_be(7), buffer.read_u16_be(5));
-            if (orientation == 5 || orientation == 6 || orientation == 7 || orientation == 8) {
+            if (orientation < 1 || orientation > 8) {
+                orientation = 1;
+            }
+            if (orientation >= 5) {
                 std::swap(size.width, size.height);
             }
             info.set_size(size);
+            info.set_orientation(orientation);
+            if (buffer.size() >= 10) {
+                uint8_t components = buffer.read_u8(9);
+                info.set_pixel_format(buffer.read_u8(4), components, false);
+                // Component: id(1), sampling factors H << 4 | V (1), quantization table(1)
+                int h_max = 1, v_max = 1, h_min = 4, v_min = 4;
+                for (size_t i = 0; i < components && 12 + i * 3 <= buffer.size(); ++i) {
+                    uint8_t factors = buffer.read_u8((off_t)(11 + i * 3));
+                    int h = (std::max)(factors >> 4, 1), v = (std::max)(factors & 0x0F, 1);
+                    h_max = (std::max)(h_max, h), v_max = (std::max)(v_max, v);
+                    h_min = (std::min)(h_min, h), v_min = (std::min)(v_min, v);
+                }
+                if (components > 1 && h_min <= h_max && v_min <= v_max) {
+                    info.set_chroma_subsampling(h_max / h_min, v_max / v_min);
+                }
+            }
+            info.set_progressive(buffer.cmp(0, 2, "\xFF\xC2"));
+            for (const auto &thumbnail : thumbnails) {
+                info.add_thumbnail(thumbnail);
+            }
+            for (const auto &block : metadata) {
+                info.add_metadata(block);
+            }
             return true;
         }
         offset += section_size + 2;
@@ -1097,52 +2861,233 @@ inline bool try_jpg(ReadInterface &ri, size_t length, ImageInfo &info) {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// After the identifier(12) and endianness(4), files of big-endian writers are not recognized
+struct KtxHeader {
+    using GlType = LeField<uint32_t, 16>;
+    using GlInternalFormat = LeField<uint32_t, 28>;
+    using GlBaseInternalFormat = LeField<uint32_t, 32>;
+    using PixelWidth = LeField<uint32_t, 36>;
+    using PixelHeight = LeField<uint32_t, 40>;
+    using NumberOfArrayElements = LeField<uint32_t, 48>;
+    using NumberOfFaces = LeField<uint32_t, 52>;
+    using NumberOfMipmapLevels = LeField<uint32_t, 56>;
+};
+
+inline void ktx_pixel_format(Buffer &buffer, ImageInfo &info) {
+    int bit_depth;
+    switch (buffer.read<KtxHeader::GlType>()) {
+        case 0x0000:  // compressed, decoders expand to 8 bits
+        case 0x1400:  // GL_BYTE
+        case 0x1401:  // GL_UNSIGNED_BYTE
+            bit_depth = 8;
+            break;
+        case 0x1402:  // GL_SHORT
+        case 0x1403:  // GL_UNSIGNED_SHORT
+        case 0x140B:  // GL_HALF_FLOAT
+            bit_depth = 16;
+            break;
+        case 0x1404:  // GL_INT
+        case 0x1405:  // GL_UNSIGNED_INT
+        case 0x1406:  // GL_FLOAT
+            bit_depth = 32;
+            break;
+        default:
+            return;
+    }
+    uint32_t base_internal_format = buffer.read<KtxHeader::GlBaseInternalFormat>();
+    if (base_internal_format == 0) {
+        base_internal_format = buffer.read<KtxHeader::GlInternalFormat>();
+    }
+    switch (base_internal_format) {
+        case 0x1902:  // GL_DEPTH_COMPONENT
+        case 0x1903:  // GL_RED
+        case 0x1909:  // GL_LUMINANCE
+            info.set_pixel_format(bit_depth, 1, false);
+            break;
+        case 0x1906:  // GL_ALPHA
+            info.set_pixel_format(bit_depth, 1, true);
+            break;
+        case 0x8227:  // GL_RG
+            info.set_pixel_format(bit_depth, 2, false);
+            break;
+        case 0x190A:  // GL_LUMINANCE_ALPHA
+            info.set_pixel_format(bit_depth, 2, true);
+            break;
+        case 0x1907:  // GL_RGB
+        case 0x80E0:  // GL_BGR
+            info.set_pixel_format(bit_depth, 3, false);
+            break;
+        case 0x1908:  // GL_RGBA
+        case 0x80E1:  // GL_BGRA
+            info.set_pixel_format(bit_depth, 4, true);
+            break;
+        default:
+            break;
+    }
+}
+
 // https://www.khronos.org/registry/KTX/specs/1.0/ktxspec_v1.html
 inline bool try_ktx(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 44) {
         return false;
     }
-    auto buffer = ri.read_buffer(0, 44);
+    auto buffer = ri.read_buffer(0, length >= 60 ? 60 : 44);
     if (!buffer.cmp(0, 12, "\xABKTX 11\xBB\r\n\x1A\n")) {
         return false;
     }
 
-    info = ImageInfo(kFormatKtx, "ktx", "ktx", "image/ktx");
-    info.set_size(               //
-        buffer.read_u32_le(36),  //
-        buffer.read_u32_le(40)   //
+    info = ImageInfo(kFormatKtx);
+    info.set_size(                             //
+        buffer.read<KtxHeader::PixelWidth>(),  //
+        buffer.read<KtxHeader::PixelHeight>()  //
     );
+    ktx_pixel_format(buffer, info);
+    // 0 means one for all three
+    if (buffer.size() >= 60) {
+        uint32_t layers = (std::max)(buffer.read<KtxHeader::NumberOfArrayElements>(), 1u) *
+                          (std::max)(buffer.read<KtxHeader::NumberOfFaces>(), 1u);
+        set_mip_levels(info, buffer.read<KtxHeader::NumberOfMipmapLevels>(), layers);
+    }
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Palette images decode to RGB8, a tRNS chunk may still add alpha
+inline void png_pixel_format(uint8_t bit_depth, uint8_t color_type, ImageInfo &info) {
+    switch (color_type) {
+        case 0:
+            info.set_pixel_format(bit_depth, 1, false);
+            break;
+        case 2:
+            info.set_pixel_format(bit_depth, 3, false);
+            break;
+        case 3:
+            info.set_pixel_format(8, 3, false);
+            break;
+        case 4:
+            info.set_pixel_format(bit_depth, 2, true);
+            break;
+        case 6:
+            info.set_pixel_format(bit_depth, 4, true);
+            break;
+        default:
+            break;
+    }
+}
+
+// acTL has to come before the first IDAT, a file without it is a still image
+#ifndef II_PNG_MAX_CHUNKS_BEFORE_IDAT
+#define II_PNG_MAX_CHUNKS_BEFORE_IDAT (64)
+#endif
+
+/**
+ * iCCP: keyword, 0, compression method(1), zlib profile
+ * iTXt: keyword, 0, compression flag(1), compression method(1), language tag, 0, translated keyword, 0, text
+ */
+inline void png_chunk_metadata(ReadInterface &ri, Buffer &chunk, uint64_t offset, uint32_t size, ImageInfo &info) {
+    uint64_t data = offset + 8;
+    if (chunk.cmp(4, 4, "eXIf")) {
+        info.add_metadata(MetadataBlock(kMetadataExif, (off_t)data, size));
+        return;
+    }
+    bool iccp = chunk.cmp(4, 4, "iCCP");
+    if (!iccp && !chunk.cmp(4, 4, "iTXt")) {
+        return;
+    }
+    auto header = ri.read_buffer((off_t)data, (std::min)((size_t)size, (size_t)256));
+    const char *p = (const char *)header.data();
+    size_t n = header.size();
+    size_t keyword_end = strnlen(p, n);
+    if (iccp && keyword_end + 2 <= n) {
+        info.add_metadata(MetadataBlock(kMetadataIcc, (off_t)(data + keyword_end + 2), size - keyword_end - 2, true));
+        return;
+    }
+    static const char xmp_keyword[] = "XML:com.adobe.xmp";
+    if (iccp || keyword_end != sizeof(xmp_keyword) - 1 || memcmp(p, xmp_keyword, keyword_end) != 0 ||
+        keyword_end + 3 > n) {
+        return;
+    }
+    bool compressed = header[keyword_end + 1] != 0;
+    size_t language_end = keyword_end + 3 + strnlen(p + keyword_end + 3, n - keyword_end - 3);
+    if (language_end >= n) {
+        return;
+    }
+    size_t text = language_end + 1 + strnlen(p + language_end + 1, n - language_end - 1) + 1;
+    if (text <= n) {
+        info.add_metadata(MetadataBlock(kMetadataXmp, (off_t)(data + text), size - text, compressed));
+    }
+}
+
+// Chunks before the first IDAT: acTL, and the metadata chunks with ParseOptions::read_metadata
+inline void png_chunks(ReadInterface &ri, size_t length, uint64_t offset, ImageInfo &info) {
+    bool read_metadata = ri.options().read_metadata;
+    for (int i = 0; i < II_PNG_MAX_CHUNKS_BEFORE_IDAT && offset + 12 <= length; ++i) {
+        // length(4), type(4), num_frames(4) for acTL
+        auto chunk = ri.read_buffer((off_t)offset, 12);
+        uint32_t size = chunk.read_u32_be(0);
+        if (chunk.cmp(4, 4, "acTL")) {
+            uint32_t frames = chunk.read_u32_be(8);
+            info.set_frame_count(frames > 1 ? frames : 1);
+            if (!read_metadata) {
+                return;
+            }
+        }
+        if (chunk.cmp_any_of(4, 4, {"IDAT", "IEND"}) || size > length - offset - 12) {
+            return;
+        }
+        if (read_metadata) {
+            png_chunk_metadata(ri, chunk, offset, size, info);
+        }
+        offset += 12 + (uint64_t)size;
+    }
+}
+
+// The IHDR chunk starting at `Offset`, 8 or 24 after an Apple CgBI chunk
+template <size_t Offset>
+struct PngIhdr {
+    using Width = BeField<uint32_t, Offset + 8>;
+    using Height = BeField<uint32_t, Offset + 12>;
+    using BitDepth = BeField<uint8_t, Offset + 16>;
+    using ColorType = BeField<uint8_t, Offset + 17>;
+    using InterlaceMethod = BeField<uint8_t, Offset + 20>;
+};
+
 // https://www.fileformat.info/format/png/corion.htm
 inline bool try_png(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 24) {
         return false;
     }
 
-    auto buffer = ri.read_buffer(0, std::min<size_t>(length, 40));
+    auto buffer = ri.read_buffer(0, std::min<size_t>(length, 42));
     if (!buffer.cmp(0, 4, "\x89PNG")) {
         return false;
     }
 
     std::string first_chunk_type = buffer.read_string(12, 4);
     if (first_chunk_type == "IHDR") {
-        info = ImageInfo(kFormatPng, "png", "png", "image/png");
-        info.set_size(               //
-            buffer.read_u32_be(16),  //
-            buffer.read_u32_be(20)   //
+        using Ihdr = PngIhdr<8>;
+        info = ImageInfo(kFormatPng);
+        info.set_size(                   //
+            buffer.read<Ihdr::Width>(),  //
+            buffer.read<Ihdr::Height>()  //
         );
+        png_pixel_format(buffer.read<Ihdr::BitDepth>(), buffer.read<Ihdr::ColorType>(), info);
+        info.set_progressive(buffer.size() > 28 && buffer.read<Ihdr::InterlaceMethod>() == 1);  // Adam7
+        png_chunks(ri, length, 33, info);
         return true;
     } else if (first_chunk_type == "CgBI") {
         if (buffer.size() >= 40 && buffer.read_string(28, 4) == "IHDR") {
-            info = ImageInfo(kFormatPng, "png", "png", "image/png");
-            info.set_size(               //
-                buffer.read_u32_be(32),  //
-                buffer.read_u32_be(36)   //
+            using Ihdr = PngIhdr<24>;
+            info = ImageInfo(kFormatPng);
+            info.set_size(                   //
+                buffer.read<Ihdr::Width>(),  //
+                buffer.read<Ihdr::Height>()  //
             );
+            if (buffer.size() >= 42) {
+                png_pixel_format(buffer.read<Ihdr::BitDepth>(), buffer.read<Ihdr::ColorType>(), info);
+            }
+            png_chunks(ri, length, 49, info);
             return true;
         }
     }
@@ -1152,6 +3097,63 @@ inline bool try_png(ReadInterface &ri, size_t length, ImageInfo &info) {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Image resources looked at for the thumbnail
+#ifndef II_PSD_MAX_RESOURCES
+#define II_PSD_MAX_RESOURCES (256)
+#endif
+
+/**
+ * Image resource 1036 (1033 before Photoshop 5), a JFIF after format(4), width(4), height(4), width bytes(4),
+ * total size(4), compressed size(4), bits per pixel(2) and planes(2)
+ */
+inline void psd_thumbnail(ReadInterface &ri, size_t length, ImageInfo &info) {
+    // Header(26), color mode data length(4) and data, image resources length(4) and resources
+    uint64_t offset = 30 + (uint64_t)ri.read_buffer(26, 4).read_u32_be(0);
+    if (offset + 4 > length) {
+        return;
+    }
+    uint64_t end = offset + 4 + ri.read_buffer((off_t)offset, 4).read_u32_be(0);
+    offset += 4;
+    if (end > length) {
+        return;
+    }
+    for (int i = 0; i < II_PSD_MAX_RESOURCES && offset + 12 <= end; ++i) {
+        // "8BIM", id(2), pascal name padded to even, size(4), data padded to even
+        auto buffer = ri.read_buffer((off_t)offset, (size_t)(std::min)(end - offset, (uint64_t)16));
+        if (!buffer.cmp(0, 4, "8BIM")) {
+            return;
+        }
+        uint16_t id = buffer.read_u16_be(4);
+        uint64_t size_at = offset + 6 + ((buffer.read_u8(6) + 2) & ~1);
+        if (size_at + 4 > end) {
+            return;
+        }
+        uint64_t data_size = size_at + 4 <= offset + buffer.size() ? buffer.read_u32_be((off_t)(size_at - offset))
+                                                                   : ri.read_buffer((off_t)size_at, 4).read_u32_be(0);
+        uint64_t data = size_at + 4;
+        if (data_size > end - data) {
+            return;
+        }
+        if ((id == 1036 || id == 1033) && data_size > 28) {
+            auto header = ri.read_buffer((off_t)data, 28);
+            if (header.read_u32_be(0) == 1) {  // kJpegRGB
+                ImageSize size(header.read_u32_be(4), header.read_u32_be(8));
+                info.add_thumbnail(Thumbnail((off_t)data + 28, (size_t)data_size - 28, kFormatJpeg, size));
+            }
+            return;
+        }
+        offset = data + ((data_size + 1) & ~(uint64_t)1);
+    }
+}
+
+struct PsdHeader {
+    using Channels = BeField<uint16_t, 12>;
+    using Height = BeField<uint32_t, 14>;
+    using Width = BeField<uint32_t, 18>;
+    using Depth = BeField<uint16_t, 22>;
+    using ColorMode = BeField<uint16_t, 24>;
+};
+
 inline bool try_psd(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 22) {
         return false;
@@ -1161,35 +3163,237 @@ inline bool try_psd(ReadInterface &ri, size_t length, ImageInfo &info) {
         return false;
     }
 
-    info = ImageInfo(kFormatPsd, "psd", "psd", "image/psd");
-    info.set_size(               //
-        buffer.read_u32_be(18),  //
-        buffer.read_u32_be(14)   //
+    info = ImageInfo(kFormatPsd);
+    info.set_size(                        //
+        buffer.read<PsdHeader::Width>(),  //
+        buffer.read<PsdHeader::Height>()  //
     );
+    if (length >= 26) {
+        // Channels beyond those of the color mode are alpha channels
+        buffer = ri.read_buffer(0, 26);
+        int channels = buffer.read<PsdHeader::Channels>();
+        int bit_depth = buffer.read<PsdHeader::Depth>();
+        int color_channels;
+        switch (buffer.read<PsdHeader::ColorMode>()) {
+            case 3:  // RGB
+            case 9:  // Lab
+                color_channels = 3;
+                break;
+            case 4:  // CMYK
+                color_channels = 4;
+                break;
+            case 2:  // Indexed, decodes to RGB
+                color_channels = 3;
+                channels += 2;
+                bit_depth = 8;
+                break;
+            default:  // Bitmap, Grayscale, Multichannel, Duotone
+                color_channels = 1;
+                break;
+        }
+        info.set_pixel_format(bit_depth, channels, channels > color_channels);
+    }
+    if (ri.options().read_thumbnails && length >= 30) {
+        psd_thumbnail(ri, length, info);
+    }
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct QoiHeader {
+    using Width = BeField<uint32_t, 4>;
+    using Height = BeField<uint32_t, 8>;
+    using Channels = BeField<uint8_t, 12>;
+};
+
 inline bool try_qoi(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 12) {
         return false;
     }
-    auto buffer = ri.read_buffer(0, 12);
+    auto buffer = ri.read_buffer(0, length >= 13 ? 13 : 12);
     if (!buffer.cmp(0, 4, "qoif")) {
         return false;
     }
 
-    info = ImageInfo(kFormatQoi, "qoi", "qoi", "image/qoi");
-    info.set_size(              //
-        buffer.read_u32_be(4),  //
-        buffer.read_u32_be(8)   //
+    info = ImageInfo(kFormatQoi);
+    info.set_size(                        //
+        buffer.read<QoiHeader::Width>(),  //
+        buffer.read<QoiHeader::Height>()  //
     );
+    if (buffer.size() >= 13) {
+        uint8_t channels = buffer.read<QoiHeader::Channels>();
+        if (channels == 3 || channels == 4) {
+            info.set_pixel_format(8, channels, channels == 4);
+        }
+    }
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Entries of one IFD are fetched this many at a time
+#ifndef II_TIFF_ENTRY_BATCH
+#define II_TIFF_ENTRY_BATCH (32)
+#endif
+
+struct TiffPixelFormat {
+    int bit_depth = 1;
+    int channels = 1;
+    bool has_alpha = false;
+};
+
+// First SHORT of an entry value, stored inline when it fits, otherwise at the offset the entry holds
+inline bool tiff_first_short(ReadInterface &ri, size_t length, Buffer &entries, off_t value_pos, uint64_t count,
+                             bool big_tiff, bool swap_endian, uint16_t &value) {
+    if (count == 0) {
+        return false;
+    }
+    size_t inline_size = big_tiff ? 8 : 4;
+    if (count * 2 <= inline_size) {
+        value = entries.read_int<uint16_t>(value_pos, swap_endian);
+        return true;
+    }
+    uint64_t offset = big_tiff ? entries.read_int<uint64_t>(value_pos, swap_endian)
+                               : entries.read_int<uint32_t>(value_pos, swap_endian);
+    if (uint64_t(length) < offset + 2 || offset > (uint64_t)std::numeric_limits<off_t>::max() - 2) {
+        return false;
+    }
+    value = ri.read_buffer((off_t)offset, 2).read_int<uint16_t>(0, swap_endian);
+    return true;
+}
+
+// SHORT, LONG, IFD or BigTIFF LONG8, IFD8 value stored inline in an entry
+inline bool tiff_entry_uint(Buffer &entries, off_t e, bool big_tiff, bool swap_endian, uint64_t &value) {
+    auto type = entries.read_int<uint16_t>(e + 2, swap_endian);
+    off_t value_pos = e + (big_tiff ? 12 : 8);
+    if (type == 3) {
+        value = entries.read_int<uint16_t>(value_pos, swap_endian);
+    } else if (type == 4 || type == 13) {
+        value = entries.read_int<uint32_t>(value_pos, swap_endian);
+    } else if (big_tiff && (type == 16 || type == 18)) {
+        value = entries.read_int<uint64_t>(value_pos, swap_endian);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#ifndef II_TIFF_MAX_IFDS
+#define II_TIFF_MAX_IFDS (64)
+#endif
+
+// Offsets of the SubIFDs tag (330), inline when they fit in the value field
+inline void tiff_sub_ifds(ReadInterface &ri, size_t length, Buffer &entries, off_t e, bool big_tiff, bool swap_endian,
+                          std::vector<uint64_t> &offsets) {
+    uint64_t count = big_tiff ? entries.read_int<uint64_t>(e + 4, swap_endian)
+                              : entries.read_int<uint32_t>(e + 4, swap_endian);
+    auto type = entries.read_int<uint16_t>(e + 2, swap_endian);
+    size_t item_size = (type == 16 || type == 18) ? 8 : 4;
+    count = (std::min)(count, (uint64_t)II_TIFF_MAX_IFDS);
+    off_t value_pos = e + (big_tiff ? 12 : 8);
+    Buffer values = entries;
+    if (count * item_size > (big_tiff ? 8u : 4u)) {
+        uint64_t offset = big_tiff ? entries.read_int<uint64_t>(value_pos, swap_endian)
+                                   : entries.read_int<uint32_t>(value_pos, swap_endian);
+        if (offset > length || length - offset < count * item_size) {
+            return;
+        }
+        values = ri.read_buffer((off_t)offset, (size_t)(count * item_size));
+        value_pos = 0;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        off_t pos = value_pos + (off_t)(i * item_size);
+        offsets.push_back(item_size == 8 ? values.read_int<uint64_t>(pos, swap_endian)
+                                         : values.read_int<uint32_t>(pos, swap_endian));
+    }
+}
+
+struct TiffIfd {
+    int64_t width = -1;
+    int64_t height = -1;
+    uint64_t subfile_type = 0;
+    std::vector<uint64_t> sub_ifds;
+    uint64_t next = 0;
+};
+
+// Entries up to SubIFDs and the next IFD offset of the IFD at `offset`
+inline bool tiff_read_ifd(ReadInterface &ri, size_t length, uint64_t offset, bool big_tiff, bool swap_endian,
+                          TiffIfd &ifd) {
+    const uint64_t count_size = big_tiff ? 8 : 2;
+    const uint64_t entry_size = big_tiff ? 20 : 12;
+    if (offset > length || length - offset < count_size) {
+        return false;
+    }
+    auto buffer = ri.read_buffer((off_t)offset, (size_t)count_size);
+    uint64_t num_entry =
+        big_tiff ? buffer.read_int<uint64_t>(0, swap_endian) : buffer.read_int<uint16_t>(0, swap_endian);
+    uint64_t entries_start = offset + count_size;
+    if (num_entry > (length - entries_start) / entry_size) {
+        return false;
+    }
+    Buffer entries;
+    for (uint64_t i = 0; i < num_entry; ++i) {
+        uint64_t k = i % II_TIFF_ENTRY_BATCH;
+        if (k == 0) {
+            uint64_t batch_count = (std::min)(num_entry - i, (uint64_t)II_TIFF_ENTRY_BATCH);
+            entries = ri.read_buffer((off_t)(entries_start + i * entry_size), (size_t)(batch_count * entry_size));
+        }
+        off_t e = (off_t)(k * entry_size);
+        auto tag = entries.read_int<uint16_t>(e, swap_endian);
+        uint64_t value = 0;
+        if (tag == 254) {  // NewSubfileType
+            tiff_entry_uint(entries, e, big_tiff, swap_endian, ifd.subfile_type);
+        } else if ((tag == 256 || tag == 257) && tiff_entry_uint(entries, e, big_tiff, swap_endian, value)) {
+            value = (std::min)(value, (uint64_t)std::numeric_limits<int64_t>::max());
+            (tag == 256 ? ifd.width : ifd.height) = (int64_t)value;
+        } else if (tag == 330) {  // SubIFDs
+            tiff_sub_ifds(ri, length, entries, e, big_tiff, swap_endian, ifd.sub_ifds);
+        } else if (tag > 330) {
+            break;
+        }
+    }
+    uint64_t next_pos = entries_start + num_entry * entry_size;
+    if (next_pos + (big_tiff ? 8 : 4) <= length) {
+        buffer = ri.read_buffer((off_t)next_pos, big_tiff ? 8 : 4);
+        ifd.next = big_tiff ? buffer.read_int<uint64_t>(0, swap_endian) : buffer.read_int<uint32_t>(0, swap_endian);
+    }
+    return ifd.width > 0 && ifd.height > 0;
+}
+
+/**
+ * Reduced-resolution images (NewSubfileType bit 0) among the SubIFDs and the IFD chain, breadth first
+ * from the first IFD. Pages that are not reduced-resolution are walked through but not listed.
+ */
+inline void tiff_levels(ReadInterface &ri, size_t length, bool big_tiff, bool swap_endian, uint64_t first_ifd,
+                        ImageInfo &info) {
+    std::vector<uint64_t> pending{first_ifd};
+    std::unordered_set<uint64_t> visited;
+    ImageLevels levels;
+    for (size_t i = 0; i < pending.size() && visited.size() < II_TIFF_MAX_IFDS; ++i) {
+        if (pending[i] == 0 || !visited.insert(pending[i]).second) {
+            continue;
+        }
+        TiffIfd ifd;
+        if (!tiff_read_ifd(ri, length, pending[i], big_tiff, swap_endian, ifd)) {
+            continue;
+        }
+        if (i == 0) {
+            levels.emplace_back(ifd.width, ifd.height);
+        } else if (ifd.subfile_type & 0x1) {
+            levels.emplace_back(ifd.width, ifd.height);
+        }
+        pending.insert(pending.end(), ifd.sub_ifds.begin(), ifd.sub_ifds.end());
+        pending.push_back(ifd.next);
+    }
+    if (levels.size() > 1) {
+        std::stable_sort(levels.begin() + 1, levels.end(), [](const ImageLevel &a, const ImageLevel &b) {
+            return a.size.width * a.size.height > b.size.width * b.size.height;
+        });
+        info.set_levels(levels);
+    }
+}
+
 // https://www.fileformat.info/format/tiff/corion.htm
 inline bool try_tiff(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 8) {
@@ -1202,49 +3406,20 @@ inline bool try_tiff(ReadInterface &ri, size_t length, ImageInfo &info) {
     bool swap_endian = buffer[0] == 0x4D;
 
     auto tiff_version = buffer.read_int<uint16_t>(2, swap_endian);
+    bool big_tiff;
+    uint64_t first_ifd;
+    uint64_t offset;
+    uint64_t num_entry;
     if (tiff_version == 0x2A) {
-        auto offset = buffer.read_int<uint32_t>(4, swap_endian);
-        if (uint64_t(length) < uint64_t(offset) + 2) {
+        big_tiff = false;
+        offset = buffer.read_int<uint32_t>(4, swap_endian);
+        first_ifd = offset;
+        if (uint64_t(length) < offset + 2) {
             return false;
         }
-
-        buffer = ri.read_buffer(offset, 2);
-
-        auto num_entry = buffer.read_int<uint16_t>(0, swap_endian);
+        buffer = ri.read_buffer((off_t)offset, 2);
+        num_entry = buffer.read_int<uint16_t>(0, swap_endian);
         offset += 2;
-
-        int64_t width = -1;
-        int64_t height = -1;
-        for (uint16_t i = 0; i < num_entry && (width == -1 || height == -1); ++i, offset += 12) {
-            if (uint64_t(length) < uint64_t(offset) + 12) {
-                return false;
-            }
-            buffer = ri.read_buffer(offset, 12);
-
-            auto tag = buffer.read_int<uint16_t>(0, swap_endian);
-            auto type = buffer.read_int<uint16_t>(2, swap_endian);
-
-            if (tag == 256) {  // Found ImageWidth entry
-                if (type == 3) {
-                    width = buffer.read_int<uint16_t>(8, swap_endian);
-                } else if (type == 4) {
-                    width = buffer.read_int<uint32_t>(8, swap_endian);
-                }
-            } else if (tag == 257) {  // Found ImageHeight entry
-                if (type == 3) {
-                    height = buffer.read_int<uint16_t>(8, swap_endian);
-                } else if (type == 4) {
-                    height = buffer.read_int<uint32_t>(8, swap_endian);
-                }
-            }
-        }
-
-        bool ok = width != -1 && height != -1;
-        if (ok) {
-            info = ImageInfo(kFormatTiff, "tiff", "tiff", "image/tiff");
-            info.set_size(width, height);
-        }
-        return ok;
     } else if (tiff_version == 0x2B) {
         if (length < 16) {
             return false;
@@ -1254,69 +3429,192 @@ inline bool try_tiff(ReadInterface &ri, size_t length, ImageInfo &info) {
         if (byte_size != 8 || zero != 0) {
             return false;
         }
+        big_tiff = true;
         buffer = ri.read_buffer(8, 8);
-        auto offset = buffer.read_int<uint64_t>(0, swap_endian);
-        if (uint64_t(length) < offset + 8 || offset > std::numeric_limits<off_t>::max() - 8) {
+        offset = buffer.read_int<uint64_t>(0, swap_endian);
+        first_ifd = offset;
+        if (uint64_t(length) < offset + 8 || offset > (uint64_t)std::numeric_limits<off_t>::max() - 8) {
             return false;
         }
         buffer = ri.read_buffer((off_t)offset, 8);
-        auto num_entry = buffer.read_int<uint64_t>(0, swap_endian);
+        num_entry = buffer.read_int<uint64_t>(0, swap_endian);
         offset += 8;
+    } else {
+        return false;
+    }
 
-        int64_t width = -1;
-        int64_t height = -1;
-        for (uint64_t i = 0; i < num_entry && (width == -1 || height == -1); ++i, offset += 20) {
-            if (uint64_t(length) < offset + 20 || offset > std::numeric_limits<off_t>::max() - 20) {
-                return false;
+    // Classic: tag(2) type(2) count(4) value(4), BigTIFF: tag(2) type(2) count(8) value(8)
+    const uint64_t entry_size = big_tiff ? 20 : 12;
+    const off_t value_pos = big_tiff ? 12 : 8;
+
+    int64_t width = -1;
+    int64_t height = -1;
+    TiffPixelFormat pixel;
+    bool read_metadata = ri.options().read_metadata;
+    MetadataBlocks metadata;
+    Buffer entries;
+    uint64_t batch_start = 0;
+    uint64_t batch_count = 0;
+    for (uint64_t i = 0; i < num_entry; ++i, offset += entry_size) {
+        if (uint64_t(length) < offset + entry_size ||
+            offset > (uint64_t)std::numeric_limits<off_t>::max() - entry_size) {
+            if (width != -1 && height != -1) {
+                break;
             }
-            buffer = ri.read_buffer((off_t)offset, 20);
-
-            auto tag = buffer.read_int<uint16_t>(0, swap_endian);
-            auto type = buffer.read_int<uint16_t>(2, swap_endian);
-
-            if (tag == 256) {  // Found ImageWidth entry
-                if (type == 3) {
-                    width = buffer.read_int<uint16_t>(12, swap_endian);
-                } else if (type == 4) {
-                    width = buffer.read_int<uint32_t>(12, swap_endian);
-                } else if (type == 16) {
-                    auto w = buffer.read_int<uint64_t>(12, swap_endian);
-                    if (w > std::numeric_limits<int64_t>::max()) {
-                        // TODO: Size > INT64_MAX is not supported
-                        return false;
-                    }
-                    width = (int64_t)w;
-                }
-            } else if (tag == 257) {  // Found ImageHeight entry
-                if (type == 3) {
-                    height = buffer.read_int<uint16_t>(12, swap_endian);
-                } else if (type == 4) {
-                    height = buffer.read_int<uint32_t>(12, swap_endian);
-                } else if (type == 16) {
-                    auto h = buffer.read_int<uint64_t>(12, swap_endian);
-                    if (h > std::numeric_limits<int64_t>::max()) {
-                        // TODO: Size > INT64_MAX is not supported
-                        return false;
-                    }
-                    height = (int64_t)h;
+            return false;
+        }
+        if (i >= batch_start + batch_count) {
+            batch_start = i;
+            batch_count = (std::min)(num_entry - i, (uint64_t)II_TIFF_ENTRY_BATCH);
+            batch_count = (std::min)(batch_count, (uint64_t(length) - offset) / entry_size);
+            entries = ri.read_buffer((off_t)offset, (size_t)(batch_count * entry_size));
+        }
+        off_t e = (off_t)((i - batch_start) * entry_size);
+
+        auto tag = entries.read_int<uint16_t>(e, swap_endian);
+        auto type = entries.read_int<uint16_t>(e + 2, swap_endian);
+        uint64_t count = big_tiff ? entries.read_int<uint64_t>(e + 4, swap_endian)
+                                  : entries.read_int<uint32_t>(e + 4, swap_endian);
+
+        if (tag == 256 || tag == 257) {  // ImageWidth, ImageHeight
+            int64_t value = -1;
+            if (type == 3) {
+                value = entries.read_int<uint16_t>(e + value_pos, swap_endian);
+            } else if (type == 4) {
+                value = entries.read_int<uint32_t>(e + value_pos, swap_endian);
+            } else if (type == 16 && big_tiff) {
+                auto v = entries.read_int<uint64_t>(e + value_pos, swap_endian);
+                if (v > (uint64_t)std::numeric_limits<int64_t>::max()) {
+                    // TODO: Size > INT64_MAX is not supported
+                    return false;
+                }
+                value = (int64_t)v;
+            }
+            (tag == 256 ? width : height) = value;
+        } else if (tag == 258) {  // BitsPerSample
+            uint16_t bits;
+            if (tiff_first_short(ri, length, entries, e + value_pos, count, big_tiff, swap_endian, bits)) {
+                pixel.bit_depth = bits;
+            }
+        } else if (tag == 277) {  // SamplesPerPixel
+            pixel.channels = entries.read_int<uint16_t>(e + value_pos, swap_endian);
+        } else if (tag == 338) {  // ExtraSamples, 1 and 2 are associated and unassociated alpha
+            uint16_t extra;
+            if (tiff_first_short(ri, length, entries, e + value_pos, count, big_tiff, swap_endian, extra)) {
+                pixel.has_alpha = extra == 1 || extra == 2;
+            }
+        } else if (read_metadata && (tag == 700 || tag == 34675) && (type == 1 || type == 7)) {  // XMP, ICC
+            uint64_t data = count <= (uint64_t)(big_tiff ? 8 : 4) ? offset + value_pos
+                            : big_tiff ? entries.read_int<uint64_t>(e + value_pos, swap_endian)
+                                       : entries.read_int<uint32_t>(e + value_pos, swap_endian);
+            if (data <= length && count <= length - data) {
+                metadata.emplace_back(tag == 700 ? kMetadataXmp : kMetadataIcc, (off_t)data, (size_t)count);
+            }
+        } else if (read_metadata && tag == 34665) {  // Exif IFD, its entry count, entries and next offset
+            uint64_t ifd = 0;
+            const uint64_t count_size = big_tiff ? 8 : 2;
+            if (tiff_entry_uint(entries, e, big_tiff, swap_endian, ifd) && ifd <= length &&
+                length - ifd >= count_size) {
+                auto ifd_header = ri.read_buffer((off_t)ifd, (size_t)count_size);
+                uint64_t ifd_entries = big_tiff ? ifd_header.read_int<uint64_t>(0, swap_endian)
+                                                : ifd_header.read_int<uint16_t>(0, swap_endian);
+                uint64_t ifd_size = count_size + (big_tiff ? 8 : 4);
+                if (ifd_entries <= (length - ifd) / entry_size) {
+                    ifd_size += ifd_entries * entry_size;
                 }
+                metadata.emplace_back(kMetadataExif, (off_t)ifd, (size_t)(std::min)(ifd_size, length - ifd));
             }
         }
 
-        bool ok = width != -1 && height != -1;
-        if (ok) {
-            info = ImageInfo(kFormatTiff, "tiff", "tiff", "image/tiff");
-            info.set_size(width, height);
+        // Tags are sorted, nothing of interest follows ExtraSamples, or the ICC profile for metadata
+        if (width != -1 && height != -1 && tag >= (read_metadata ? 34675 : 338)) {
+            break;
+        }
+    }
+
+    bool ok = width != -1 && height != -1;
+    if (ok) {
+        info = ImageInfo(kFormatTiff);
+        info.set_size(width, height);
+        info.set_pixel_format(pixel.bit_depth, pixel.channels, pixel.has_alpha);
+        for (const auto &block : metadata) {
+            info.add_metadata(block);
+        }
+        if (ri.options().read_tiff_levels) {
+            tiff_levels(ri, length, big_tiff, swap_endian, first_ifd, info);
         }
-        return ok;
-    } else {
-        return false;
     }
+    return ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // https://developers.google.com/speed/webp/docs/riff_container
+// ANMF chunks follow VP8X and ANIM, each one costs a chunk header read
+inline int64_t webp_frame_count(ReadInterface &ri, size_t length, uint64_t riff_end) {
+    ScanBudget budget(ri);
+    uint64_t end = (std::min)((uint64_t)length, riff_end);
+    uint64_t offset = 30;
+    int64_t frames = 0;
+    while (offset + 8 <= end) {
+        if (!budget.take(offset, 8)) {
+            return -1;
+        }
+        auto chunk = ri.read_buffer((off_t)offset, 8);
+        if (chunk.cmp(0, 4, "ANMF")) {
+            ++frames;
+        }
+        uint32_t size = chunk.read_u32_le(4);
+        offset += 8 + (uint64_t)size + (size & 1);
+    }
+    return frames >= 1 ? frames : -1;
+}
+
+// Chunks read looking for metadata, which follows the image data and every frame
+#ifndef II_WEBP_MAX_CHUNKS
+#define II_WEBP_MAX_CHUNKS (4096)
+#endif
+
+// The ICCP, EXIF and XMP chunks that the VP8X flags announce, one chunk header read per chunk
+inline void webp_metadata(ReadInterface &ri, size_t length, uint64_t riff_end, uint8_t flags, ImageInfo &info) {
+    uint64_t end = (std::min)((uint64_t)length, riff_end);
+    uint64_t offset = 30;
+    // ICC profile 0x20, EXIF 0x08, XMP 0x04
+    flags &= 0x2C;
+    for (int i = 0; i < II_WEBP_MAX_CHUNKS && flags != 0 && offset + 8 <= end; ++i) {
+        auto chunk = ri.read_buffer((off_t)offset, 8);
+        uint32_t size = chunk.read_u32_le(4);
+        if (size > end - offset - 8) {
+            return;
+        }
+        if (chunk.cmp(0, 4, "ICCP")) {
+            info.add_metadata(MetadataBlock(kMetadataIcc, (off_t)offset + 8, size));
+            flags &= ~0x20;
+        } else if (chunk.cmp(0, 4, "EXIF")) {
+            info.add_metadata(MetadataBlock(kMetadataExif, (off_t)offset + 8, size));
+            flags &= ~0x08;
+        } else if (chunk.cmp(0, 4, "XMP ")) {
+            info.add_metadata(MetadataBlock(kMetadataXmp, (off_t)offset + 8, size));
+            flags &= ~0x04;
+        }
+        offset += 8 + (uint64_t)size + (size & 1);
+    }
+}
+
+// RIFF header(12), then the first chunk header at 12 and its data at 20
+struct WebpHeader {
+    using RiffSize = LeField<uint32_t, 4>;
+    // VP8 frame tag(3), start code(3), then 14 bits sizes and 2 bits scales
+    using Vp8Width = LeField<uint16_t, 26>;
+    using Vp8Height = LeField<uint16_t, 28>;
+    // VP8L signature(1), then 14 bits width - 1, 14 bits height - 1, alpha_is_used(1), version(3)
+    using Vp8lBits = LeField<uint32_t, 21>;
+    using Vp8xFlags = LeField<uint8_t, 20>;
+    // 24 bits canvas width - 1 at 24 and height - 1 at 27, loaded from 26 and shifted to stay within 30 bytes
+    using Vp8xWidth = LeField<uint32_t, 24>;
+    using Vp8xHeight = LeField<uint32_t, 26>;
+};
+
 inline bool try_webp(ReadInterface &ri, size_t length, ImageInfo &info) {
     if (length < 16) {
         return false;
@@ -1328,30 +3626,42 @@ inline bool try_webp(ReadInterface &ri, size_t length, ImageInfo &info) {
 
     std::string type = buffer.read_string(12, 4);
     if (type == "VP8 " && buffer.size() >= 30) {
-        info = ImageInfo(kFormatWebp, "webp", "webp", "image/webp");
-        info.set_size(                        //
-            buffer.read_u16_le(26) & 0x3FFF,  //
-            buffer.read_u16_le(28) & 0x3FFF   //
+        info = ImageInfo(kFormatWebp);
+        info.set_size(                                     //
+            buffer.read<WebpHeader::Vp8Width>() & 0x3FFF,  //
+            buffer.read<WebpHeader::Vp8Height>() & 0x3FFF  //
         );
+        info.set_pixel_format(8, 3, false);
         return true;
     } else if (type == "VP8L" && buffer.size() >= 25) {
-        uint32_t n = buffer.read_u32_le(21);
-        info = ImageInfo(kFormatWebp, "webp", "webp", "image/webp");
+        uint32_t n = buffer.read<WebpHeader::Vp8lBits>();
+        info = ImageInfo(kFormatWebp);
         info.set_size(                //
             (n & 0x3FFF) + 1,         //
             ((n >> 14) & 0x3FFF) + 1  //
         );
+        bool has_alpha = (n >> 28) & 0x01;
+        info.set_pixel_format(8, has_alpha ? 4 : 3, has_alpha);
         return true;
     } else if (type == "VP8X" && buffer.size() >= 30) {
-        uint8_t extended_header = buffer.read_u8(20);
+        uint8_t extended_header = buffer.read<WebpHeader::Vp8xFlags>();
         bool valid_start = (extended_header & 0xc0) == 0;
         bool valid_end = (extended_header & 0x01) == 0;
         if (valid_start && valid_end) {
-            info = ImageInfo(kFormatWebp, "webp", "webp", "image/webp");
-            info.set_size(                                        //
-                (buffer.read_u32_le(24) & 0x00FFFFFF) + 1,        //
-                ((buffer.read_u32_le(26) & 0xFFFFFF00) >> 8) + 1  //
+            info = ImageInfo(kFormatWebp);
+            info.set_size(                                                //
+                (buffer.read<WebpHeader::Vp8xWidth>() & 0x00FFFFFF) + 1,  //
+                (buffer.read<WebpHeader::Vp8xHeight>() >> 8) + 1          //
             );
+            bool has_alpha = (extended_header & 0x10) != 0;
+            info.set_pixel_format(8, has_alpha ? 4 : 3, has_alpha);
+            uint64_t riff_end = 8 + (uint64_t)buffer.read<WebpHeader::RiffSize>();
+            if (extended_header & 0x02) {
+                info.set_frame_count(webp_frame_count(ri, length, riff_end));
+            }
+            if (ri.options().read_metadata) {
+                webp_metadata(ri, length, riff_end, extended_header, info);
+            }
             return true;
         }
     }
@@ -1361,6 +3671,35 @@ inline bool try_webp(ReadInterface &ri, size_t length, ImageInfo &info) {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct TgaHeader {
+    using IdLength = LeField<uint8_t, 0>;
+    using ColorMapType = LeField<uint8_t, 1>;
+    using ImageType = LeField<uint8_t, 2>;
+    using FirstColorMapEntryIndex = LeField<uint16_t, 3>;
+    using ColorMapLength = LeField<uint16_t, 5>;
+    using ColorMapEntrySize = LeField<uint8_t, 7>;
+    using Width = LeField<uint16_t, 12>;
+    using Height = LeField<uint16_t, 14>;
+    using PixelDepth = LeField<uint8_t, 16>;
+    // The low 4 bits count alpha bits
+    using ImageDescriptor = LeField<uint8_t, 17>;
+};
+
+inline void tga_pixel_format(Buffer &buffer, ImageInfo &info) {
+    uint8_t image_type = buffer.read<TgaHeader::ImageType>();
+    uint8_t pixel_depth = buffer.read<TgaHeader::PixelDepth>();
+    bool has_alpha = (buffer.read<TgaHeader::ImageDescriptor>() & 0x0F) != 0;
+    if (image_type == 1 || image_type == 9) {  // color mapped
+        has_alpha = buffer.read<TgaHeader::ColorMapEntrySize>() == 32;
+        info.set_pixel_format(8, has_alpha ? 4 : 3, has_alpha);
+    } else if (image_type == 3 || image_type == 11) {  // grayscale
+        info.set_pixel_format(8, has_alpha ? 2 : 1, has_alpha);
+    } else if (pixel_depth == 15 || pixel_depth == 16 || pixel_depth == 24 || pixel_depth == 32) {
+        has_alpha = has_alpha || pixel_depth == 32;
+        info.set_pixel_format(8, has_alpha ? 4 : 3, has_alpha);
+    }
+}
+
 // TODO Not rigorous enough, keep it as last detector
 // https://www.fileformat.info/format/tga/corion.htm
 inline bool try_tga(ReadInterface &ri, size_t length, ImageInfo &info) {
@@ -1375,53 +3714,379 @@ inline bool try_tga(ReadInterface &ri, size_t length, ImageInfo &info) {
             return false;
         }
         buffer = ri.read_buffer(0, 18);
-        info = ImageInfo(kFormatTga, "tga", "tga", "image/tga");
-        info.set_size(               //
-            buffer.read_u16_le(12),  //
-            buffer.read_u16_le(14)   //
+        info = ImageInfo(kFormatTga);
+        info.set_size(                        //
+            buffer.read<TgaHeader::Width>(),  //
+            buffer.read<TgaHeader::Height>()  //
         );
+        tga_pixel_format(buffer, info);
         return true;
     }
 
     buffer = ri.read_buffer(0, 18);
 
-    uint8_t id_len = buffer.read_u8(0);
+    uint8_t id_len = buffer.read<TgaHeader::IdLength>();
     if (length < (size_t)id_len + 18) {
         return false;
     }
 
-    uint8_t color_map_type = buffer.read_u8(1);
-    uint8_t image_type = buffer.read_u8(2);
-    uint16_t first_color_map_entry_index = buffer.read_u16_le(3);
-    uint16_t color_map_length = buffer.read_u16_le(5);
-    uint8_t color_map_entry_size = buffer.read_u8(7);
-    // uint16_t x_origin = buffer.read_u16_le(8);
-    // uint16_t y_origin = buffer.read_u16_le(10);
-    uint16_t w = buffer.read_u16_le(12);
-    uint16_t h = buffer.read_u16_le(14);
-    // uint8_t pixel_depth = buffer.read_u8(16);
-    // uint8_t flags = buffer.read_u8(17);
+    uint8_t color_map_type = buffer.read<TgaHeader::ColorMapType>();
+    uint8_t image_type = buffer.read<TgaHeader::ImageType>();
+    uint16_t first_color_map_entry_index = buffer.read<TgaHeader::FirstColorMapEntryIndex>();
+    uint16_t color_map_length = buffer.read<TgaHeader::ColorMapLength>();
+    uint8_t color_map_entry_size = buffer.read<TgaHeader::ColorMapEntrySize>();
+    uint16_t w = buffer.read<TgaHeader::Width>();
+    uint16_t h = buffer.read<TgaHeader::Height>();
 
     if (color_map_type == 0) {  // no color map
         if (image_type == 0 || image_type == 2 || image_type == 3 || image_type == 10 || image_type == 11 ||
             image_type == 32 || image_type == 33) {
             if (first_color_map_entry_index == 0 && color_map_length == 0 && color_map_entry_size == 0) {
-                info = ImageInfo(kFormatTga, "tga", "tga", "image/tga");
+                info = ImageInfo(kFormatTga);
                 info.set_size(w, h);
+                tga_pixel_format(buffer, info);
                 return true;
             }
         }
     } else if (color_map_type == 1) {  // 256 entry palette
         if (image_type == 1 || image_type == 9) {
-            info = ImageInfo(kFormatTga, "tga", "tga", "image/tga");
+            info = ImageInfo(kFormatTga);
             info.set_size(w, h);
+            tga_pixel_format(buffer, info);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Bytes read at once by the full verification level
+#ifndef II_VERIFY_WINDOW_SIZE
+#define II_VERIFY_WINDOW_SIZE (65536)
+#endif
+
+// CRCs of the chunks from the signature up to IHDR, or up to IEND when `full`
+inline bool verify_png(ReadInterface &ri, size_t length, bool full) {
+    uint64_t offset = 8;
+    while (offset + 12 <= length) {
+        auto header = ri.read_buffer((off_t)offset, 8);
+        uint64_t size = header.read_u32_be(0);
+        if (size > 0x7FFFFFFF || offset + 12 + size > length) {
+            return false;
+        }
+        uint32_t crc = crc32(header.data() + 4, 4);
+        // Data and the stored CRC, the last window keeps the CRC in one piece
+        uint64_t pos = offset + 8;
+        uint64_t remaining = size + 4;
+        uint32_t stored = 0;
+        while (remaining > 0) {
+            size_t n = remaining <= II_VERIFY_WINDOW_SIZE + 4 ? (size_t)remaining : II_VERIFY_WINDOW_SIZE;
+            auto data = ri.read_buffer((off_t)pos, n);
+            bool last = n == remaining;
+            crc = crc32(data.data(), last ? n - 4 : n, crc);
+            if (last) {
+                stored = data.read_u32_be((off_t)(n - 4));
+            }
+            pos += n;
+            remaining -= n;
+        }
+        if (stored != crc) {
+            return false;
+        }
+        if (header.cmp(4, 4, "IEND") || (!full && header.cmp(4, 4, "IHDR"))) {
             return true;
         }
+        offset = pos;
+    }
+    return false;
+}
+
+// The RIFF size covers the file exactly, and when `full`, the chunks, padded to even sizes, fill it
+inline bool verify_webp(ReadInterface &ri, size_t length, bool full) {
+    if (length < 12) {
+        return false;
+    }
+    uint64_t riff_end = 8 + (uint64_t)ri.read_buffer(4, 4).read_u32_le(0);
+    if (riff_end != length) {
+        return false;
+    }
+    if (!full) {
+        return true;
+    }
+    uint64_t offset = 12;
+    while (offset < riff_end) {
+        if (riff_end - offset < 8) {
+            return false;
+        }
+        uint64_t size = ri.read_buffer((off_t)offset, 8).read_u32_le(4);
+        size += size & 1;
+        if (size > riff_end - offset - 8) {
+            return false;
+        }
+        offset += 8 + size;
+    }
+    return true;
+}
+
+// Offset of the first marker after entropy-coded data, stuffed bytes, fill bytes and restart markers are skipped
+inline uint64_t jpeg_skip_entropy_data(ReadInterface &ri, size_t length, uint64_t offset) {
+    while (offset + 1 < length) {
+        size_t n = (size_t)(std::min)((uint64_t)II_VERIFY_WINDOW_SIZE, length - offset);
+        auto buffer = ri.read_buffer((off_t)offset, n);
+        const uint8_t *p = buffer.data();
+        size_t i = 0;
+        while (i + 1 < n) {
+            const auto *ff = (const uint8_t *)memchr(p + i, 0xFF, n - 1 - i);
+            if (ff == nullptr) {
+                i = n - 1;
+                break;
+            }
+            i = (size_t)(ff - p);
+            uint8_t marker = p[i + 1];
+            if (marker == 0xFF) {
+                i += 1;
+            } else if (marker == 0x00 || (marker >= 0xD0 && marker <= 0xD7)) {
+                i += 2;
+            } else {
+                return offset + i;
+            }
+        }
+        offset += i;
     }
+    return length;
+}
 
+// Segment lengths chain from SOI to the first SOS, or through every scan to EOI when `full`
+inline bool verify_jpeg(ReadInterface &ri, size_t length, bool full) {
+    uint64_t offset = 2;
+    bool scanned = false;
+    while (offset + 2 <= length) {
+        auto buffer = ri.read_buffer((off_t)offset, (size_t)(std::min)((uint64_t)4, length - offset));
+        if (buffer.read_u8(0) != 0xFF) {
+            return false;
+        }
+        uint8_t marker = buffer.read_u8(1);
+        if (marker == 0xFF) {
+            offset += 1;
+            continue;
+        }
+        if (marker == 0xD9) {
+            return scanned;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            offset += 2;
+            continue;
+        }
+        if (buffer.size() < 4) {
+            return false;
+        }
+        uint16_t size = buffer.read_u16_be(2);
+        if (size < 2 || offset + 2 + size > length) {
+            return false;
+        }
+        offset += 2 + size;
+        if (marker == 0xDA) {
+            if (!full) {
+                return true;
+            }
+            scanned = true;
+            offset = jpeg_skip_entropy_data(ri, length, offset);
+        }
+    }
     return false;
 }
 
+// Boxes fill [offset, end) exactly, and when `full`, so do the children of container boxes
+inline bool verify_iso_boxes(ReadInterface &ri, uint64_t offset, uint64_t end, bool full, int depth = 0) {
+    static const char *const containers[] = {
+        "moov", "trak", "mdia", "minf", "stbl", "dinf", "edts", "meta", "iprp", "ipco", "jp2h", "res ",
+    };
+    while (offset < end) {
+        if (end - offset < 8) {
+            return false;
+        }
+        auto header = ri.read_buffer((off_t)offset, (size_t)(std::min)((uint64_t)16, end - offset));
+        uint64_t size = header.read_u32_be(0);
+        uint64_t header_size = 8;
+        if (size == 1) {
+            if (header.size() < 16) {
+                return false;
+            }
+            size = header.read_u64_be(8);
+            header_size = 16;
+        } else if (size == 0) {
+            // Extends to the end
+            size = end - offset;
+        }
+        if (size < header_size || size > end - offset) {
+            return false;
+        }
+        if (full && depth < 8) {
+            for (const char *type : containers) {
+                if (!header.cmp(4, 4, type)) {
+                    continue;
+                }
+                // meta is a full box, version and flags come first
+                uint64_t children = offset + header_size + (header.cmp(4, 4, "meta") ? 4 : 0);
+                if (children > offset + size || !verify_iso_boxes(ri, children, offset + size, full, depth + 1)) {
+                    return false;
+                }
+                break;
+            }
+        }
+        offset += size;
+    }
+    return true;
+}
+
+// Formats without checks always pass
+inline bool verify_integrity(ReadInterface &ri, size_t length, Format format, VerifyLevel level) {
+    bool full = level == kVerifyFull;
+    switch (format) {
+        case kFormatPng:
+            return verify_png(ri, length, full);
+        case kFormatWebp:
+            return verify_webp(ri, length, full);
+        case kFormatJpeg:
+            return verify_jpeg(ri, length, full);
+        case kFormatAvif:
+        case kFormatHeic:
+        case kFormatJp2:
+        case kFormatJph:
+        case kFormatJpx:
+            return verify_iso_boxes(ri, 0, length, full);
+        default:
+            return true;
+    }
+}
+
+// Bytes read from the end of the file to find the JPEG, PNG and GIF trailers
+#ifndef II_TAIL_PROBE_SIZE
+#define II_TAIL_PROBE_SIZE (256)
+#endif
+
+// The end of the item data iloc points at, 0 if `meta` holds no iloc
+inline uint64_t heif_data_end(Buffer &meta) {
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> locations;
+    uint64_t data_end = 0;
+    off_t offset = 0;
+    off_t end = (off_t)meta.size();
+    while (offset + 8 <= end) {
+        uint32_t box_size = meta.read_u32_be(offset);
+        if (box_size < 8 || (uint64_t)offset + box_size > (uint64_t)end) {
+            break;
+        }
+        if (meta.cmp(offset + 4, 4, "iloc")) {
+            heif_item_locations(meta, offset, offset + box_size, locations, &data_end);
+        }
+        offset += box_size;
+    }
+    return data_end;
+}
+
+/**
+ * The top-level box chain runs past the end, box headers beyond the header cache cost one read and only one is taken.
+ * The items of HEIF and AVIF usually sit in an mdat behind a meta too large for the cache, the extents of its iloc
+ * tell where they end, so a meta past the cache takes that read instead of the next box header.
+ */
+inline bool iso_boxes_truncated(ReadInterface &ri, size_t length) {
+    uint64_t offset = 0;
+    bool probed = false;
+    while (offset + 8 <= length) {
+        size_t size = (size_t)(std::min)((uint64_t)16, length - offset);
+        if (offset + size > ri.header_cache_size()) {
+            if (probed) {
+                return false;
+            }
+            probed = true;
+        }
+        auto header = ri.read_buffer((off_t)offset, size);
+        uint64_t box_size = header.read_u32_be(0);
+        if (box_size == 1 && header.size() == 16) {
+            box_size = header.read_u64_be(8);
+        } else if (box_size == 0 || box_size == 1) {
+            // Extends to the end, or a largesize field cut off
+            return box_size == 1;
+        }
+        if (box_size < 8) {
+            return false;
+        }
+        if (box_size > length - offset) {
+            return true;
+        }
+        if (header.cmp(4, 4, "meta") && box_size > 12) {
+            bool past_cache = offset + box_size > ri.header_cache_size();
+            if (!past_cache || !probed) {
+                probed = probed || past_cache;
+                // Full box, version and flags come first
+                auto meta = ri.read_buffer((off_t)(offset + 12), (size_t)(box_size - 12));
+                if (heif_data_end(meta) > length) {
+                    return true;
+                }
+            }
+        }
+        offset += box_size;
+    }
+    // A box header cut off
+    return offset < length;
+}
+
+// The entries of the directory run past the end
+inline bool ico_truncated(ReadInterface &ri, size_t length) {
+    uint16_t entry_count = ri.read_buffer(4, 2).read_u16_le(0);
+    auto entries = ri.read_buffer(6, (size_t)entry_count * 16);
+    uint64_t total = 6 + (uint64_t)entry_count * 16;
+    for (uint16_t i = 0; i < entry_count; ++i) {
+        uint64_t bytes = entries.read_u32_le(i * 16 + 8);
+        uint64_t end = entries.read_u32_le(i * 16 + 12) + bytes;
+        total += bytes;
+        if (end > length) {
+            return true;
+        }
+    }
+    return total > length;
+}
+
+/**
+ * Whether the file ends before its trailer or its declared length, with at most one read past the header cache:
+ * JPEG EOI followed by nothing but 0x00 or 0xFF padding, PNG IEND and its CRC, the GIF trailer 0x3B, the RIFF size
+ * of WebP, the top-level boxes of ISOBMFF and the ICO and ICNS directory totals. Other formats are never truncated.
+ */
+inline bool is_truncated(ReadInterface &ri, size_t length, Format format) {
+    switch (format) {
+        case kFormatJpeg: {
+            size_t size = (std::min)(length, (size_t)II_TAIL_PROBE_SIZE);
+            auto tail = ri.read_buffer((off_t)(length - size), size);
+            size_t end = size;
+            while (end > 2 && (tail[end - 1] == 0x00 || tail[end - 1] == 0xFF)) {
+                --end;
+            }
+            return end < 2 || tail[end - 2] != 0xFF || tail[end - 1] != 0xD9;
+        }
+        case kFormatPng:
+            return length < 12 || !ri.read_buffer((off_t)(length - 12), 12).cmp(0, 12, "\0\0\0\0IEND\xAE\x42\x60\x82");
+        case kFormatGif:
+            return ri.read_buffer((off_t)(length - 1), 1).read_u8(0) != 0x3B;
+        case kFormatWebp:
+            return length < 8 || 8 + (uint64_t)ri.read_buffer(4, 4).read_u32_le(0) > length;
+        case kFormatAvif:
+        case kFormatHeic:
+        case kFormatJp2:
+        case kFormatJph:
+        case kFormatJpx:
+            return iso_boxes_truncated(ri, length);
+        case kFormatIco:
+        case kFormatCur:
+            return ico_truncated(ri, length);
+        case kFormatIcns:
+            return ri.read_buffer(4, 4).read_u32_be(0) > length;
+        default:
+            return false;
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 enum DetectorIndex {
@@ -1448,11 +4113,6 @@ enum DetectorIndex {
 
 using Detector = bool (*)(ReadInterface &ri, size_t length, ImageInfo &info);
 
-template <typename T, size_t N>
-inline constexpr size_t countof(T (&)[N]) noexcept {
-    return N;
-}
-
 struct DetectorInfo {
     Format format;
     DetectorIndex index;
@@ -1476,10 +4136,10 @@ constexpr bool check_format_order(const DetectorInfo (&dl)[N]) {
     return check_format_order_<N>::check(dl);
 }
 
-inline ImageInfo parse(ReadInterface &ri,                               //
-                       Format most_likely_format,                       //
-                       const std::vector<Format> &likely_formats = {},  //
-                       bool must_be_one_of_likely_formats = false) {    //
+II_IMPL ImageInfo parse(ReadInterface &ri,                               //
+                        Format most_likely_format,                       //
+                        const std::vector<Format> &likely_formats = {},  //
+                        bool must_be_one_of_likely_formats = false) {    //
     size_t length = ri.length();
 
     constexpr DetectorInfo dl[] = {
@@ -1512,11 +4172,22 @@ inline ImageInfo parse(ReadInterface &ri,                               //
 
     ImageInfo info;
 
+    auto checked = [&]() {
+        VerifyLevel level = ri.options().verify;
+        if (level != kVerifyNone && !verify_integrity(ri, length, info.format(), level)) {
+            return ImageInfo(kIntegrityCheckFailed);
+        }
+        if (ri.options().check_truncation && is_truncated(ri, length, info.format())) {
+            return ImageInfo(kTruncatedFile);
+        }
+        return info;
+    };
+
     if (most_likely_format != Format::kFormatUnknown) {
         auto detector = dl[most_likely_format - 1];
         if (detector.detect(ri, length, info)  //
             && (!must_be_one_of_likely_formats || info.format() == most_likely_format)) {
-            return info;
+            return checked();
         }
         tried[detector.index] = true;
     }
@@ -1531,7 +4202,7 @@ inline ImageInfo parse(ReadInterface &ri,                               //
         }
         if (detector.detect(ri, length, info)  //
             && (!must_be_one_of_likely_formats || info.format() == format)) {
-            return info;
+            return checked();
         }
         tried[detector.index] = true;
     }
@@ -1545,7 +4216,7 @@ inline ImageInfo parse(ReadInterface &ri,                               //
             continue;
         }
         if (detector.detect(ri, length, info)) {
-            return info;
+            return checked();
         }
         tried[detector.index] = true;
     }
@@ -1553,31 +4224,1596 @@ inline ImageInfo parse(ReadInterface &ri,                               //
     return ImageInfo(kUnrecognizedFormat);
 }
 
-inline ImageInfo parse(ReadInterface &ri,                               //
-                       const std::vector<Format> &likely_formats = {},  //
-                       bool must_be_one_of_likely_formats = false) {    //
+II_IMPL ImageInfo parse(ReadInterface &ri,                               //
+                        const std::vector<Format> &likely_formats = {},  //
+                        bool must_be_one_of_likely_formats = false) {    //
     return parse(ri, Format::kFormatUnknown, likely_formats, must_be_one_of_likely_formats);
 }
 
+#else  // II_LEAN_HEADER
+
+ImageInfo parse(ReadInterface &ri,                               //
+                Format most_likely_format,                       //
+                const std::vector<Format> &likely_formats = {},  //
+                bool must_be_one_of_likely_formats = false);     //
+
+ImageInfo parse(ReadInterface &ri,                               //
+                const std::vector<Format> &likely_formats = {},  //
+                bool must_be_one_of_likely_formats = false);     //
+
+#endif  // II_LEAN_HEADER
+
 template <typename ReaderType, typename InputType>
-inline ImageInfo parse(const InputType &input,                          //
-                       Format most_likely_format,                       //
-                       const std::vector<Format> &likely_formats = {},  //
-                       bool must_be_one_of_likely_formats = false) {    //
+inline ImageInfo parse(const InputType &input,                           //
+                       Format most_likely_format,                        //
+                       const std::vector<Format> &likely_formats = {},   //
+                       bool must_be_one_of_likely_formats = false,       //
+                       const ParseOptions &options = ParseOptions()) {  //
     ReaderType reader(input);
     size_t length = reader.size();
     ReadFunc read_func = [&reader](void *buf, off_t offset, size_t size) { reader.read(buf, offset, size); };
-    ReadInterface ri(read_func, length);
+    ReadInterface ri(read_func, length, options);
     return parse(ri, most_likely_format, likely_formats, must_be_one_of_likely_formats);
 }
 
 template <typename ReaderType, typename InputType>
-inline ImageInfo parse(const InputType &input,                          //
-                       const std::vector<Format> &likely_formats = {},  //
-                       bool must_be_one_of_likely_formats = false) {    //
-    return parse<ReaderType>(input, Format::kFormatUnknown, likely_formats, must_be_one_of_likely_formats);
+inline ImageInfo parse(const InputType &input,                           //
+                       const std::vector<Format> &likely_formats = {},   //
+                       bool must_be_one_of_likely_formats = false,       //
+                       const ParseOptions &options = ParseOptions()) {  //
+    return parse<ReaderType>(input, Format::kFormatUnknown, likely_formats, must_be_one_of_likely_formats, options);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum DecodeReduction {
+    kReductionNone = 0,
+    // JPEG IDCT scaling, decode at 1 / scale_denom
+    kReductionJpegScale,
+    // Read a smaller stored level: JPEG 2000 discard levels, DDS/KTX mip level, TIFF reduced-resolution subfile
+    kReductionLevel,
+};
+
+struct DecodePlan {
+    DecodeReduction reduction = kReductionNone;
+    int scale_denom = 1;
+    // Index into ImageInfo::levels(), for JPEG 2000 this is the number of discarded resolution levels
+    int level = 0;
+    // What the decoder produces before any resampling to the target
+    ImageSize decoded_size;
+    // Peak decoder memory, the decoded pixels plus the full size coefficient buffer of progressive JPEGs
+    int64_t decoder_bytes = 0;
+};
+
+/**
+ * Cheapest decoder-side reduction whose output still covers `target` once the image is fitted into it,
+ * computed from the header alone. JPEG scales by 1/2, 1/4 or 1/8, formats with levels read a smaller level,
+ * everything else (WebP, AVIF, PNG, ...) decodes at full size.
+ */
+DecodePlan plan_decode(const ImageInfo &info, const ImageSize &target);
+
+#ifndef II_LEAN_HEADER
+II_IMPL DecodePlan plan_decode(const ImageInfo &info, const ImageSize &target) {
+    DecodePlan plan;
+    const ImageSize &size = info.size();
+    plan.decoded_size = size;
+    if (!info || size.width <= 0 || size.height <= 0) {
+        return plan;
+    }
+    // Size of the image fitted into the target, rounded up so that a plan never undershoots it
+    ImageSize fitted = size;
+    if (target.width > 0 && target.height > 0) {
+        double fit = (std::min)({1.0, (double)target.width / size.width, (double)target.height / size.height});
+        fitted.width = (int64_t)std::ceil(size.width * fit - 1e-6);
+        fitted.height = (int64_t)std::ceil(size.height * fit - 1e-6);
+    }
+    auto covers = [&fitted](int64_t width, int64_t height) { return width >= fitted.width && height >= fitted.height; };
+
+    int sample_bytes = info.bit_depth() > 8 ? 2 : 1;
+    int channels = info.channels() > 0 ? info.channels() : 4;
+    if (info.format() == kFormatJpeg) {
+        for (int denom : {8, 4, 2}) {
+            int64_t width = (size.width + denom - 1) / denom;
+            int64_t height = (size.height + denom - 1) / denom;
+            if (covers(width, height)) {
+                plan.reduction = kReductionJpegScale;
+                plan.scale_denom = denom;
+                plan.decoded_size = ImageSize(width, height);
+                break;
+            }
+        }
+    } else if (!info.levels().empty()) {
+        const auto &levels = info.levels();
+        for (size_t i = levels.size(); i-- > 1;) {
+            if (covers(levels[i].size.width, levels[i].size.height)) {
+                plan.reduction = kReductionLevel;
+                plan.level = (int)i;
+                plan.decoded_size = levels[i].size;
+                break;
+            }
+        }
+    }
+
+    // Declared sizes go up to 2^32 per side, every product saturates
+    plan.decoder_bytes =
+        saturating_product({plan.decoded_size.width, plan.decoded_size.height, (int64_t)channels, sample_bytes});
+    if (info.format() == kFormatJpeg && info.progressive()) {
+        // One 16 bit coefficient per sample of every component, chroma planes subsampled
+        const ImageSize &sub = info.chroma_subsampling();
+        int64_t luma = saturating_product({size.width, size.height});
+        int64_t chroma = saturating_product({(int64_t)channels - 1, luma}) /
+                         (std::max)(saturating_product({sub.width, sub.height}), (int64_t)1);
+        auto add = [](int64_t a, int64_t b) {
+            return a > std::numeric_limits<int64_t>::max() - b ? std::numeric_limits<int64_t>::max() : a + b;
+        };
+        plan.decoder_bytes =
+            add(plan.decoder_bytes, add(saturating_product({2, luma}), saturating_product({2, chroma})));
+    }
+    return plan;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Caller-owned column arrays a BatchSink writes into, nothing is allocated per row
+ *
+ * format, error, width and height hold `capacity` rows. Row i's entry sizes are
+ * [entry_offsets[i], entry_offsets[i + 1]) of entry_widths and entry_heights, so entry_offsets holds capacity + 1
+ * values and the entry arrays `entry_capacity`. Leave the entry pointers null to drop entry sizes.
+ * SizeType is int64_t, or uint32_t for half the memory, larger sizes are saturated.
+ */
+template <typename SizeType = int64_t>
+struct BatchColumns {
+    size_t capacity = 0;
+    uint8_t *format = nullptr;
+    uint8_t *error = nullptr;
+    SizeType *width = nullptr;
+    SizeType *height = nullptr;
+
+    size_t entry_capacity = 0;
+    uint64_t *entry_offsets = nullptr;
+    SizeType *entry_widths = nullptr;
+    SizeType *entry_heights = nullptr;
+};
+
+static_assert(FORMAT_END <= 256, "Format does not fit the uint8_t format column");
+
+template <typename SizeType = int64_t>
+class BatchSink {
+public:
+    explicit BatchSink(const BatchColumns<SizeType> &columns) : columns_(columns) { clear(); }
+
+    // False, and nothing written, when the rows or the entry sizes are full
+    inline bool append(const ImageInfo &info) {
+        const auto &entries = info.entry_sizes();
+        bool keep_entries = columns_.entry_widths != nullptr && columns_.entry_heights != nullptr;
+        if (size_ >= columns_.capacity ||
+            (keep_entries && entries.size() > columns_.entry_capacity - entry_size_)) {
+            return false;
+        }
+        columns_.format[size_] = (uint8_t)info.format();
+        columns_.error[size_] = (uint8_t)info.error();
+        columns_.width[size_] = saturate(info.size().width);
+        columns_.height[size_] = saturate(info.size().height);
+        if (keep_entries) {
+            for (const auto &entry : entries) {
+                columns_.entry_widths[entry_size_] = saturate(entry.width);
+                columns_.entry_heights[entry_size_] = saturate(entry.height);
+                ++entry_size_;
+            }
+        }
+        ++size_;
+        if (columns_.entry_offsets != nullptr) {
+            columns_.entry_offsets[size_] = entry_size_;
+        }
+        return true;
+    }
+
+    inline size_t size() const { return size_; }
+
+    inline size_t entry_size() const { return entry_size_; }
+
+    inline bool full() const { return size_ >= columns_.capacity; }
+
+    inline void clear() {
+        size_ = 0;
+        entry_size_ = 0;
+        if (columns_.entry_offsets != nullptr) {
+            columns_.entry_offsets[0] = 0;
+        }
+    }
+
+private:
+    static inline SizeType saturate(int64_t value) {
+        if (value < (int64_t)(std::numeric_limits<SizeType>::min)()) {
+            return (std::numeric_limits<SizeType>::min)();
+        }
+        // Only positive values compare unsigned, a signed SizeType keeps -1 of a failed parse
+        if (value > 0 && (uint64_t)value > (uint64_t)(std::numeric_limits<SizeType>::max)()) {
+            return (std::numeric_limits<SizeType>::max)();
+        }
+        return (SizeType)value;
+    }
+
+    BatchColumns<SizeType> columns_;
+    size_t size_ = 0;
+    size_t entry_size_ = 0;
+};
+
+// Parse inputs in order into the sink until it is full, returns how many were consumed
+template <typename ReaderType, typename Iterator, typename SizeType>
+inline size_t parse_batch(Iterator first,                                //
+                          Iterator last,                                 //
+                          BatchSink<SizeType> &sink,                     //
+                          const ParseOptions &options = ParseOptions()) {  //
+    size_t consumed = 0;
+    for (; first != last; ++first, ++consumed) {
+        if (sink.full() || !sink.append(parse<ReaderType>(*first, kFormatUnknown, {}, false, options))) {
+            break;
+        }
+    }
+    return consumed;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct MemoCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+};
+
+/**
+ * In-process sharded LRU cache of parse results keyed by content, for payloads without a path or inode
+ *
+ * An entry is found by hashing the length and the header prefix, then confirmed by re-hashing every other range the
+ * detectors read when the entry was filled. A repeated payload is recognized without running any detector.
+ */
+class MemoCache {
+public:
+    explicit MemoCache(size_t capacity = 4096, size_t shard_count = 16)
+        : shard_capacity_((std::max)((size_t)1, capacity / (std::max)((size_t)1, shard_count))) {
+        for (size_t i = 0; i < (std::max)((size_t)1, shard_count); ++i) {
+            shards_.emplace_back(new Shard());
+        }
+    }
+
+    MemoCache(const MemoCache &) = delete;
+
+    MemoCache &operator=(const MemoCache &) = delete;
+
+    inline ImageInfo parse(ReadInterface &ri,                               //
+                           Format most_likely_format,                       //
+                           const std::vector<Format> &likely_formats = {},  //
+                           bool must_be_one_of_likely_formats = false) {    //
+        size_t length = ri.length();
+        size_t prefix_size = (std::min)(length, (size_t)II_HEADER_CACHE_SIZE);
+        auto prefix = ri.read_buffer(0, prefix_size);
+
+        uint64_t seed = hash_mix((uint64_t)length) ^ hash_mix(((uint64_t)most_likely_format << 1) + 1) ^
+                        hash_mix(ri.options().fingerprint() + 0x100) ^ (must_be_one_of_likely_formats ? 1 : 0);
+        if (!likely_formats.empty()) {
+            seed ^= hash_bytes(likely_formats.data(), likely_formats.size() * sizeof(Format));
+        }
+        uint64_t key = hash_bytes(prefix.data(), prefix.size(), seed);
+        Shard &shard = *shards_[key % shards_.size()];
+
+        std::vector<Entry> candidates;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto range = shard.index.equal_range(key);
+            for (auto it = range.first; it != range.second; ++it) {
+                candidates.push_back(*it->second);
+            }
+        }
+        for (const auto &candidate : candidates) {
+            if (verify(ri, candidate.ranges)) {
+                touch(shard, key, candidate.id);
+                hits_++;
+                return candidate.info;
+            }
+        }
+        misses_++;
+
+        ReadLog read_log;
+        ri.set_read_log(&read_log);
+        auto info = imageinfo::parse(ri, most_likely_format, likely_formats, must_be_one_of_likely_formats);
+        ri.set_read_log(nullptr);
+
+        Entry entry;
+        entry.key = key;
+        entry.info = info;
+        for (const auto &record : read_log) {
+            // Reads that stay inside the prefix are already covered by the key
+            if ((size_t)record.offset + record.size > prefix_size) {
+                entry.ranges.push_back(record);
+            }
+        }
+        insert(shard, std::move(entry));
+        return info;
+    }
+
+    inline MemoCacheStats stats() const {
+        MemoCacheStats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.evictions = evictions_;
+        for (const auto &shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            stats.size += shard->lru.size();
+        }
+        return stats;
+    }
+
+    inline void clear() {
+        for (auto &shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->lru.clear();
+            shard->index.clear();
+        }
+    }
+
+private:
+    struct Entry {
+        uint64_t id = 0;
+        uint64_t key = 0;
+        ReadLog ranges;
+        ImageInfo info;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    static inline bool verify(ReadInterface &ri, const ReadLog &ranges) {
+        for (const auto &record : ranges) {
+            if (record.offset < 0 || (size_t)record.offset + record.size > ri.length()) {
+                return false;
+            }
+            auto buffer = ri.read_buffer(record.offset, record.size);
+            if (hash_bytes(buffer.data(), buffer.size()) != record.hash) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline void touch(Shard &shard, uint64_t key, uint64_t id) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto range = shard.index.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second->id == id) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                return;
+            }
+        }
+    }
+
+    inline void insert(Shard &shard, Entry &&entry) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        entry.id = ++next_id_;
+        uint64_t key = entry.key;
+        shard.lru.push_front(std::move(entry));
+        shard.index.emplace(key, shard.lru.begin());
+        while (shard.lru.size() > shard_capacity_) {
+            auto last = std::prev(shard.lru.end());
+            auto range = shard.index.equal_range(last->key);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == last) {
+                    shard.index.erase(it);
+                    break;
+                }
+            }
+            shard.lru.erase(last);
+            evictions_++;
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t shard_capacity_;
+    std::atomic<uint64_t> next_id_{0};
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+template <typename ReaderType, typename InputType>
+inline ImageInfo parse_memo(MemoCache &cache,                                //
+                            const InputType &input,                          //
+                            Format most_likely_format = kFormatUnknown,      //
+                            const std::vector<Format> &likely_formats = {},  //
+                            bool must_be_one_of_likely_formats = false,      //
+                            const ParseOptions &options = ParseOptions()) {  //
+    ReaderType reader(input);
+    size_t length = reader.size();
+    ReadFunc read_func = [&reader](void *buf, off_t offset, size_t size) { reader.read(buf, offset, size); };
+    ReadInterface ri(read_func, length, options);
+    return cache.parse(ri, most_likely_format, likely_formats, must_be_one_of_likely_formats);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef II_COROUTINES
+
+/**
+ * Lazily started coroutine returning T, co_await it from another coroutine, or start() it and poll done()
+ * from code that is not a coroutine
+ */
+template <typename T>
+class AsyncTask {
+public:
+    struct promise_type {
+        T value{};
+        std::exception_ptr exception;
+        std::coroutine_handle<> continuation;
+
+        struct FinalAwaiter {
+            inline bool await_ready() const noexcept { return false; }
+
+            inline std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                auto continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            inline void await_resume() const noexcept {}
+        };
+
+        inline AsyncTask get_return_object() {
+            return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        inline std::suspend_always initial_suspend() noexcept { return {}; }
+
+        inline FinalAwaiter final_suspend() noexcept { return {}; }
+
+        inline void return_value(T v) { value = std::move(v); }
+
+        inline void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    AsyncTask(AsyncTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    AsyncTask(const AsyncTask &) = delete;
+    AsyncTask &operator=(const AsyncTask &) = delete;
+    AsyncTask &operator=(AsyncTask &&) = delete;
+
+    ~AsyncTask() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    inline void start() { handle_.resume(); }
+
+    inline bool done() const { return handle_.done(); }
+
+    // Only valid once done()
+    inline T &result() {
+        if (handle_.promise().exception) {
+            std::rethrow_exception(handle_.promise().exception);
+        }
+        return handle_.promise().value;
+    }
+
+    inline bool await_ready() const noexcept { return false; }
+
+    inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        handle_.promise().continuation = continuation;
+        return handle_;
+    }
+
+    inline T await_resume() { return std::move(result()); }
+
+private:
+    explicit AsyncTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Bytes parse_async() fetches around a read it has not seen yet, aligned to the window
+#ifndef II_ASYNC_FETCH_WINDOW
+#define II_ASYNC_FETCH_WINDOW (65536)
+#endif
+
+/**
+ * Byte ranges fetched by parse_async(), kept sorted and merged so that a read is one lookup,
+ * and a read spanning two fetched windows is served from their union
+ */
+class FetchedRanges {
+public:
+    inline bool read(void *buf, off_t offset, size_t size) const {
+        if (size == 0) {
+            return true;
+        }
+        auto it = ranges_.upper_bound(offset);
+        if (it == ranges_.begin()) {
+            return false;
+        }
+        --it;
+        if ((uint64_t)offset + size > (uint64_t)it->first + it->second.size()) {
+            return false;
+        }
+        memcpy(buf, it->second.data() + (offset - it->first), size);
+        return true;
+    }
+
+    // Bytes of the range that runs up to `offset`, 0 if `offset - 1` was not fetched
+    inline size_t run_before(off_t offset) const {
+        auto it = ranges_.lower_bound(offset);
+        if (it == ranges_.begin()) {
+            return 0;
+        }
+        --it;
+        off_t end = it->first + (off_t)it->second.size();
+        return end >= offset ? (size_t)(offset - it->first) : 0;
+    }
+
+    // Merges [offset, offset + size) with the ranges it overlaps or touches, appending to the range before it
+    // so that a sequential scan copies each byte once
+    inline void insert(off_t offset, const uint8_t *data, size_t size) {
+        auto it = ranges_.upper_bound(offset);
+        if (it != ranges_.begin() && std::prev(it)->first + (off_t)std::prev(it)->second.size() >= offset) {
+            --it;
+        } else {
+            it = ranges_.emplace_hint(it, offset, std::vector<uint8_t>());
+        }
+        append(it->second, (size_t)(offset - it->first), data, size);
+        // Ranges the grown one now reaches are folded into it
+        auto next = std::next(it);
+        while (next != ranges_.end() && next->first <= it->first + (off_t)it->second.size()) {
+            append(it->second, (size_t)(next->first - it->first), next->second.data(), next->second.size());
+            next = ranges_.erase(next);
+        }
+    }
+
+private:
+    // Writes `size` bytes at `at`, growing `range` past its end if needed
+    static inline void append(std::vector<uint8_t> &range, size_t at, const uint8_t *data, size_t size) {
+        if (at + size > range.size()) {
+            range.resize(at + size);
+        }
+        memcpy(range.data() + at, data, size);
+    }
+
+    std::map<off_t, std::vector<uint8_t>> ranges_;
+};
+
+/**
+ * Parse with a reader whose size() and read(buf, offset, size) return awaitables, the caller is never blocked on I/O
+ *
+ * The detectors stay synchronous: each pass runs them over the ranges fetched so far, and the first read they make
+ * outside of those unwinds the pass. The II_ASYNC_FETCH_WINDOW aligned window around that read is awaited and the
+ * pass repeats. A miss right past a fetched range is a sequential scan (full verification, frame scans, skipping
+ * garbage), so it fetches as much again as that range holds: a scan of the whole file costs a logarithmic number of
+ * passes, and all passes together read about twice what a single one does. Arguments are taken by value because
+ * the task starts after the call returns, the reader has to outlive it.
+ */
+template <typename AsyncReaderType>
+AsyncTask<ImageInfo> parse_async(AsyncReaderType &reader,                     //
+                                 Format most_likely_format = kFormatUnknown,  //
+                                 std::vector<Format> likely_formats = {},     //
+                                 bool must_be_one_of_likely_formats = false,  //
+                                 ParseOptions options = ParseOptions()) {     //
+    struct ReadMiss {
+        off_t offset;
+        size_t size;
+    };
+    size_t length = co_await reader.size();
+    FetchedRanges fetched;
+    std::vector<uint8_t> buffer;
+    for (;;) {
+        ReadMiss miss{0, 0};
+        ReadFunc read_func = [&fetched](void *buf, off_t offset, size_t size) {
+            if (!fetched.read(buf, offset, size)) {
+                throw ReadMiss{offset, size};
+            }
+        };
+        try {
+            ReadInterface ri(read_func, length, options);
+            co_return parse(ri, most_likely_format, likely_formats, must_be_one_of_likely_formats);
+        } catch (const ReadMiss &e) {
+            miss = e;
+        }
+        const uint64_t window = II_ASYNC_FETCH_WINDOW;
+        uint64_t start = (uint64_t)miss.offset / window * window;
+        uint64_t end = ((uint64_t)miss.offset + miss.size + window - 1) / window * window;
+        end = (std::max)(end, start + fetched.run_before((off_t)start));
+        end = (std::min)(end, (uint64_t)length);
+        buffer.resize((size_t)(end - start));
+        co_await reader.read(buffer.data(), (off_t)start, buffer.size());
+        fetched.insert((off_t)start, buffer.data(), buffer.size());
+    }
+}
+
+/**
+ * Adapts a blocking reader for parse_async() by handing each call to an executor, e.g. a thread pool,
+ * the coroutine resumes on the thread that ran the call
+ */
+template <typename ReaderType>
+class ExecutorReader {
+public:
+    using Executor = std::function<void(std::function<void()>)>;
+
+    ExecutorReader(ReaderType &reader, Executor executor) : reader_(reader), executor_(std::move(executor)) {}
+
+    struct SizeAwaiter {
+        ExecutorReader *self;
+        size_t size = 0;
+
+        inline bool await_ready() const noexcept { return false; }
+
+        inline void await_suspend(std::coroutine_handle<> handle) {
+            self->executor_([this, handle] {
+                size = self->reader_.size();
+                handle.resume();
+            });
+        }
+
+        inline size_t await_resume() const noexcept { return size; }
+    };
+
+    struct ReadAwaiter {
+        ExecutorReader *self;
+        void *buf;
+        off_t offset;
+        size_t size;
+
+        inline bool await_ready() const noexcept { return false; }
+
+        inline void await_suspend(std::coroutine_handle<> handle) {
+            self->executor_([this, handle] {
+                self->reader_.read(buf, offset, size);
+                handle.resume();
+            });
+        }
+
+        inline void await_resume() const noexcept {}
+    };
+
+    inline SizeAwaiter size() { return SizeAwaiter{this}; }
+
+    inline ReadAwaiter read(void *buf, off_t offset, size_t size) { return ReadAwaiter{this, buf, offset, size}; }
+
+private:
+    ReaderType &reader_;
+    Executor executor_;
+};
+
+#endif  // II_COROUTINES
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum ArchiveFormat {
+    kArchiveUnknown = 0,
+    kArchiveTar,
+    kArchiveZip,
+};
+
+struct ArchiveMember {
+    std::string name;
+    // Range of the member's bytes in the archive, for compressed members the compressed bytes
+    off_t offset = 0;
+    size_t size = 0;
+    // False for deflated and encrypted zip members, which cannot be parsed in place
+    bool stored = true;
+};
+
+using ArchiveMembers = std::vector<ArchiveMember>;
+
+// Window of another reader, lets a member of an archive be read in place
+template <typename ReaderType>
+class SubRangeReader {
+public:
+    SubRangeReader(ReaderType &reader, off_t offset, size_t size) : reader_(reader), offset_(offset), size_(size) {}
+
+    inline size_t size() { return size_; }
+
+    inline void read(void *buf, off_t offset, size_t size) { reader_.read(buf, offset_ + offset, size); }
+
+private:
+    ReaderType &reader_;
+    off_t offset_;
+    size_t size_;
+};
+
+#ifndef II_ARCHIVE_MAX_NAME_SIZE
+#define II_ARCHIVE_MAX_NAME_SIZE (65536)
+#endif
+
+// Regular files of a ustar, GNU or pax tar, one 512 bytes read per member, directories and links are skipped
+bool list_tar_members(ReadFunc &read_func, size_t length, ArchiveMembers &members);
+
+// Files of a zip or zip64 from its central directory, plus one 30 bytes read of each local header for the data offset
+bool list_zip_members(ReadFunc &read_func, size_t length, ArchiveMembers &members);
+
+ArchiveFormat list_archive_members(ReadFunc &read_func, size_t length, ArchiveMembers &members);
+
+#ifndef II_LEAN_HEADER
+
+// Octal, or base-256 when the high bit of the first byte is set
+inline uint64_t tar_number(const uint8_t *field, size_t size) {
+    uint64_t value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < size; ++i) {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+    for (size_t i = 0; i < size && field[i] != 0 && field[i] != ' '; ++i) {
+        if (field[i] < '0' || field[i] > '7') {
+            return 0;
+        }
+        value = (value << 3) | (uint64_t)(field[i] - '0');
+    }
+    return value;
+}
+
+inline bool tar_checksum_ok(const uint8_t *header) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < 512; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    return sum == tar_number(header + 148, 8);
+}
+
+II_IMPL bool list_tar_members(ReadFunc &read_func, size_t length, ArchiveMembers &members) {
+    members.clear();
+    std::string long_name;
+    uint64_t pax_size = 0;
+    bool has_pax_size = false;
+    off_t offset = 0;
+    Buffer header(512);
+    while (offset + 512 <= (off_t)length) {
+        read_func(header.data(), offset, 512);
+        if (header[0] == 0) {
+            // End of archive
+            break;
+        }
+        if (!tar_checksum_ok(header.data())) {
+            return false;
+        }
+        uint64_t size = has_pax_size ? pax_size : tar_number(header.data() + 124, 12);
+        off_t data_offset = offset + 512;
+        if (size > length - (size_t)data_offset) {
+            return false;
+        }
+        char type = (char)header[156];
+        if (type == 'L' || type == 'x') {
+            if (size > II_ARCHIVE_MAX_NAME_SIZE) {
+                return false;
+            }
+            Buffer data((size_t)size);
+            read_func(data.data(), data_offset, (size_t)size);
+            if (type == 'L') {
+                long_name = std::string((const char *)data.data(), strnlen((const char *)data.data(), (size_t)size));
+            } else {
+                // Records are "<length> <key>=<value>\n"
+                std::string records = data.to_string();
+                size_t pos = 0;
+                while (pos < records.size()) {
+                    size_t space = records.find(' ', pos);
+                    if (space == std::string::npos) {
+                        break;
+                    }
+                    size_t record_size = strtoul(records.c_str() + pos, nullptr, 10);
+                    if (record_size <= space - pos || pos + record_size > records.size()) {
+                        break;
+                    }
+                    std::string record = records.substr(space + 1, pos + record_size - space - 2);
+                    if (record.compare(0, 5, "path=") == 0) {
+                        long_name = record.substr(5);
+                    } else if (record.compare(0, 5, "size=") == 0) {
+                        pax_size = strtoull(record.c_str() + 5, nullptr, 10);
+                        has_pax_size = true;
+                    }
+                    pos += record_size;
+                }
+            }
+        } else {
+            if (type == '0' || type == '\0' || type == '7') {
+                ArchiveMember member;
+                if (!long_name.empty()) {
+                    member.name = long_name;
+                } else {
+                    member.name = std::string((const char *)header.data(), strnlen((const char *)header.data(), 100));
+                    // POSIX ustar splits long names into a prefix, GNU tar uses the same bytes for other fields
+                    if (header.cmp(257, 6, "ustar\0") && header[345] != 0) {
+                        const char *prefix = (const char *)header.data() + 345;
+                        member.name = std::string(prefix, strnlen(prefix, 155)) + "/" + member.name;
+                    }
+                }
+                member.offset = data_offset;
+                member.size = (size_t)size;
+                members.push_back(member);
+            }
+            long_name.clear();
+            has_pax_size = false;
+        }
+        offset = data_offset + (off_t)((size + 511) / 512 * 512);
+    }
+    return true;
+}
+
+II_IMPL bool list_zip_members(ReadFunc &read_func, size_t length, ArchiveMembers &members) {
+    members.clear();
+    // The end of central directory record is 22 bytes plus a comment of up to 65535 bytes
+    if (length < 22) {
+        return false;
+    }
+    size_t tail_size = (std::min)(length, (size_t)(22 + 65535));
+    off_t tail_offset = (off_t)(length - tail_size);
+    Buffer tail(tail_size);
+    read_func(tail.data(), tail_offset, tail_size);
+    off_t eocd = -1;
+    for (off_t i = (off_t)tail_size - 22; i >= 0; --i) {
+        if (tail.cmp(i, 4, "PK\x05\x06")) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) {
+        return false;
+    }
+    uint64_t entry_count = tail.read_u16_le(eocd + 10);
+    uint64_t directory_size = tail.read_u32_le(eocd + 12);
+    uint64_t directory_offset = tail.read_u32_le(eocd + 16);
+    if (eocd >= 20 && tail.cmp(eocd - 20, 4, "PK\x06\x07")) {
+        uint64_t zip64_eocd = tail.read_u64_le(eocd - 20 + 8);
+        if (length < 56 || zip64_eocd > length - 56) {
+            return false;
+        }
+        Buffer record(56);
+        read_func(record.data(), (off_t)zip64_eocd, 56);
+        if (!record.cmp(0, 4, "PK\x06\x06")) {
+            return false;
+        }
+        entry_count = record.read_u64_le(32);
+        directory_size = record.read_u64_le(40);
+        directory_offset = record.read_u64_le(48);
+    }
+    if (directory_offset > length || directory_size > length - directory_offset) {
+        return false;
+    }
+    Buffer directory((size_t)directory_size);
+    read_func(directory.data(), (off_t)directory_offset, (size_t)directory_size);
+    off_t pos = 0;
+    for (uint64_t i = 0; i < entry_count; ++i) {
+        if (pos + 46 > (off_t)directory_size || !directory.cmp(pos, 4, "PK\x01\x02")) {
+            return false;
+        }
+        uint16_t flags = directory.read_u16_le(pos + 8);
+        uint16_t method = directory.read_u16_le(pos + 10);
+        uint64_t compressed_size = directory.read_u32_le(pos + 20);
+        uint64_t uncompressed_size = directory.read_u32_le(pos + 24);
+        uint16_t name_size = directory.read_u16_le(pos + 28);
+        uint16_t extra_size = directory.read_u16_le(pos + 30);
+        uint16_t comment_size = directory.read_u16_le(pos + 32);
+        uint64_t local_offset = directory.read_u32_le(pos + 42);
+        off_t next = pos + 46 + name_size + extra_size + comment_size;
+        if (next > (off_t)directory_size) {
+            return false;
+        }
+        // Zip64 extended information holds the fields saturated at 0xFFFFFFFF, in this order
+        for (off_t extra = pos + 46 + name_size; extra + 4 <= pos + 46 + name_size + extra_size;) {
+            uint16_t id = directory.read_u16_le(extra);
+            uint16_t size = directory.read_u16_le(extra + 2);
+            if (id == 0x0001) {
+                off_t field = extra + 4;
+                off_t end = (std::min)(field + size, pos + 46 + name_size + extra_size);
+                for (uint64_t *value : {&uncompressed_size, &compressed_size, &local_offset}) {
+                    if (*value == 0xFFFFFFFF && field + 8 <= end) {
+                        *value = directory.read_u64_le(field);
+                        field += 8;
+                    }
+                }
+            }
+            extra += 4 + size;
+        }
+        ArchiveMember member;
+        member.name = directory.read_string(pos + 46, name_size);
+        pos = next;
+        if (member.name.empty() || member.name.back() == '/') {
+            continue;
+        }
+        if (length < 30 || local_offset > length - 30) {
+            return false;
+        }
+        Buffer local(30);
+        read_func(local.data(), (off_t)local_offset, 30);
+        if (!local.cmp(0, 4, "PK\x03\x04")) {
+            return false;
+        }
+        uint64_t data_offset = local_offset + 30 + local.read_u16_le(26) + local.read_u16_le(28);
+        if (data_offset > length || compressed_size > length - data_offset) {
+            return false;
+        }
+        member.offset = (off_t)data_offset;
+        member.size = (size_t)compressed_size;
+        member.stored = method == 0 && (flags & 0x0001) == 0 && compressed_size == uncompressed_size;
+        members.push_back(member);
+    }
+    return true;
+}
+
+II_IMPL ArchiveFormat list_archive_members(ReadFunc &read_func, size_t length, ArchiveMembers &members) {
+    if (length >= 512) {
+        Buffer header(512);
+        read_func(header.data(), 0, 512);
+        if (header.cmp(257, 5, "ustar") || (header[0] != 0 && tar_checksum_ok(header.data()))) {
+            return list_tar_members(read_func, length, members) ? kArchiveTar : kArchiveUnknown;
+        }
+    }
+    return list_zip_members(read_func, length, members) ? kArchiveZip : kArchiveUnknown;
+}
+
+#endif
+
+template <typename ReaderType>
+inline ArchiveFormat list_archive_members(ReaderType &reader, ArchiveMembers &members) {
+    ReadFunc read_func = [&reader](void *buf, off_t offset, size_t size) { reader.read(buf, offset, size); };
+    return list_archive_members(read_func, reader.size(), members);
+}
+
+// Parse a member in place, `reader` is the archive's
+template <typename ReaderType>
+inline ImageInfo parse_member(ReaderType &reader,                               //
+                              const ArchiveMember &member,                      //
+                              const ParseOptions &options = ParseOptions()) {  //
+    if (!member.stored) {
+        return ImageInfo(kUnsupportedMember);
+    }
+    SubRangeReader<ReaderType> sub_reader(reader, member.offset, member.size);
+    ReadFunc read_func = [&sub_reader](void *buf, off_t offset, size_t size) { sub_reader.read(buf, offset, size); };
+    ReadInterface ri(read_func, sub_reader.size(), options);
+    return parse(ri);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// One piece of a stripped file, a range of the input, or literal bytes when `bytes` is not empty
+struct StripSegment {
+    off_t offset = 0;
+    size_t length = 0;
+    std::string bytes;
+};
+
+using StripPlan = std::vector<StripSegment>;
+
+/**
+ * Ranges of a JPEG, PNG or WebP to keep for a copy without EXIF, XMP and text metadata, nothing is decoded
+ *
+ * JPEG: APP1 (EXIF, XMP), APP13 (Photoshop, IPTC) and COM segments before SOS are dropped.
+ * PNG: eXIf, tEXt, zTXt and iTXt chunks are dropped, the output ends with IEND.
+ * WebP: EXIF and XMP chunks are dropped, the output ends with the RIFF chunk, and the RIFF size and VP8X flags
+ * are rewritten as a 21 bytes literal segment.
+ * ICC profiles are kept. One header read per segment or chunk, false for other formats and broken structures,
+ * garbage between JPEG segments is skipped up to the next marker.
+ */
+bool plan_strip_metadata(ReadFunc &read_func, size_t length, StripPlan &plan);
+
+#ifndef II_LEAN_HEADER
+
+// Appends a range, merged with the previous one when they touch
+inline void strip_plan_keep(StripPlan &plan, uint64_t offset, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (!plan.empty() && plan.back().bytes.empty() && (uint64_t)plan.back().offset + plan.back().length == offset) {
+        plan.back().length += (size_t)length;
+        return;
+    }
+    StripSegment segment;
+    segment.offset = (off_t)offset;
+    segment.length = (size_t)length;
+    plan.push_back(segment);
+}
+
+inline bool strip_plan_jpeg(ReadInterface &ri, size_t length, StripPlan &plan) {
+    uint64_t offset = 2;
+    uint64_t kept = 0;
+    while (true) {
+        if (offset + 2 > length) {
+            return false;
+        }
+        // marker(2), length(2)
+        auto buffer = ri.read_buffer((off_t)offset, (size_t)(std::min)((uint64_t)4, length - offset));
+        if (buffer[0] != 0xFF) {
+            // Garbage, e.g. after a segment length one byte short: resync on the next 0xFF a window at a time,
+            // as try_jpg and decoders do. Garbage right after a dropped segment is dropped with it
+            uint64_t start = offset;
+            auto window = ri.read_buffer((off_t)offset,
+                                         (size_t)(std::min)((uint64_t)II_JPEG_GARBAGE_WINDOW, length - offset));
+            auto *ff = (const uint8_t *)memchr(window.data(), 0xFF, window.size());
+            offset += ff != nullptr ? (uint64_t)(ff - window.data()) : window.size();
+            if (kept == start) {
+                kept = offset;
+            }
+            continue;
+        }
+        uint8_t marker = buffer[1];
+        if (marker == 0xFF) {  // Fill byte
+            offset += 1;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {  // TEM, RSTn and SOI carry no length
+            offset += 2;
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) {  // Entropy coded data and everything after it is kept as is
+            break;
+        }
+        if (buffer.size() < 4) {
+            return false;
+        }
+        uint16_t section_size = buffer.read_u16_be(2);
+        if (section_size < 2 || section_size > length - offset - 2) {
+            return false;
+        }
+        if (marker == 0xE1 || marker == 0xED || marker == 0xFE) {
+            strip_plan_keep(plan, kept, offset - kept);
+            kept = offset + 2 + section_size;
+        }
+        offset += 2 + section_size;
+    }
+    strip_plan_keep(plan, kept, length - kept);
+    return true;
+}
+
+inline bool strip_plan_png(ReadInterface &ri, size_t length, StripPlan &plan) {
+    uint64_t offset = 8;
+    uint64_t kept = 0;
+    while (offset + 12 <= length) {
+        auto chunk = ri.read_buffer((off_t)offset, 8);
+        uint32_t size = chunk.read_u32_be(0);
+        if (size > length - offset - 12) {
+            return false;
+        }
+        uint64_t next = offset + 12 + size;
+        if (chunk.cmp(4, 4, "IEND")) {
+            strip_plan_keep(plan, kept, next - kept);
+            return true;
+        }
+        if (chunk.cmp_any_of(4, 4, {"eXIf", "tEXt", "zTXt", "iTXt"})) {
+            strip_plan_keep(plan, kept, offset - kept);
+            kept = next;
+        }
+        offset = next;
+    }
+    return false;
+}
+
+inline bool strip_plan_webp(ReadInterface &ri, size_t length, StripPlan &plan) {
+    auto header = ri.read_buffer(0, 30);
+    uint64_t end = (std::min)((uint64_t)length, 8 + (uint64_t)header.read_u32_le(4));
+    if (!header.cmp(12, 4, "VP8X")) {  // Simple formats have no metadata chunks
+        strip_plan_keep(plan, 0, end);
+        return true;
+    }
+    if (end < 30) {
+        return false;
+    }
+    // The VP8X flags byte is rewritten, kept ranges start right after it
+    uint64_t offset = 12;
+    uint64_t kept = 21;
+    uint64_t dropped = 0;
+    while (offset + 8 <= end) {
+        auto chunk = ri.read_buffer((off_t)offset, 8);
+        uint32_t size = chunk.read_u32_le(4);
+        if (size > end - offset - 8) {
+            return false;
+        }
+        uint64_t next = (std::min)(offset + 8 + size + (size & 1), end);
+        if (chunk.cmp_any_of(0, 4, {"EXIF", "XMP "})) {
+            strip_plan_keep(plan, kept, offset - kept);
+            kept = next;
+            dropped += next - offset;
+        }
+        offset = next;
+    }
+    strip_plan_keep(plan, kept, end - kept);
+    if (dropped == 0) {
+        plan.clear();
+        strip_plan_keep(plan, 0, end);
+        return true;
+    }
+    // The RIFF size shrinks by the dropped chunks, and the VP8X flags lose EXIF 0x08 and XMP 0x04
+    StripSegment literal;
+    literal.bytes.assign((const char *)header.data(), 21);
+    uint32_t riff_size = (uint32_t)(end - 8 - dropped);
+    for (int i = 0; i < 4; ++i) {
+        literal.bytes[4 + i] = (char)(uint8_t)(riff_size >> (i * 8));
+    }
+    literal.bytes[20] = (char)(header[20] & ~0x0C);
+    literal.length = literal.bytes.size();
+    plan.insert(plan.begin(), literal);
+    return true;
+}
+
+II_IMPL bool plan_strip_metadata(ReadFunc &read_func, size_t length, StripPlan &plan) {
+    plan.clear();
+    ReadInterface ri(read_func, length);
+    if (length >= 4 && ri.read_buffer(0, 3).cmp(0, 3, "\xFF\xD8\xFF")) {
+        return strip_plan_jpeg(ri, length, plan);
+    }
+    if (length >= 8 && ri.read_buffer(0, 8).cmp(0, 8, "\x89PNG\r\n\x1a\n")) {
+        return strip_plan_png(ri, length, plan);
+    }
+    if (length >= 30) {
+        auto buffer = ri.read_buffer(0, 12);
+        if (buffer.cmp(0, 4, "RIFF") && buffer.cmp(8, 4, "WEBP")) {
+            return strip_plan_webp(ri, length, plan);
+        }
+    }
+    return false;
+}
+
+#endif
+
+template <typename ReaderType>
+inline bool plan_strip_metadata(ReaderType &reader, StripPlan &plan) {
+    ReadFunc read_func = [&reader](void *buf, off_t offset, size_t size) { reader.read(buf, offset, size); };
+    return plan_strip_metadata(read_func, reader.size(), plan);
+}
+
+#ifdef II_POSIX
+
+/**
+ * Write the stripped copy of `in_fd` to the current position of `out_fd`
+ *
+ * Kept ranges are copied by the kernel with copy_file_range, or sendfile where the file systems differ or
+ * the output is a pipe or a socket, and with pread and write elsewhere.
+ */
+bool strip_metadata(int in_fd, int out_fd);
+
+#ifndef II_LEAN_HEADER
+
+inline bool write_all(int fd, const void *buf, size_t size) {
+    auto *p = (const uint8_t *)buf;
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+inline bool copy_fd_range(int in_fd, int out_fd, off_t offset, size_t length) {
+#ifdef __linux__
+    bool use_copy_file_range = true;
+    bool use_sendfile = true;
+#endif
+    std::vector<uint8_t> buf;
+    while (length > 0) {
+        ssize_t n = -1;
+#ifdef __linux__
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+        if (use_copy_file_range) {
+            loff_t in_offset = offset;
+            n = ::copy_file_range(in_fd, &in_offset, out_fd, nullptr, length, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            use_copy_file_range = n > 0;
+        }
+#endif
+        if (n <= 0 && use_sendfile) {
+            off_t in_offset = offset;
+            n = ::sendfile(out_fd, in_fd, &in_offset, length);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            use_sendfile = n > 0;
+        }
+#endif
+        if (n <= 0) {
+            buf.resize((std::min)(length, (size_t)(1 << 20)));
+            n = ::pread(in_fd, buf.data(), buf.size(), offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0 || !write_all(out_fd, buf.data(), (size_t)n)) {
+                return false;
+            }
+        }
+        offset += (off_t)n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+II_IMPL bool strip_metadata(int in_fd, int out_fd) {
+    FileDescriptorReader reader(in_fd);
+    StripPlan plan;
+    if (!plan_strip_metadata(reader, plan)) {
+        return false;
+    }
+    for (const auto &segment : plan) {
+        bool ok = segment.bytes.empty() ? copy_fd_range(in_fd, out_fd, segment.offset, segment.length)
+                                        : write_all(out_fd, segment.bytes.data(), segment.bytes.size());
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
+
+#endif  // II_POSIX
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef II_POSIX
+
+// Bump this whenever detector output or the slot layout changes, old caches are discarded on open
+#define II_RESULT_CACHE_VERSION (6)
+
+#ifndef II_RESULT_CACHE_MAX_ENTRIES
+#define II_RESULT_CACHE_MAX_ENTRIES (24)
+#endif
+
+struct ResultCacheKey {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    uint64_t mtime_ns = 0;
+    uint32_t version = II_RESULT_CACHE_VERSION;
+
+    inline bool operator==(const ResultCacheKey &rhs) const {
+        return device == rhs.device && inode == rhs.inode && size == rhs.size && mtime_ns == rhs.mtime_ns &&
+               version == rhs.version;
+    }
+};
+
+// Only stat the file, never open it
+inline bool make_result_cache_key(const std::string &path, ResultCacheKey &key) {
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    key.device = (uint64_t)st.st_dev;
+    key.inode = (uint64_t)st.st_ino;
+    key.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    key.mtime_ns = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ull + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+    key.mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+/**
+ * Persistent on-disk cache of parse results, shared by any number of processes
+ *
+ * The file is a memory-mapped open-addressing hash table of fixed-size slots, keyed by
+ * (device, inode, size, mtime_ns, version). Failed parses are cached as well.
+ * Lookups take a shared flock and stores take an exclusive one, so concurrent readers and writers never
+ * observe a half-written slot. Results with more than II_RESULT_CACHE_MAX_ENTRIES entry sizes are not cached.
+ */
+class ResultCache {
+public:
+    static constexpr size_t kDefaultSlotCount = 1 << 20;
+    static constexpr size_t kMaxProbe = 8;
+
+    ResultCache() = default;
+
+    ResultCache(const ResultCache &) = delete;
+
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    ~ResultCache() { close(); }
+
+    inline bool open(const std::string &path, size_t slot_count = kDefaultSlotCount) {
+        close();
+        if (slot_count == 0) {
+            return false;
+        }
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        if (::flock(fd_, LOCK_EX) != 0) {
+            close();
+            return false;
+        }
+        bool ok = init_locked(slot_count);
+        ::flock(fd_, LOCK_UN);
+        if (!ok) {
+            close();
+        }
+        return ok;
+    }
+
+    inline void close() {
+        if (map_ != nullptr) {
+            ::munmap(map_, map_size_);
+            map_ = nullptr;
+            map_size_ = 0;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        slot_count_ = 0;
+    }
+
+    inline bool is_open() const { return map_ != nullptr; }
+
+    inline bool lookup(const ResultCacheKey &key, ImageInfo &info) {
+        if (!is_open()) {
+            return false;
+        }
+        bool found = false;
+        ::flock(fd_, LOCK_SH);
+        if (header_valid()) {
+            size_t home = slot_index(key);
+            for (size_t i = 0; i < kMaxProbe; ++i) {
+                const Slot &slot = slots()[(home + i) % slot_count_];
+                if (slot.version == 0) {
+                    break;
+                }
+                if (slot_key(slot) == key) {
+                    info = slot_to_info(slot);
+                    found = true;
+                    break;
+                }
+            }
+        }
+        ::flock(fd_, LOCK_UN);
+        found ? ++hits_ : ++misses_;
+        return found;
+    }
+
+    inline bool store(const ResultCacheKey &key, const ImageInfo &info) {
+        if (!is_open()) {
+            return false;
+        }
+        Slot slot{};
+        if (!info_to_slot(key, info, slot)) {
+            return false;
+        }
+        bool stored = false;
+        ::flock(fd_, LOCK_EX);
+        if (header_valid()) {
+            // Reuse an empty slot or one holding an older version of the same file, otherwise evict the home slot
+            size_t home = slot_index(key);
+            size_t target = home;
+            for (size_t i = 0; i < kMaxProbe; ++i) {
+                size_t index = (home + i) % slot_count_;
+                const Slot &s = slots()[index];
+                if (s.version == 0 || (s.device == key.device && s.inode == key.inode)) {
+                    target = index;
+                    break;
+                }
+            }
+            slots()[target] = slot;
+            stored = true;
+        }
+        ::flock(fd_, LOCK_UN);
+        return stored;
+    }
+
+    inline uint64_t hits() const { return hits_; }
+
+    inline uint64_t misses() const { return misses_; }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t slot_size;
+        uint64_t slot_count;
+        uint32_t library_version;
+        uint8_t reserved[36];
+    };
+
+    struct Slot {
+        uint32_t version;  // 0 means empty, keep it as the first field across layout changes
+        uint8_t error;
+        uint8_t format;
+        uint16_t entry_count;
+        uint8_t bit_depth;  // 0 means unknown
+        uint8_t channels;   // 0 means unknown
+        uint8_t has_alpha;
+        uint8_t orientation;
+        int32_t frame_count;
+        uint16_t level_count;  // levels follow the entry sizes in `entries`
+        uint8_t progressive;
+        uint8_t chroma_subsampling;  // x << 4 | y
+        uint32_t level_layers;
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        uint64_t mtime_ns;
+        int64_t width;
+        int64_t height;
+        uint32_t entries[II_RESULT_CACHE_MAX_ENTRIES][2];
+    };
+
+    static_assert(sizeof(Header) == 64, "sizeof(ResultCache::Header) != 64");
+
+    inline bool init_locked(size_t slot_count) {
+        struct stat st {};
+        if (::fstat(fd_, &st) != 0) {
+            return false;
+        }
+        Header header{};
+        bool valid = (size_t)st.st_size >= sizeof(Header) &&
+                     ::pread(fd_, &header, sizeof(Header), 0) == (ssize_t)sizeof(Header) && header_matches(header) &&
+                     (size_t)st.st_size == sizeof(Header) + header.slot_count * sizeof(Slot);
+        if (valid) {
+            // Adopt the existing table size, other processes may already have it mapped
+            slot_count = header.slot_count;
+        } else {
+            memset(&header, 0, sizeof(Header));
+            memcpy(header.magic, "IIRCACHE", 8);
+            header.version = II_RESULT_CACHE_VERSION;
+            header.library_version = IMAGEINFO_VERSION;
+            header.slot_size = sizeof(Slot);
+            header.slot_count = slot_count;
+            auto file_size = (off_t)(sizeof(Header) + slot_count * sizeof(Slot));
+            if (::ftruncate(fd_, 0) != 0 || ::ftruncate(fd_, file_size) != 0 ||
+                ::pwrite(fd_, &header, sizeof(Header), 0) != (ssize_t)sizeof(Header)) {
+                return false;
+            }
+        }
+        map_size_ = sizeof(Header) + slot_count * sizeof(Slot);
+        void *map = ::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            map_size_ = 0;
+            return false;
+        }
+        map_ = (uint8_t *)map;
+        slot_count_ = slot_count;
+        return true;
+    }
+
+    static inline bool header_matches(const Header &header) {
+        return memcmp(header.magic, "IIRCACHE", 8) == 0 && header.version == II_RESULT_CACHE_VERSION &&
+               header.library_version == IMAGEINFO_VERSION && header.slot_size == sizeof(Slot) &&
+               header.slot_count != 0;
+    }
+
+    // Another process may have reinitialized the file since we mapped it
+    inline bool header_valid() const {
+        const Header &header = *(const Header *)map_;
+        return header_matches(header) && header.slot_count == slot_count_;
+    }
+
+    inline Slot *slots() const { return (Slot *)(map_ + sizeof(Header)); }
+
+    inline size_t slot_index(const ResultCacheKey &key) const {
+        return (size_t)(hash_mix(key.device * 0x9E3779B97F4A7C15ull ^ key.inode) % slot_count_);
+    }
+
+    static inline ResultCacheKey slot_key(const Slot &slot) {
+        ResultCacheKey key;
+        key.device = slot.device;
+        key.inode = slot.inode;
+        key.size = slot.size;
+        key.mtime_ns = slot.mtime_ns;
+        key.version = slot.version;
+        return key;
+    }
+
+    static inline bool info_to_slot(const ResultCacheKey &key, const ImageInfo &info, Slot &slot) {
+        const auto &entry_sizes = info.entry_sizes();
+        const auto &levels = info.levels();
+        if (entry_sizes.size() + levels.size() > II_RESULT_CACHE_MAX_ENTRIES) {
+            return false;
+        }
+        slot.level_count = (uint16_t)levels.size();
+        slot.level_layers = levels.empty() ? 1 : levels[0].layers;
+        EntrySizes sizes = entry_sizes;
+        for (const auto &level : levels) {
+            if (level.layers != slot.level_layers) {
+                return false;
+            }
+            sizes.push_back(level.size);
+        }
+        slot.version = key.version;
+        slot.error = (uint8_t)info.error();
+        slot.format = (uint8_t)info.format();
+        slot.entry_count = (uint16_t)entry_sizes.size();
+        slot.bit_depth = (uint8_t)(info.bit_depth() > 0 && info.bit_depth() <= 255 ? info.bit_depth() : 0);
+        slot.channels = (uint8_t)(info.channels() > 0 && info.channels() <= 255 ? info.channels() : 0);
+        slot.has_alpha = info.has_alpha() ? 1 : 0;
+        slot.orientation = (uint8_t)info.orientation();
+        slot.progressive = info.progressive() ? 1 : 0;
+        slot.chroma_subsampling =
+            (uint8_t)((info.chroma_subsampling().width & 0x0F) << 4 | (info.chroma_subsampling().height & 0x0F));
+        slot.frame_count = (int32_t)(std::min)(info.frame_count(), (int64_t)std::numeric_limits<int32_t>::max());
+        slot.device = key.device;
+        slot.inode = key.inode;
+        slot.size = key.size;
+        slot.mtime_ns = key.mtime_ns;
+        slot.width = info.size().width;
+        slot.height = info.size().height;
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            const auto &size = sizes[i];
+            if (size.width < 0 || size.height < 0 || size.width > std::numeric_limits<uint32_t>::max() ||
+                size.height > std::numeric_limits<uint32_t>::max()) {
+                return false;
+            }
+            slot.entries[i][0] = (uint32_t)size.width;
+            slot.entries[i][1] = (uint32_t)size.height;
+        }
+        return true;
+    }
+
+    static inline ImageInfo slot_to_info(const Slot &slot) {
+        if (slot.error != kNoError) {
+            return ImageInfo((Error)slot.error);
+        }
+        auto format = slot.format < FORMAT_END ? (Format)slot.format : kFormatUnknown;
+        ImageInfo info(format);
+        info.set_size(slot.width, slot.height);
+        info.set_pixel_format(slot.bit_depth != 0 ? slot.bit_depth : -1, slot.channels != 0 ? slot.channels : -1,
+                              slot.has_alpha != 0);
+        info.set_orientation(slot.orientation);
+        info.set_progressive(slot.progressive != 0);
+        info.set_chroma_subsampling(slot.chroma_subsampling >> 4, slot.chroma_subsampling & 0x0F);
+        info.set_frame_count(slot.frame_count);
+        for (uint16_t i = 0; i < slot.entry_count && i < II_RESULT_CACHE_MAX_ENTRIES; ++i) {
+            info.add_entry_size(slot.entries[i][0], slot.entries[i][1]);
+        }
+        for (size_t i = slot.entry_count; i < (size_t)slot.entry_count + slot.level_count; ++i) {
+            if (i < II_RESULT_CACHE_MAX_ENTRIES) {
+                info.add_level(ImageLevel(slot.entries[i][0], slot.entries[i][1], slot.level_layers));
+            }
+        }
+        return info;
+    }
+
+private:
+    int fd_ = -1;
+    uint8_t *map_ = nullptr;
+    size_t map_size_ = 0;
+    size_t slot_count_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+/**
+ * Parse a file through a ResultCache, a hit costs a single stat and never opens the file.
+ * Format hints only affect detection speed, so they are not part of the key.
+ */
+inline ImageInfo parse_cached(ResultCache &cache,                               //
+                              const std::string &path,                          //
+                              Format most_likely_format = kFormatUnknown,       //
+                              const std::vector<Format> &likely_formats = {}) {  //
+    ResultCacheKey key;
+    if (!make_result_cache_key(path, key)) {
+        return parse<FilePathReader>(path, most_likely_format, likely_formats);
+    }
+    ImageInfo info;
+    if (cache.lookup(key, info)) {
+        return info;
+    }
+    // A file that can't be opened is not stored, it may become readable without its key changing
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ImageInfo(kUnrecognizedFormat);
+    }
+    info = parse<FileDescriptorReader>(fd, most_likely_format, likely_formats);
+    ::close(fd);
+    cache.store(key, info);
+    return info;
+}
+
+#endif  // II_POSIX
+
 }  // namespace imageinfo
 
 #ifdef __clang__
@@ -0,0 +1,4 @@
+// Compiled mode: the detectors and the parse core are built once here, users of the imageinfo_static
+// target see the lean header, see the top of imageinfo.hpp
+#define IMAGEINFO_IMPLEMENTATION
+#include "imageinfo.hpp"
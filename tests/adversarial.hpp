@@ -0,0 +1,202 @@
+//
+// Worst-case inputs for the detectors, each with the reader calls and bytes a parse may cost
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace adversarial {
+
+struct Input {
+    std::string name;
+    std::vector<uint8_t> data;
+    // Calls of the read function and bytes they may ask for, the header cache fill included
+    size_t max_reads;
+    size_t max_bytes;
+};
+
+inline void put_u16_be(std::vector<uint8_t> &out, uint16_t v) {
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+inline void put_u32_be(std::vector<uint8_t> &out, uint32_t v) {
+    put_u16_be(out, (uint16_t)(v >> 16));
+    put_u16_be(out, (uint16_t)v);
+}
+
+inline void put_u16_le(std::vector<uint8_t> &out, uint16_t v) {
+    out.push_back((uint8_t)v);
+    out.push_back((uint8_t)(v >> 8));
+}
+
+inline void put_u32_le(std::vector<uint8_t> &out, uint32_t v) {
+    put_u16_le(out, (uint16_t)v);
+    put_u16_le(out, (uint16_t)(v >> 16));
+}
+
+inline void put_u64_le(std::vector<uint8_t> &out, uint64_t v) {
+    put_u32_le(out, (uint32_t)v);
+    put_u32_le(out, (uint32_t)(v >> 32));
+}
+
+inline void put_str(std::vector<uint8_t> &out, const char *s) {
+    for (; *s != '\0'; ++s) {
+        out.push_back((uint8_t)*s);
+    }
+}
+
+// SOI, then `segments` APP0 segments, then a 16x16 SOF0 if `sof`, then EOI
+inline std::vector<uint8_t> jpeg_app_segments(size_t segments, bool sof) {
+    std::vector<uint8_t> out{0xFF, 0xD8};
+    for (size_t i = 0; i < segments; ++i) {
+        out.push_back(0xFF);
+        // APP0 to APP15 but APP1, which would be parsed for EXIF
+        out.push_back((uint8_t)(i % 16 == 1 ? 0xE0 : 0xE0 + i % 16));
+        put_u16_be(out, 16);
+        out.resize(out.size() + 14);
+    }
+    if (sof) {
+        static const uint8_t sof0[] = {0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x10, 0x00, 0x10, 0x03,
+                                       0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01};
+        out.insert(out.end(), sof0, sof0 + sizeof(sof0));
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+    return out;
+}
+
+// SOI, `size` bytes of garbage between segments, then a 16x16 SOF0
+inline std::vector<uint8_t> jpeg_garbage(size_t size) {
+    std::vector<uint8_t> out{0xFF, 0xD8};
+    out.resize(out.size() + size, 0x00);
+    auto tail = jpeg_app_segments(0, true);
+    out.insert(out.end(), tail.begin() + 2, tail.end());
+    return out;
+}
+
+// BigTIFF whose first IFD claims 2^63 - 1 entries: 64x64, then `padding` entries that are never sorted past 338
+inline std::vector<uint8_t> bigtiff_num_entry(size_t padding) {
+    std::vector<uint8_t> out;
+    put_str(out, "II");
+    put_u16_le(out, 0x2B);
+    put_u16_le(out, 8);
+    put_u16_le(out, 0);
+    put_u64_le(out, 16);
+    put_u64_le(out, 0x7FFFFFFFFFFFFFFFull);
+    for (uint16_t tag : {256, 257}) {
+        put_u16_le(out, tag);
+        put_u16_le(out, 16);  // LONG8
+        put_u64_le(out, 1);
+        put_u64_le(out, 64);
+    }
+    out.resize(out.size() + padding * 20);
+    return out;
+}
+
+// icns with `chunks` empty is32 chunks, or one chunk of size 0 that never advances
+inline std::vector<uint8_t> icns_chunks(size_t chunks, uint32_t chunk_size = 8) {
+    std::vector<uint8_t> out;
+    put_str(out, "icns");
+    put_u32_be(out, (uint32_t)(8 + chunks * 8));
+    for (size_t i = 0; i < chunks; ++i) {
+        put_str(out, "is32");
+        put_u32_be(out, chunk_size);
+    }
+    return out;
+}
+
+// ICO directory of 65535 entries, all 256x256 and empty
+inline std::vector<uint8_t> ico_entries() {
+    std::vector<uint8_t> out{0x00, 0x00, 0x01, 0x00};
+    put_u16_le(out, 0xFFFF);
+    out.resize(out.size() + 0xFFFF * 16, 0x00);
+    return out;
+}
+
+// Radiance HDR with `size` bytes of comment lines before the 8x8 resolution string
+inline std::vector<uint8_t> hdr_comments(size_t size) {
+    std::vector<uint8_t> out;
+    put_str(out, "#?RADIANCE\n");
+    std::string line = "# " + std::string(61, 'c') + "\n";
+    while (out.size() < size) {
+        put_str(out, line.c_str());
+    }
+    put_str(out, "FORMAT=32-bit_rle_rgbe\n\n-Y 8 +X 8\n");
+    return out;
+}
+
+// AVIF whose ipma associates `items` items with 8 properties each, the primary item is 64x64
+inline std::vector<uint8_t> avif_ipma(uint16_t items) {
+    std::vector<uint8_t> ispe;
+    put_u32_be(ispe, 20);
+    put_str(ispe, "ispe");
+    put_u32_be(ispe, 0);
+    put_u32_be(ispe, 64);
+    put_u32_be(ispe, 64);
+    std::vector<uint8_t> ipma;
+    put_u32_be(ipma, (uint32_t)(16 + (size_t)items * 11));
+    put_str(ipma, "ipma");
+    put_u32_be(ipma, 0);
+    put_u32_be(ipma, items);
+    for (uint32_t item = 1; item <= items; ++item) {
+        put_u16_be(ipma, (uint16_t)item);
+        ipma.push_back(8);
+        for (uint8_t index = 1; index <= 8; ++index) {
+            ipma.push_back(index);
+        }
+    }
+    std::vector<uint8_t> out;
+    put_u32_be(out, 24);
+    put_str(out, "ftypavif");
+    put_u32_be(out, 0);
+    put_str(out, "avifmif1");
+    size_t meta_size = 12 + 14 + 8 + 8 + ispe.size() + ipma.size();
+    put_u32_be(out, (uint32_t)meta_size);
+    put_str(out, "meta");
+    put_u32_be(out, 0);
+    put_u32_be(out, 14);
+    put_str(out, "pitm");
+    put_u32_be(out, 0);
+    put_u16_be(out, 1);
+    put_u32_be(out, (uint32_t)(8 + 8 + ispe.size() + ipma.size()));
+    put_str(out, "iprp");
+    put_u32_be(out, (uint32_t)(8 + ispe.size()));
+    put_str(out, "ipco");
+    out.insert(out.end(), ispe.begin(), ispe.end());
+    out.insert(out.end(), ipma.begin(), ipma.end());
+    // meta is read along with the 12 bytes following it
+    put_u32_be(out, 16);
+    put_str(out, "mdat");
+    out.resize(out.size() + 8);
+    return out;
+}
+
+inline std::vector<Input> inputs() {
+    std::vector<Input> list;
+    auto add = [&list](const char *name, std::vector<uint8_t> data, size_t max_reads, size_t max_bytes) {
+        list.push_back(Input{name, std::move(data), max_reads, max_bytes});
+    };
+    // One read per segment past the header cache, none of the other detectors gets far
+    add("jpeg_app_segments.jpg", jpeg_app_segments(4000, true), 4000, 4000 * 22 + 1024);
+    add("jpeg_no_sof.jpg", jpeg_app_segments(4000, false), 4064, 4064 * 22 + 1024);
+    // Garbage is skipped a window at a time, not a byte at a time
+    add("jpeg_garbage.jpg", jpeg_garbage(1 << 20), 1024, (1 << 20) * 2);
+    // Entries are read in batches of II_TIFF_ENTRY_BATCH up to the end of the file
+    add("bigtiff_num_entry.tif", bigtiff_num_entry(4096), 4096 / 32 + 16, 4098 * 20 + 4096);
+    add("icns_chunks.icns", icns_chunks(4000), 4000, 4000 * 8 + 1024);
+    add("icns_zero_chunk.icns", icns_chunks(1, 0), 64, 4096);
+    // The directory is one read
+    add("ico_entries.ico", ico_entries(), 8, 0xFFFF * 16 + 4096);
+    // Header pieces grow, the comments cost a few dozen reads and are searched once
+    add("hdr_comments.hdr", hdr_comments(1 << 20), 64, (1 << 20) * 2);
+    // meta is one read however large its ipma
+    add("avif_ipma.avif", avif_ipma(0xFFFF), 16, 0xFFFF * 11 + 4096);
+    return list;
+}
+
+}  // namespace adversarial
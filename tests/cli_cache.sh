@@ -0,0 +1,33 @@
+#!/bin/sh
+# Usage: cli_cache.sh IMAGEINFO IMAGES_DIR
+set -e
+
+IMAGEINFO="$1"
+IMAGES_DIR="$2"
+CACHE="${TMPDIR:-/tmp}/imageinfo_tests_$$.cache"
+trap 'rm -f "$CACHE"' EXIT
+
+expect() {
+    if [ "$1" != "$2" ]; then
+        echo "Error cli_cache, expected:"
+        echo "$2"
+        echo "got:"
+        echo "$1"
+        exit 1
+    fi
+}
+
+# A cold and a warm run answer like a run without the cache
+plain=$("$IMAGEINFO" --json "$IMAGES_DIR"/valid/*/*)
+expect "$("$IMAGEINFO" --json --cache "$CACHE" "$IMAGES_DIR"/valid/*/*)" "$plain"
+expect "$("$IMAGEINFO" --json --cache "$CACHE" "$IMAGES_DIR"/valid/*/*)" "$plain"
+
+# Flags the cache can't honour are rejected instead of ignored
+for flags in "--metadata" "--frame-budget 65536" "--scan" "--members"; do
+    if "$IMAGEINFO" --cache "$CACHE" $flags "$IMAGES_DIR/valid/png/sample.png" > /dev/null 2>&1; then
+        echo "Error cli_cache, --cache accepted with $flags"
+        exit 1
+    fi
+done
+
+echo "Test passed, cli cache"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Usage: cli_daemon.sh IMAGEINFO IMAGES_DIR
+set -e
+
+IMAGEINFO="$1"
+IMAGES_DIR="$2"
+SOCKET="${TMPDIR:-/tmp}/imageinfo_tests_$$.sock"
+
+"$IMAGEINFO" daemon --threads 2 "$SOCKET" &
+DAEMON=$!
+trap 'kill $DAEMON 2>/dev/null || true' EXIT
+
+i=0
+while [ ! -S "$SOCKET" ] && [ $i -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+expect() {
+    if ! printf '%s\n' "$1" | grep -q -F "$2"; then
+        echo "Error cli_daemon, expected $2 in:"
+        echo "$1"
+        exit 1
+    fi
+}
+
+out=$("$IMAGEINFO" client "$SOCKET" "$IMAGES_DIR/valid/png/sample.png" "$IMAGES_DIR/invalid/crash_png_1")
+expect "$out" '"format":"png","ext":"png","mimetype":"image/png","width":123,"height":456,'
+expect "$out" '"error":"Unrecognized format"}'
+
+out=$("$IMAGEINFO" client --fd "$SOCKET" "$IMAGES_DIR/valid/ico/multi-size.ico" "$IMAGES_DIR/valid/jpg/rotation-90.jpg")
+expect "$out" '"entries":[[256,256],[128,128],[96,96],[72,72],[64,64],[48,48],[32,32],[24,24],[16,16]]}'
+expect "$out" '"width":3024,"height":4032,'
+
+# Answers come back in request order
+out=$("$IMAGEINFO" client "$SOCKET" "$IMAGES_DIR/valid/gif/sample.gif" "$IMAGES_DIR/valid/bmp/sample.bmp" | cut -c1-200)
+first=$(printf '%s\n' "$out" | head -n 1)
+expect "$first" '"format":"gif"'
+
+echo "Test passed, cli daemon"
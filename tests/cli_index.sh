@@ -0,0 +1,43 @@
+#!/bin/sh
+# Usage: cli_index.sh IMAGEINFO IMAGES_DIR
+set -e
+
+IMAGEINFO="$1"
+IMAGES_DIR="$2"
+INDEX="${TMPDIR:-/tmp}/imageinfo_tests_$$.idx"
+MIXED_INDEX="${TMPDIR:-/tmp}/imageinfo_tests_mixed_$$.idx"
+trap 'rm -f "$INDEX" "$MIXED_INDEX"' EXIT
+
+expect() {
+    if [ "$1" != "$2" ]; then
+        echo "Error cli_index, expected:"
+        echo "$2"
+        echo "got:"
+        echo "$1"
+        exit 1
+    fi
+}
+
+"$IMAGEINFO" index build --threads 2 -o "$INDEX" "$IMAGES_DIR/valid" 2>/dev/null
+
+out=$("$IMAGEINFO" index query "$INDEX" 'width>4000' or 'format=png' 'height>=456')
+expect "$out" "$IMAGES_DIR/valid/jpg/very-large.jpg
+$IMAGES_DIR/valid/png/sample.png"
+
+out=$("$IMAGEINFO" index query --count "$INDEX" format=ico 'entries>1')
+expect "$out" "2"
+
+out=$("$IMAGEINFO" index query --count "$INDEX" format=none)
+expect "$out" "0"
+
+# Unrecognized files have format code 0, a format the index doesn't list must not match them
+"$IMAGEINFO" index build --threads 2 -o "$MIXED_INDEX" "$IMAGES_DIR/valid/png" "$IMAGES_DIR/invalid" 2>/dev/null
+all=$("$IMAGEINFO" index query --count "$MIXED_INDEX" 'width>=0')
+out=$("$IMAGEINFO" index query --count "$MIXED_INDEX" format=none)
+expect "$out" "0"
+out=$("$IMAGEINFO" index query --count "$MIXED_INDEX" 'format!=none')
+expect "$out" "$all"
+out=$("$IMAGEINFO" index query --count "$MIXED_INDEX" 'format!=png' 'width=0')
+expect "$out" "$(ls "$IMAGES_DIR/invalid" | wc -l | tr -d ' ')"
+
+echo "Test passed, cli index"
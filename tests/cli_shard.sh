@@ -0,0 +1,51 @@
+#!/bin/sh
+# Usage: cli_shard.sh IMAGEINFO IMAGES_DIR
+set -e
+
+IMAGEINFO="$1"
+IMAGES_DIR="$2"
+TMP="${TMPDIR:-/tmp}/imageinfo_tests_shard_$$"
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+expect() {
+    if [ "$1" != "$2" ]; then
+        echo "Error cli_shard, expected:"
+        echo "$2"
+        echo "got:"
+        echo "$1"
+        exit 1
+    fi
+}
+
+# Three shards of the same tree, run side by side as on three nodes
+"$IMAGEINFO" --json "$IMAGES_DIR"/valid/*/* > "$TMP/all.ndjson"
+for i in 0 1 2; do
+    "$IMAGEINFO" --json --shard "$i/3" "$IMAGES_DIR"/valid/*/* > "$TMP/shard$i.ndjson" &
+    "$IMAGEINFO" index build --threads 2 --shard "$i/3" -o "$TMP/shard$i.idx" "$IMAGES_DIR/valid" 2>/dev/null &
+done
+wait
+
+# Every file is in exactly one shard
+total=$(wc -l < "$TMP/all.ndjson")
+expect "$(cat "$TMP"/shard*.ndjson | wc -l)" "$total"
+expect "$(cat "$TMP"/shard*.ndjson | sort -u | wc -l)" "$total"
+if [ "$(wc -l < "$TMP/shard0.ndjson")" -eq "$total" ]; then
+    echo "Error cli_shard, shard 0 holds every file"
+    exit 1
+fi
+
+# The merge is sorted and deduplicated, whatever the order and overlap of its inputs
+"$IMAGEINFO" merge "$TMP/shard2.ndjson" "$TMP/shard0.ndjson" "$TMP/shard1.ndjson" "$TMP/shard0.ndjson" \
+    > "$TMP/merged.ndjson" 2> "$TMP/summary"
+expect "$(cat "$TMP/merged.ndjson")" "$(LC_ALL=C sort "$TMP/all.ndjson")"
+duplicates=$(wc -l < "$TMP/shard0.ndjson" | tr -d ' ')
+expect "$(head -n 1 "$TMP/summary")" \
+    "Merged 4 inputs: $total files, $duplicates duplicates, 0 conflicting, 0 lines without a path"
+
+"$IMAGEINFO" merge -o "$TMP/merged.idx" "$TMP/shard0.idx" "$TMP/shard1.idx" "$TMP/shard2.idx" 2>/dev/null
+out=$("$IMAGEINFO" index query "$TMP/merged.idx" 'width>4000' or 'format=png' 'height>=456')
+expect "$out" "$IMAGES_DIR/valid/jpg/very-large.jpg
+$IMAGES_DIR/valid/png/sample.png"
+
+echo "Test passed, cli shard"
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Usage: cli_watch.sh IMAGEINFO IMAGES_DIR
+set -e
+
+IMAGEINFO="$1"
+IMAGES_DIR="$2"
+DIR="${TMPDIR:-/tmp}/imageinfo_tests_watch_$$"
+OUT="$DIR.ndjson"
+mkdir -p "$DIR/tree"
+cp "$IMAGES_DIR/valid/png/sample.png" "$DIR/tree/a.png"
+: > "$OUT"
+
+"$IMAGEINFO" watch --threads 2 --debounce 100 "$DIR/tree" > "$OUT" &
+WATCHER=$!
+trap 'kill $WATCHER 2>/dev/null || true; rm -rf "$DIR" "$OUT"' EXIT
+
+wait_for() {
+    i=0
+    while ! grep -q -F "$1" "$OUT" && [ $i -lt 50 ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    if ! grep -q -F "$1" "$OUT"; then
+        echo "Error cli_watch, expected $1 in:"
+        cat "$OUT"
+        exit 1
+    fi
+}
+
+wait_for '{"event":"scan","path":"'"$DIR/tree/a.png"'","format":"png"'
+wait_for '{"event":"ready","files":1}'
+
+# Written in place, renamed into place, in a new directory, and removed
+cp "$IMAGES_DIR/valid/gif/sample.gif" "$DIR/tree/b.gif"
+cp "$IMAGES_DIR/valid/bmp/sample.bmp" "$DIR/c.tmp"
+mv "$DIR/c.tmp" "$DIR/tree/c.bmp"
+mkdir "$DIR/tree/sub"
+cp "$IMAGES_DIR/valid/jpg/sample.jpg" "$DIR/tree/sub/d.jpg"
+rm "$DIR/tree/a.png"
+
+wait_for '{"event":"update","path":"'"$DIR/tree/b.gif"'","format":"gif"'
+wait_for '{"event":"update","path":"'"$DIR/tree/c.bmp"'","format":"bmp"'
+wait_for '{"event":"update","path":"'"$DIR/tree/sub/d.jpg"'","format":"jpeg"'
+wait_for '{"event":"remove","path":"'"$DIR/tree/a.png"'"}'
+
+mv "$DIR/tree/sub" "$DIR/gone"
+wait_for '{"event":"remove","path":"'"$DIR/tree/sub/d.jpg"'"}'
+
+# Only changed files are parsed again, d.jpg may be seen by both the scan of sub and its events
+if [ "$(grep '"event":"update"' "$OUT" | sed 's/,"format".*//' | sort -u | wc -l)" -ne 3 ]; then
+    echo "Error cli_watch, unexpected updates:"
+    cat "$OUT"
+    exit 1
+fi
+
+echo "Test passed, cli watch"
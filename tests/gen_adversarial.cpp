@@ -0,0 +1,23 @@
+//
+// Writes the adversarial inputs of the performance gates to a directory, for fuzzers and benchmarks
+//
+
+#include <cstdio>
+
+#include "adversarial.hpp"
+
+// Usage: imageinfo_gen_adversarial [DIR]
+int main(int argc, char **argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    for (const auto &input : adversarial::inputs()) {
+        std::string path = dir + "/" + input.name;
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == nullptr || fwrite(input.data.data(), 1, input.data.size(), file) != input.data.size()) {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+            return 1;
+        }
+        fclose(file);
+        printf("%s, %zu bytes\n", path.c_str(), input.data.size());
+    }
+    return 0;
+}
@@ -2,8 +2,13 @@
 // Created by xiaozhuai on 2021/4/1.
 //
 
+#include <chrono>
+#include <cinttypes>
 #include <cstdio>
+#include <cstring>
+#include <vector>
 
+#include "adversarial.hpp"
 #include "imageinfo.hpp"
 
 #define ASSERT_II(file, e, f, w, h)                                                                       \
@@ -27,6 +32,22 @@
         }                                                                                                 \
     } while (0)
 
+#define ASSERT_PIXEL(file, d, c, a, bytes)                                                                      \
+    do {                                                                                                        \
+        auto info = imageinfo::parse<imageinfo::FilePathReader>(file);                                          \
+        if (info.bit_depth() != (d) || info.channels() != (c) || info.has_alpha() != (a)) {                     \
+            fprintf(stderr, "Error ASSERT_PIXEL, file: %s, line: %d, pixel format {%d, %d, %d}\n", file, __LINE__, \
+                    info.bit_depth(), info.channels(), info.has_alpha());                                       \
+            abort();                                                                                            \
+        } else if (info.decoded_bytes_estimate() != (bytes)) {                                                  \
+            fprintf(stderr, "Error ASSERT_PIXEL, file: %s, line: %d, decoded bytes != %ld\n", file, __LINE__,     \
+                    (bytes));                                                                                   \
+            abort();                                                                                            \
+        } else {                                                                                                \
+            printf("Test passed, pixel format of file: %s \n", file);                                           \
+        }                                                                                                       \
+    } while (0)
+
 int main() {
     using namespace imageinfo;
 
@@ -67,6 +88,7 @@ int main() {
 
     {
         ASSERT_II(IMAGES_DIR "valid/gif/sample.gif", kNoError, kFormatGif, 123l, 456l);
+        ASSERT_II(IMAGES_DIR "valid/gif/animated.gif", kNoError, kFormatGif, 32l, 32l);
     }
 
     {
@@ -134,6 +156,7 @@ int main() {
         ASSERT_II(IMAGES_DIR "valid/tiff/big-endian.tiff", kNoError, kFormatTiff, 123l, 456l);
         ASSERT_II(IMAGES_DIR "valid/tiff/jpeg.tiff", kNoError, kFormatTiff, 123l, 456l);
         ASSERT_II(IMAGES_DIR "valid/tiff/little-endian.tiff", kNoError, kFormatTiff, 123l, 456l);
+        ASSERT_II(IMAGES_DIR "valid/tiff/pyramid.tif", kNoError, kFormatTiff, 64l, 32l);
         ASSERT_II(IMAGES_DIR "valid/tiff/BigTIFF.tif", kNoError, kFormatTiff, 64l, 64l);
         ASSERT_II(IMAGES_DIR "valid/tiff/BigTIFFLong.tif", kNoError, kFormatTiff, 64l, 64l);
         ASSERT_II(IMAGES_DIR "valid/tiff/BigTIFFMotorola.tif", kNoError, kFormatTiff, 64l, 64l);
@@ -143,6 +166,7 @@ int main() {
         ASSERT_II(IMAGES_DIR "valid/webp/lossless.webp", kNoError, kFormatWebp, 123l, 456l);
         ASSERT_II(IMAGES_DIR "valid/webp/extended.webp", kNoError, kFormatWebp, 123l, 456l);
         ASSERT_II(IMAGES_DIR "valid/webp/lossy.webp", kNoError, kFormatWebp, 123l, 456l);
+        ASSERT_II(IMAGES_DIR "valid/webp/animated.webp", kNoError, kFormatWebp, 1l, 1l);
     }
 
     {
@@ -169,5 +193,857 @@ int main() {
         ASSERT_II(IMAGES_DIR "invalid/crash_tiff_1", kUnrecognizedFormat, kFormatUnknown, -1l, -1l);
     }
 
+    {
+        ASSERT_PIXEL(IMAGES_DIR "valid/avif/sample.avif", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/heic/sample2.heic", 8, 3, false, 4147200l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/bmp/sample.bmp", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/ico/multi-size.ico", 8, 4, true, 262144l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/dds/sample.dds", 8, 4, true, 224352l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/gif/sample.gif", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/hdr/sample.hdr", 32, 3, false, 673056l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/j2k/_00042.j2k", 12, 3, false, 12441600l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/j2k/cthead1.j2k", 8, 1, false, 65536l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/jp2/sample.jp2", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/jpg/very-large.jpg", 8, 3, false, 51840000l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/ktx/sample.ktx", 8, 4, true, 224352l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/png/sample.png", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/png/sample_apng.png", 8, 4, true, 768000l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/psd/sample.psd", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/qoi/sample.qoi", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/tga/sample.tga", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/tiff/big-endian.tiff", 8, 4, true, 224352l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/tiff/BigTIFFMotorola.tif", 8, 3, false, 12288l);
+        ASSERT_PIXEL(IMAGES_DIR "valid/webp/lossy.webp", 8, 3, false, 168264l);
+        ASSERT_PIXEL(IMAGES_DIR "invalid/sample.png", -1, -1, false, 0l);
+    }
+
+    {
+        ParseOptions budget;
+        budget.frame_scan_budget = 1 << 20;
+        struct {
+            const char *file;
+            int64_t frames;
+            int64_t frames_with_budget;
+        } cases[] = {
+            {IMAGES_DIR "valid/png/sample_apng.png", 34, 34},
+            {IMAGES_DIR "valid/png/sample.png", 1, 1},
+            {IMAGES_DIR "valid/gif/animated.gif", -1, 3},  // Frames past the header cache are not scanned
+            {IMAGES_DIR "valid/gif/sample.gif", 1, 1},
+            // Not looping, the second frame is only seen with a budget
+            {IMAGES_DIR "valid/gif/two-frames.gif", 1, 2},
+            {IMAGES_DIR "valid/webp/animated.webp", 3, 3},
+            {IMAGES_DIR "valid/webp/extended.webp", 1, 1},
+            {IMAGES_DIR "valid/avif/sample3.avif", 44, 44},
+            {IMAGES_DIR "valid/avif/sample.avif", 1, 1},
+        };
+        for (const auto &c : cases) {
+            auto info = parse<FilePathReader>(c.file);
+            auto scanned = parse<FilePathReader>(c.file, kFormatUnknown, {}, false, budget);
+            if (info.frame_count() != c.frames || scanned.frame_count() != c.frames_with_budget ||
+                info.is_animated() != (c.frames != 1)) {
+                fprintf(stderr, "Error frames, file: %s, frames: %" PRId64 ", with budget: %" PRId64 "\n", c.file,
+                        info.frame_count(), scanned.frame_count());
+                abort();
+            }
+            printf("Test passed, frames of file: %s \n", c.file);
+        }
+    }
+
+    {
+        auto expect_levels = [](const char *name, const ImageInfo &info, const ImageLevels &expected) {
+            if (info.levels() != expected) {
+                fprintf(stderr, "Error levels, %s, got %zu levels\n", name, info.levels().size());
+                abort();
+            }
+            printf("Test passed, levels of %s \n", name);
+        };
+        expect_levels("ktx", parse<FilePathReader>(IMAGES_DIR "valid/ktx/sample.ktx"),
+                      {{123, 456}, {61, 228}, {30, 114}, {15, 57}, {7, 28}, {3, 14}, {1, 7}, {1, 3}, {1, 1}});
+        expect_levels("j2k", parse<FilePathReader>(IMAGES_DIR "valid/j2k/sample.j2k"),
+                      {{123, 456}, {62, 228}, {31, 114}, {16, 57}, {8, 29}, {4, 15}});
+        expect_levels("tiff", parse<FilePathReader>(IMAGES_DIR "valid/tiff/pyramid.tif"), {});
+        ParseOptions tiff_levels;
+        tiff_levels.read_tiff_levels = true;
+        auto pyramid =
+            parse<FilePathReader>(IMAGES_DIR "valid/tiff/pyramid.tif", kFormatUnknown, {}, false, tiff_levels);
+        expect_levels("tiff with read_tiff_levels", pyramid, {{64, 32}, {32, 16}, {16, 8}, {8, 4}});
+
+        // 16x8 DX10 cube map array of 2 elements with 3 mip levels
+        std::vector<uint8_t> dds(148, 0);
+        auto put_u32 = [&dds](size_t offset, uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                dds[offset + i] = (uint8_t)(value >> (i * 8));
+            }
+        };
+        memcpy(dds.data(), "DDS ", 4);
+        put_u32(8, 0x20000);  // DDSD_MIPMAPCOUNT
+        put_u32(12, 8);
+        put_u32(16, 16);
+        put_u32(28, 3);
+        put_u32(80, 0x4);  // DDPF_FOURCC
+        memcpy(dds.data() + 84, "DX10", 4);
+        put_u32(136, 0x4);  // DDS_RESOURCE_MISC_TEXTURECUBE
+        put_u32(140, 2);
+        expect_levels("dds", parse<RawDataReader>(RawData(dds.data(), dds.size())),
+                      {{16, 8, 12}, {8, 4, 12}, {4, 2, 12}});
+    }
+
+    {
+        auto rotated = parse<FilePathReader>(IMAGES_DIR "valid/jpg/rotation-90.jpg");
+        auto progressive = parse<FilePathReader>(IMAGES_DIR "valid/jpg/progressive.jpg");
+        if (!(rotated.chroma_subsampling() == ImageSize(2, 2)) || rotated.progressive() ||
+            !(progressive.chroma_subsampling() == ImageSize(1, 1)) || !progressive.progressive()) {
+            fprintf(stderr, "Error JPEG SOF, subsampling or progressive flag\n");
+            abort();
+        }
+        struct {
+            const char *file;
+            ImageSize target;
+            DecodeReduction reduction;
+            int scale_denom;
+            int level;
+            ImageSize decoded_size;
+        } cases[] = {
+            {IMAGES_DIR "valid/jpg/very-large.jpg", {256, 256}, kReductionJpegScale, 8, 0, {600, 450}},
+            {IMAGES_DIR "valid/jpg/very-large.jpg", {1200, 1200}, kReductionJpegScale, 4, 0, {1200, 900}},
+            {IMAGES_DIR "valid/jpg/very-large.jpg", {1201, 1201}, kReductionJpegScale, 2, 0, {2400, 1800}},
+            {IMAGES_DIR "valid/jpg/sample.jpg", {1000, 1000}, kReductionNone, 1, 0, {123, 456}},
+            {IMAGES_DIR "valid/j2k/balloon.j2k", {256, 256}, kReductionLevel, 1, 3, {340, 463}},
+            {IMAGES_DIR "valid/webp/lossy.webp", {16, 16}, kReductionNone, 1, 0, {123, 456}},
+        };
+        for (const auto &c : cases) {
+            auto plan = plan_decode(parse<FilePathReader>(c.file), c.target);
+            if (plan.reduction != c.reduction || plan.scale_denom != c.scale_denom || plan.level != c.level ||
+                !(plan.decoded_size == c.decoded_size)) {
+                fprintf(stderr, "Error plan_decode, file: %s, reduction: %d, 1/%d, level %d\n", c.file, plan.reduction,
+                        plan.scale_denom, plan.level);
+                abort();
+            }
+            printf("Test passed, decode plan of file: %s \n", c.file);
+        }
+
+        // Declared sizes up to 2^32 per side saturate instead of overflowing
+        ImageInfo huge(kFormatJpeg);
+        huge.set_size(0xFFFFFFFFll, 0xFFFFFFFFll);
+        huge.set_pixel_format(16, 3, false);
+        huge.set_progressive(true);
+        huge.set_chroma_subsampling(2, 2);
+        auto huge_plan = plan_decode(huge, ImageSize(0xFFFFFFFFll, 0xFFFFFFFFll));
+        if (huge_plan.decoder_bytes != std::numeric_limits<int64_t>::max() ||
+            huge.decoded_bytes_estimate() != std::numeric_limits<int64_t>::max()) {
+            fprintf(stderr, "Error plan_decode, decoder bytes of a 2^32 square: %" PRId64 "\n",
+                    huge_plan.decoder_bytes);
+            abort();
+        }
+    }
+
+    {
+        ParseOptions no_exif;
+        no_exif.read_exif = false;
+        struct {
+            const char *file;
+            int orientation;
+            ImageSize stored;
+        } cases[] = {
+            {IMAGES_DIR "valid/jpg/rotation-90.jpg", 6, ImageSize(4032, 3024)},
+            {IMAGES_DIR "valid/jpg/1x2-flipped-big-endian.jpg", 8, ImageSize(1, 2)},
+            {IMAGES_DIR "valid/jpg/1x2-flipped-little-endian.jpg", 8, ImageSize(1, 2)},
+            {IMAGES_DIR "valid/jpg/sample.jpg", 1, ImageSize(123, 456)},
+        };
+        for (const auto &c : cases) {
+            auto info = parse<FilePathReader>(c.file);
+            auto raw = parse<FilePathReader>(c.file, kFormatUnknown, {}, false, no_exif);
+            if (info.orientation() != c.orientation || !(info.stored_size() == c.stored) ||
+                raw.orientation() != 1 || !(raw.size() == c.stored)) {
+                fprintf(stderr, "Error orientation, file: %s, orientation: %d, stored: %" PRId64 "x%" PRId64 "\n",
+                        c.file, info.orientation(), info.stored_size().width, info.stored_size().height);
+                abort();
+            }
+            printf("Test passed, orientation of file: %s \n", c.file);
+        }
+    }
+
+    {
+        // Same length and header prefix, the SOF0 segment lives past the prefix
+        auto make_jpeg = [](uint16_t width, uint16_t height) {
+            std::vector<uint8_t> data = {0xFF, 0xD8, 0xFF, 0xE0, 0x07, 0xD0};
+            data.resize(data.size() + 1998, 0);
+            std::vector<uint8_t> sof = {0xFF, 0xC0, 0x00, 0x11, 0x08};
+            sof.push_back(height >> 8);
+            sof.push_back(height & 0xFF);
+            sof.push_back(width >> 8);
+            sof.push_back(width & 0xFF);
+            data.insert(data.end(), sof.begin(), sof.end());
+            data.resize(data.size() + 16, 0);
+            return data;
+        };
+        auto a = make_jpeg(123, 456);
+        auto b = make_jpeg(789, 456);
+        MemoCache cache(16, 2);
+        const std::vector<uint8_t> *payloads[] = {&a, &a, &b, &b, &a};
+        const int64_t widths[] = {123, 123, 789, 789, 123};
+        for (size_t i = 0; i < countof(payloads); ++i) {
+            auto info = parse_memo<RawDataReader>(cache, RawData(payloads[i]->data(), payloads[i]->size()));
+            if (info.format() != kFormatJpeg || info.size().width != widths[i] || info.size().height != 456) {
+                fprintf(stderr, "Error MemoCache, payload: %zu, wrong result\n", i);
+                abort();
+            }
+        }
+        auto stats = cache.stats();
+        if (stats.hits != 3 || stats.misses != 2 || stats.size != 2) {
+            fprintf(stderr, "Error MemoCache, hits: %" PRIu64 ", misses: %" PRIu64 ", size: %zu\n", stats.hits,
+                    stats.misses, stats.size);
+            abort();
+        }
+        printf("Test passed, MemoCache\n");
+    }
+
+    {
+        ParseOptions options;
+        options.read_thumbnails = true;
+        auto expect_thumbnails = [](const char *name, const ImageInfo &info, const Thumbnails &expected) {
+            if (info.thumbnails() != expected) {
+                fprintf(stderr, "Error thumbnails, file: %s, %zu thumbnails\n", name, info.thumbnails().size());
+                for (const auto &t : info.thumbnails()) {
+                    fprintf(stderr, "    {%ld, %zu, %d, %" PRId64 "x%" PRId64 "}\n", (long)t.offset, t.length,
+                            t.format, t.size.width, t.size.height);
+                }
+                abort();
+            }
+            printf("Test passed, thumbnails of file: %s \n", name);
+        };
+        const char *jpg = IMAGES_DIR "valid/jpg/rotation-90.jpg";
+        const char *heic = IMAGES_DIR "valid/heic/sample4.heic";
+        expect_thumbnails(jpg, parse<FilePathReader>(jpg, kFormatUnknown, {}, false, options),
+                          {Thumbnail(114, 9525, kFormatJpeg, ImageSize(160, 120))});
+        expect_thumbnails(jpg, parse<FilePathReader>(jpg), {});
+        expect_thumbnails(heic, parse<FilePathReader>(heic, kFormatUnknown, {}, false, options),
+                          {Thumbnail(2596, 2372, kFormatHeic, ImageSize(512, 288))});
+
+        // 16x8 RGB PSD with a named resource before a 4x2 thumbnail resource of 10 bytes
+        std::vector<uint8_t> psd(106, 0);
+        auto put_be = [&psd](size_t offset, uint32_t value, int size) {
+            for (int i = 0; i < size; ++i) {
+                psd[offset + i] = (uint8_t)(value >> ((size - 1 - i) * 8));
+            }
+        };
+        memcpy(psd.data(), "8BPS\x00\x01", 6);
+        put_be(12, 3, 2);
+        put_be(14, 8, 4);
+        put_be(18, 16, 4);
+        put_be(22, 8, 2);
+        put_be(24, 3, 2);
+        put_be(30, 68, 4);
+        memcpy(psd.data() + 34, "8BIM\x03\xED", 6);
+        psd[40] = 2;
+        memcpy(psd.data() + 41, "ab", 2);
+        put_be(44, 3, 4);
+        memcpy(psd.data() + 52, "8BIM\x04\x0C", 6);
+        put_be(60, 38, 4);
+        put_be(64, 1, 4);
+        put_be(68, 4, 4);
+        put_be(72, 2, 4);
+        auto info = parse<RawDataReader>(RawData(psd.data(), psd.size()), kFormatUnknown, {}, false, options);
+        expect_thumbnails("psd", info, {Thumbnail(92, 10, kFormatJpeg, ImageSize(4, 2))});
+    }
+
+    {
+        static_assert(format_from_mimetype("image/jpeg") == kFormatJpeg, "format_from_mimetype");
+        static_assert(format_from_ext("jpg") == kFormatJpeg, "format_from_ext");
+        static_assert(format_from_ext("jpeg") == kFormatJpeg, "format_from_ext");
+        static_assert(format_from_mimetype("image/none") == kFormatUnknown, "format_from_mimetype");
+        auto info = parse<FilePathReader>(IMAGES_DIR "valid/jpg/rotation-90.jpg");
+        auto compact = CompactImageInfo::from(info);
+        auto expanded = compact.to_image_info();
+        if (strcmp(compact.descriptor().mimetype, "image/jpeg") != 0 || !(expanded.size() == info.size()) ||
+            expanded.orientation() != 6 || expanded.channels() != 3 || strcmp(expanded.full_ext(), "jpeg") != 0 ||
+            CompactImageInfo::from(ImageInfo(kUnrecognizedFormat)).to_image_info().ok()) {
+            fprintf(stderr, "Error CompactImageInfo\n");
+            abort();
+        }
+        printf("Test passed, CompactImageInfo\n");
+    }
+
+    {
+        const char *files[] = {
+            IMAGES_DIR "valid/png/sample.png",
+            IMAGES_DIR "valid/ico/multi-size.ico",
+            IMAGES_DIR "invalid/crash_png_1",
+            IMAGES_DIR "valid/jpg/rotation-90.jpg",
+        };
+        // Room for three rows and ten entry sizes, the fourth file does not fit
+        uint8_t format[3];
+        uint8_t error[3];
+        uint32_t width[3];
+        uint32_t height[3];
+        uint64_t entry_offsets[4];
+        uint32_t entry_widths[10];
+        uint32_t entry_heights[10];
+        BatchColumns<uint32_t> columns;
+        columns.capacity = 3;
+        columns.format = format;
+        columns.error = error;
+        columns.width = width;
+        columns.height = height;
+        columns.entry_capacity = 10;
+        columns.entry_offsets = entry_offsets;
+        columns.entry_widths = entry_widths;
+        columns.entry_heights = entry_heights;
+        BatchSink<uint32_t> sink(columns);
+        size_t consumed = parse_batch<FilePathReader>(files, files + 4, sink);
+        if (consumed != 3 || sink.size() != 3 || sink.entry_size() != 9 || format[0] != kFormatPng ||
+            width[0] != 123 || height[0] != 456 || format[1] != kFormatIco || width[1] != 256 ||
+            entry_offsets[1] != 0 || entry_offsets[2] != 9 || entry_widths[8] != 16 || entry_heights[0] != 256 ||
+            error[2] != kUnrecognizedFormat || entry_offsets[3] != 9) {
+            fprintf(stderr, "Error BatchSink, %zu consumed, %zu rows, %zu entries\n", consumed, sink.size(),
+                    sink.entry_size());
+            abort();
+        }
+
+        // The default int64_t columns keep -1 for the size of a failed parse
+        uint8_t wide_format[1];
+        uint8_t wide_error[1];
+        int64_t wide_width[1];
+        int64_t wide_height[1];
+        BatchColumns<> wide_columns;
+        wide_columns.capacity = 1;
+        wide_columns.format = wide_format;
+        wide_columns.error = wide_error;
+        wide_columns.width = wide_width;
+        wide_columns.height = wide_height;
+        BatchSink<> wide_sink(wide_columns);
+        if (!wide_sink.append(ImageInfo(kUnrecognizedFormat)) || wide_error[0] != kUnrecognizedFormat ||
+            wide_width[0] != -1 || wide_height[0] != -1) {
+            fprintf(stderr, "Error BatchSink, int64_t size of a failed parse: %" PRId64 "x%" PRId64 "\n",
+                    wide_width[0], wide_height[0]);
+            abort();
+        }
+        printf("Test passed, BatchSink\n");
+    }
+
+    {
+        ParseOptions options;
+        options.read_metadata = true;
+        struct Expected {
+            const char *name;
+            MetadataBlocks metadata;
+        };
+        const Expected expected[] = {
+            {"jpg/rotation-90.jpg",
+             {MetadataBlock(kMetadataExif, 34, 9605), MetadataBlock(kMetadataXmp, 9672, 2370),
+              MetadataBlock(kMetadataIcc, 12150, 536)}},
+            {"png/sample_fried.png", {MetadataBlock(kMetadataIcc, 80, 2610, true)}},
+            {"webp/extended.webp", {MetadataBlock(kMetadataIcc, 38, 552)}},
+            {"tiff/big-endian.tiff", {MetadataBlock(kMetadataIcc, 224618, 1960)}},
+            {"heic/sample.heic", {MetadataBlock(kMetadataExif, 481, 90), MetadataBlock(kMetadataXmp, 571, 2795)}},
+        };
+        for (const auto &e : expected) {
+            std::string path = std::string(IMAGES_DIR "valid/") + e.name;
+            auto info = parse<FilePathReader>(path, kFormatUnknown, {}, false, options);
+            if (info.metadata() != e.metadata || !parse<FilePathReader>(path).metadata().empty()) {
+                fprintf(stderr, "Error metadata, file: %s, %zu blocks\n", e.name, info.metadata().size());
+                for (const auto &m : info.metadata()) {
+                    fprintf(stderr, "    {%d, %ld, %zu, %d}\n", m.kind, (long)m.offset, m.length, m.compressed);
+                }
+                abort();
+            }
+            printf("Test passed, metadata of file: %s \n", e.name);
+        }
+    }
+
+    {
+        // Unaligned fields of both byte orders
+        const uint8_t bytes[] = {0x00, 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0};
+        if (BeField<uint32_t, 1>::load(bytes) != 0x12345678 || LeField<uint16_t, 1>::load(bytes) != 0x3412 ||
+            LeField<int8_t, 5>::load(bytes) != (int8_t)0x9A || BeField<int16_t, 5>::load(bytes) != (int16_t)0x9ABC ||
+            BeField<uint64_t, 1>::load(bytes) != 0x123456789ABCDEF0ull ||
+            LeField<uint64_t, 1>::load(bytes) != 0xF0DEBC9A78563412ull) {
+            fprintf(stderr, "Error header fields\n");
+            abort();
+        }
+        printf("Test passed, header fields\n");
+    }
+
+    {
+        const char *check = "123456789";
+        std::vector<uint8_t> data(4099);
+        uint32_t x = 2463534242u;
+        for (auto &b : data) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            b = (uint8_t)x;
+        }
+        // The kernels against a bitwise CRC, at every tail length and alignment
+        auto crc32_bitwise = [](const uint8_t *p, size_t size) {
+            uint32_t crc = ~0u;
+            for (size_t i = 0; i < size; ++i) {
+                crc ^= p[i];
+                for (int k = 0; k < 8; ++k) {
+                    crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+                }
+            }
+            return ~crc;
+        };
+        uint32_t running = crc32(data.data() + 100, data.size() - 100, crc32(data.data(), 100));
+        bool crc_ok = crc32(check, 9) == 0xCBF43926 && crc32(data.data() + 7, 0) == 0 &&
+                      running == crc32(data.data(), data.size());
+        for (size_t size = 0; size < 300 && crc_ok; ++size) {
+            for (size_t start = 0; start < 3; ++start) {
+                crc_ok = crc_ok && crc32(data.data() + start, size) == crc32_bitwise(data.data() + start, size);
+            }
+        }
+        if (!crc_ok) {
+            fprintf(stderr, "Error crc32\n");
+            abort();
+        }
+        printf("Test passed, crc32\n");
+
+        auto read_file = [](const char *path) {
+            std::vector<uint8_t> bytes;
+            FILE *fp = fopen(path, "rb");
+            uint8_t chunk[65536];
+            size_t n;
+            while (fp != nullptr && (n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+                bytes.insert(bytes.end(), chunk, chunk + n);
+            }
+            if (fp != nullptr) {
+                fclose(fp);
+            }
+            return bytes;
+        };
+        auto verify = [](const std::vector<uint8_t> &bytes, VerifyLevel level) {
+            ParseOptions options;
+            options.verify = level;
+            auto info = parse<RawDataReader>(RawData(bytes.data(), bytes.size()), kFormatUnknown, {}, false, options);
+            return info.error();
+        };
+        const char *intact[] = {"png/sample_fried.png", "webp/extended.webp", "jpg/progressive.jpg",
+                                "heic/sample.heic",     "avif/sample.avif",   "jp2/sample.jp2"};
+        for (const char *name : intact) {
+            auto bytes = read_file((std::string(IMAGES_DIR "valid/") + name).c_str());
+            if (bytes.empty() || verify(bytes, kVerifyFull) != kNoError) {
+                fprintf(stderr, "Error verify, file: %s\n", name);
+                abort();
+            }
+        }
+
+        // A flipped bit in the last IDAT only shows at the full level, a trailing byte breaks the RIFF size,
+        // and the COM segment of sample2.jpg is one byte short
+        auto png = read_file(IMAGES_DIR "valid/png/sample_fried.png");
+        png[png.size() - 20] ^= 0x10;
+        auto webp = read_file(IMAGES_DIR "valid/webp/extended.webp");
+        webp.push_back(0);
+        auto jpg = read_file(IMAGES_DIR "valid/jpg/sample2.jpg");
+        if (verify(png, kVerifyHeader) != kNoError || verify(png, kVerifyFull) != kIntegrityCheckFailed ||
+            verify(webp, kVerifyNone) != kNoError || verify(webp, kVerifyHeader) != kIntegrityCheckFailed ||
+            verify(jpg, kVerifyHeader) != kIntegrityCheckFailed) {
+            fprintf(stderr, "Error verify, corrupted files\n");
+            abort();
+        }
+        printf("Test passed, verify\n");
+
+        // Uploads cut in half are reported as truncated, with at most one read more than the plain parse
+        // sample4.heic is ftyp, a meta larger than the header cache, free and mdat
+        const char *complete[] = {"jpg/sample.jpg",   "png/sample_fried.png", "gif/sample.gif",
+                                  "webp/extended.webp", "heic/sample.heic",   "heic/sample4.heic",
+                                  "avif/sample.avif", "ico/sample.ico",       "icns/sample.icns"};
+        for (const char *name : complete) {
+            auto bytes = read_file((std::string(IMAGES_DIR "valid/") + name).c_str());
+            bytes.resize(bytes.size() / 2);
+            size_t reads[2] = {0, 0};
+            Error errors[2] = {kNoError, kNoError};
+            for (int check = 0; check < 2; ++check) {
+                ReadFunc read_func = [&](void *buf, off_t offset, size_t size) {
+                    memcpy(buf, bytes.data() + offset, size);
+                    ++reads[check];
+                };
+                ParseOptions options;
+                options.check_truncation = check == 1;
+                ReadInterface ri(read_func, bytes.size(), options);
+                errors[check] = parse(ri).error();
+            }
+            // Truncated ICO and ICNS directories are only accepted by the detectors when checking
+            bool directory = strstr(name, "ic") == name;
+            if ((errors[0] != kNoError && !directory) || errors[1] != kTruncatedFile ||
+                (!directory && reads[1] > reads[0] + 1)) {
+                fprintf(stderr, "Error truncation, file: %s, error: %d, reads: %zu, %zu\n", name, errors[1], reads[0],
+                        reads[1]);
+                abort();
+            }
+            printf("Test passed, truncation of file: %s \n", name);
+        }
+    }
+
+    {
+        // Performance gates: worst-case inputs stay within their read budget, and well within a second
+        for (const auto &input : adversarial::inputs()) {
+            size_t reads = 0;
+            size_t bytes = 0;
+            ReadFunc read_func = [&](void *buf, off_t offset, size_t size) {
+                memcpy(buf, input.data.data() + offset, size);
+                ++reads;
+                bytes += size;
+            };
+            auto start = std::chrono::steady_clock::now();
+            ReadInterface ri(read_func, input.data.size());
+            auto info = parse(ri);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            if (reads > input.max_reads || bytes > input.max_bytes || ms.count() > 500) {
+                fprintf(stderr, "Error adversarial, file: %s, %zu reads, %zu bytes, %d ms\n", input.name.c_str(), reads,
+                        bytes, (int)ms.count());
+                abort();
+            }
+            printf("Test passed, adversarial file: %s, format: %d, %zu reads, %zu bytes, %d ms\n", input.name.c_str(),
+                   info.format(), reads, bytes, (int)ms.count());
+        }
+    }
+
+    {
+        struct Expected {
+            const char *name;
+            Format format;
+            int64_t width;
+            int64_t height;
+        };
+        const Expected expected[] = {
+            {"animated.gif", kFormatGif, 32, 32},
+            {"png/sample_fried.png", kFormatPng, 128, 68},
+            {"1x2-flipped-big-endian.jpg", kFormatJpeg, 2, 1},
+        };
+        const char *archives[] = {IMAGES_DIR "archive/sample.tar", IMAGES_DIR "archive/sample.zip"};
+        for (const char *archive : archives) {
+            FilePathReader reader(archive);
+            ArchiveMembers members;
+            auto format = list_archive_members(reader, members);
+            bool is_zip = strstr(archive, ".zip") != nullptr;
+            if (format != (is_zip ? kArchiveZip : kArchiveTar) || members.size() != 3) {
+                fprintf(stderr, "Error archive, file: %s, format: %d, members: %zu\n", archive, format,
+                        members.size());
+                abort();
+            }
+            for (size_t i = 0; i < members.size(); ++i) {
+                const auto &member = members[i];
+                const auto &e = expected[i];
+                auto info = parse_member(reader, member);
+                size_t name_size = strlen(e.name);
+                bool name_ok = member.name.size() >= name_size &&
+                               member.name.compare(member.name.size() - name_size, name_size, e.name) == 0;
+                // The jpg is deflated in the zip
+                bool info_ok = is_zip && i == 2 ? !member.stored && info.error() == kUnsupportedMember
+                                                : info.format() == e.format && info.size().width == e.width &&
+                                                      info.size().height == e.height;
+                if (!name_ok || !info_ok) {
+                    fprintf(stderr, "Error archive, file: %s, member: %s, format: %d, %s\n", archive,
+                            member.name.c_str(), info.format(), info.error_msg());
+                    abort();
+                }
+            }
+            printf("Test passed, archive members of file: %s \n", archive);
+        }
+
+        // A zip64 locator in a 42-byte archive points at a record that can not fit
+        uint8_t tiny_zip[42] = {'P', 'K', 0x06, 0x07};
+        memcpy(tiny_zip + 20, "PK\x05\x06", 4);
+        ArchiveMembers members;
+        RawDataReader tiny_reader(RawData(tiny_zip, sizeof(tiny_zip)));
+        if (list_archive_members(tiny_reader, members) != kArchiveUnknown) {
+            fprintf(stderr, "Error archive, 42-byte zip64 archive accepted\n");
+            abort();
+        }
+        printf("Test passed, archive members of a 42-byte zip64 archive\n");
+    }
+
+#ifdef II_COROUTINES
+    {
+        // A fake asynchronous backend, completions are queued and only run a few loop ticks later
+        std::vector<std::pair<int, std::function<void()>>> pending;
+        const char *files[] = {
+            IMAGES_DIR "valid/jpg/rotation-90.jpg",
+            IMAGES_DIR "valid/gif/animated.gif",
+            IMAGES_DIR "valid/heic/sample4.heic",
+            IMAGES_DIR "valid/tiff/pyramid.tif",
+            IMAGES_DIR "invalid/crash_png_1",
+        };
+        ParseOptions options;
+        options.read_tiff_levels = true;
+        options.frame_scan_budget = 1 << 20;
+        for (const char *file : files) {
+            FilePathReader reader(file);
+            size_t sync_reads = 0;
+            ReadFunc read_func = [&](void *buf, off_t offset, size_t size) {
+                ++sync_reads;
+                reader.read(buf, offset, size);
+            };
+            ReadInterface ri(read_func, reader.size(), options);
+            auto expected = parse(ri);
+
+            size_t async_calls = 0;
+            ExecutorReader<FilePathReader> async_reader(reader, [&](std::function<void()> completion) {
+                ++async_calls;
+                pending.emplace_back(3, std::move(completion));
+            });
+            auto task = parse_async(async_reader, kFormatUnknown, {}, false, options);
+            task.start();
+            int ticks = 0;
+            while (!task.done() && ticks < 100000) {
+                ++ticks;
+                for (size_t i = 0; i < pending.size(); ++i) {
+                    if (--pending[i].first == 0) {
+                        auto completion = std::move(pending[i].second);
+                        pending.erase(pending.begin() + (std::ptrdiff_t)i);
+                        completion();
+                        break;
+                    }
+                }
+            }
+            if (!task.done()) {
+                fprintf(stderr, "Error parse_async, file: %s, not done\n", file);
+                abort();
+            }
+            auto &info = task.result();
+            if (info.error() != expected.error() || info.format() != expected.format() ||
+                !(info.size() == expected.size()) || info.frame_count() != expected.frame_count() ||
+                info.levels() != expected.levels() || info.orientation() != expected.orientation()) {
+                fprintf(stderr, "Error parse_async, file: %s, result mismatch\n", file);
+                abort();
+            }
+            // The size plus at most the reads of a blocking parse, each one suspending the task
+            if (async_calls < 2 || async_calls > sync_reads + 1 || ticks < 3 * (int)async_calls) {
+                fprintf(stderr, "Error parse_async, file: %s, %zu async calls, %zu sync reads, %d ticks\n", file,
+                        async_calls, sync_reads, ticks);
+                abort();
+            }
+            printf("Test passed, parse_async of file: %s \n", file);
+        }
+
+        // Misses fetch whole windows, worst-case inputs cost a few passes and not one per read
+        for (const auto &input : adversarial::inputs()) {
+            RawDataReader reader(RawData(input.data.data(), input.data.size()));
+            std::vector<std::function<void()>> queue;
+            size_t async_calls = 0;
+            ExecutorReader<RawDataReader> async_reader(reader, [&](std::function<void()> completion) {
+                ++async_calls;
+                queue.push_back(std::move(completion));
+            });
+            auto start = std::chrono::steady_clock::now();
+            auto task = parse_async(async_reader);
+            task.start();
+            while (!task.done() && !queue.empty()) {
+                auto completion = std::move(queue.back());
+                queue.pop_back();
+                completion();
+            }
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            auto expected = parse<RawDataReader>(RawData(input.data.data(), input.data.size()));
+            if (!task.done() || task.result().format() != expected.format() || ms.count() > 500) {
+                fprintf(stderr, "Error parse_async, adversarial file: %s, %zu async calls, %d ms\n",
+                        input.name.c_str(), async_calls, (int)ms.count());
+                abort();
+            }
+            printf("Test passed, parse_async of adversarial file: %s, %zu async calls, %d ms\n", input.name.c_str(),
+                   async_calls, (int)ms.count());
+        }
+
+        // Full verification of a 16 MiB PNG reads it all, sequential misses double the fetch so passes stay few
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        auto put_chunk = [&png](const char *type, const std::vector<uint8_t> &data) {
+            uint8_t header[8] = {(uint8_t)(data.size() >> 24), (uint8_t)(data.size() >> 16),
+                                 (uint8_t)(data.size() >> 8), (uint8_t)data.size()};
+            memcpy(header + 4, type, 4);
+            png.insert(png.end(), header, header + 8);
+            png.insert(png.end(), data.begin(), data.end());
+            uint32_t crc = crc32(data.data(), data.size(), crc32(header + 4, 4));
+            uint8_t tail[4] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+            png.insert(png.end(), tail, tail + 4);
+        };
+        put_chunk("IHDR", {0, 0, 0x10, 0, 0, 0, 0x10, 0, 8, 2, 0, 0, 0});
+        for (int i = 0; i < 256; ++i) {
+            put_chunk("IDAT", std::vector<uint8_t>(65536, (uint8_t)i));
+        }
+        put_chunk("IEND", {});
+        ParseOptions verify_full;
+        verify_full.verify = kVerifyFull;
+        RawDataReader png_reader(RawData(png.data(), png.size()));
+        size_t png_calls = 0;
+        ExecutorReader<RawDataReader> png_async_reader(png_reader, [&](std::function<void()> completion) {
+            ++png_calls;
+            completion();
+        });
+        auto png_task = parse_async(png_async_reader, kFormatUnknown, {}, false, verify_full);
+        png_task.start();
+        // The size, the first window, then one pass per doubling up to 16 MiB
+        if (!png_task.done() || png_task.result().error() != kNoError || png_calls > 12) {
+            fprintf(stderr, "Error parse_async, full verification of a 16 MiB png, %zu async calls\n", png_calls);
+            abort();
+        }
+        printf("Test passed, parse_async full verification, %zu async calls\n", png_calls);
+    }
+#endif
+
+#ifdef II_POSIX
+    {
+        const char *cache_file = "imageinfo_tests.cache";
+        unlink(cache_file);
+        ResultCache cache;
+        if (!cache.open(cache_file, 64)) {
+            fprintf(stderr, "Error ResultCache, failed to open %s\n", cache_file);
+            abort();
+        }
+        const char *files[] = {
+            IMAGES_DIR "valid/ico/multi-size.ico",
+            IMAGES_DIR "valid/jpg/rotation-90.jpg",
+            IMAGES_DIR "valid/ktx/sample.ktx",
+            IMAGES_DIR "invalid/crash_png_1",
+        };
+        for (int round = 0; round < 2; ++round) {
+            for (const char *file : files) {
+                auto expected = parse<FilePathReader>(file);
+                auto info = parse_cached(cache, file);
+                if (info.error() != expected.error() || info.format() != expected.format() ||
+                    !(info.size() == expected.size()) || info.entry_sizes() != expected.entry_sizes() ||
+                    info.orientation() != expected.orientation() || info.frame_count() != expected.frame_count() ||
+                    info.levels() != expected.levels() ||
+                    strcmp(info.mimetype(), expected.mimetype()) != 0) {
+                    fprintf(stderr, "Error ResultCache, file: %s, round: %d, result mismatch\n", file, round);
+                    abort();
+                }
+            }
+        }
+        if (cache.hits() != 4 || cache.misses() != 4) {
+            fprintf(stderr, "Error ResultCache, hits: %" PRIu64 ", misses: %" PRIu64 "\n", cache.hits(),
+                    cache.misses());
+            abort();
+        }
+        // A file that fails to open must not leave an entry behind once it becomes readable
+        const char *locked_file = "imageinfo_tests_locked.jpg";
+        {
+            FILE *src = fopen(IMAGES_DIR "valid/jpg/rotation-90.jpg", "rb");
+            FILE *dst = fopen(locked_file, "wb");
+            char buf[4096];
+            for (size_t n; (n = fread(buf, 1, sizeof(buf), src)) > 0;) {
+                fwrite(buf, 1, n, dst);
+            }
+            fclose(src);
+            fclose(dst);
+        }
+        chmod(locked_file, 0);
+        auto locked = parse_cached(cache, locked_file);
+        chmod(locked_file, 0644);
+        auto unlocked = parse_cached(cache, locked_file);
+        unlink(locked_file);
+        // Root opens the file either way
+        if ((geteuid() != 0 && locked.ok()) || unlocked.format() != kFormatJpeg) {
+            fprintf(stderr, "Error ResultCache, unreadable file: %s, then: %s\n", locked.error_msg(),
+                    unlocked.error_msg());
+            abort();
+        }
+        cache.close();
+        unlink(cache_file);
+        printf("Test passed, ResultCache\n");
+    }
+
+    {
+        auto read_all = [](FILE *fp) {
+            std::vector<uint8_t> data;
+            uint8_t chunk[65536];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+                data.insert(data.end(), chunk, chunk + n);
+            }
+            return data;
+        };
+
+        // extended.webp with an EXIF chunk appended, stripping gives back the original bytes
+        FILE *fp = fopen(IMAGES_DIR "valid/webp/extended.webp", "rb");
+        auto original = read_all(fp);
+        fclose(fp);
+        auto webp = original;
+        const uint8_t exif[] = {'E', 'X', 'I', 'F', 5, 0, 0, 0, 'M', 'M', 0, '*', 0, 0};
+        webp.insert(webp.end(), exif, exif + sizeof(exif));
+        webp[4] += sizeof(exif);
+        webp[20] |= 0x08;
+        RawDataReader webp_reader(RawData(webp.data(), webp.size()));
+        StripPlan plan;
+        std::vector<uint8_t> stripped;
+        if (plan_strip_metadata(webp_reader, plan)) {
+            for (const auto &segment : plan) {
+                const uint8_t *p = segment.bytes.empty() ? webp.data() + segment.offset
+                                                         : (const uint8_t *)segment.bytes.data();
+                stripped.insert(stripped.end(), p, p + segment.length);
+            }
+        }
+        if (stripped != original) {
+            fprintf(stderr, "Error strip_metadata, webp, %zu segments, %zu bytes\n", plan.size(), stripped.size());
+            abort();
+        }
+
+        // The JPEG keeps its ICC profile only, and is reported as stored without the EXIF orientation
+        int in_fd = open(IMAGES_DIR "valid/jpg/rotation-90.jpg", O_RDONLY);
+        FILE *out = tmpfile();
+        bool ok = in_fd >= 0 && out != nullptr && strip_metadata(in_fd, fileno(out));
+        close(in_fd);
+        rewind(out);
+        auto jpg = read_all(out);
+        fclose(out);
+        ParseOptions options;
+        options.read_metadata = true;
+        auto info = parse<RawDataReader>(RawData(jpg.data(), jpg.size()), kFormatUnknown, {}, false, options);
+        if (!ok || jpg.size() != 4088952 || !(info.size() == ImageSize(4032, 3024)) ||
+            info.metadata() != MetadataBlocks{MetadataBlock(kMetadataIcc, 132, 536)}) {
+            fprintf(stderr, "Error strip_metadata, jpg, %zu bytes, %zu metadata blocks\n", jpg.size(),
+                    info.metadata().size());
+            abort();
+        }
+
+        // The COM segment of sample2.jpg is one byte short, the stray byte goes with it
+        fp = fopen(IMAGES_DIR "valid/jpg/sample2.jpg", "rb");
+        auto short_com = read_all(fp);
+        fclose(fp);
+        RawDataReader short_com_reader(RawData(short_com.data(), short_com.size()));
+        stripped.clear();
+        if (plan_strip_metadata(short_com_reader, plan)) {
+            for (const auto &segment : plan) {
+                stripped.insert(stripped.end(), short_com.data() + segment.offset,
+                                short_com.data() + segment.offset + segment.length);
+            }
+        }
+        ParseOptions verify_header;
+        verify_header.verify = kVerifyHeader;
+        auto short_com_info = parse<RawDataReader>(RawData(short_com.data(), short_com.size()));
+        auto stripped_info =
+            parse<RawDataReader>(RawData(stripped.data(), stripped.size()), kFormatUnknown, {}, false, verify_header);
+        if (stripped.empty() || stripped.size() >= short_com.size() || !stripped_info.ok() ||
+            !(stripped_info.size() == short_com_info.size())) {
+            fprintf(stderr, "Error strip_metadata, jpg with a short COM segment, %zu bytes, error: %s\n",
+                    stripped.size(), stripped_info.error_msg());
+            abort();
+        }
+        printf("Test passed, strip_metadata\n");
+    }
+
+    {
+        std::vector<std::string> paths = {IMAGES_DIR "valid/png/sample.png", IMAGES_DIR "valid/jpg/sample.jpg",
+                                          IMAGES_DIR "not-exists", IMAGES_DIR "valid/gif/sample.gif"};
+        const Format formats[] = {kFormatPng, kFormatJpeg, kFormatUnknown, kFormatGif};
+        ScanQueue queue(paths, 2);
+        ScanFile file;
+        size_t count = 0;
+        while (queue.next(file)) {
+            auto info = parse<ScanFileReader>(file);
+            if (count >= paths.size() || file.path != paths[count] || info.format() != formats[count]) {
+                fprintf(stderr, "Error ScanQueue, file: %s, format: %d\n", file.path.c_str(), info.format());
+                abort();
+            }
+            ++count;
+        }
+        if (count != paths.size()) {
+            fprintf(stderr, "Error ScanQueue, %zu files\n", count);
+            abort();
+        }
+        printf("Test passed, ScanQueue\n");
+    }
+#endif
+
     return 0;
 }